@@ -0,0 +1,206 @@
+// AckSession.h - Confirms that every receiver in the fleet heard a set of state frames.
+//
+// Broadcasts get no MAC ACK, and if every receiver answered one at once the replies would
+// collide. A session follows its frames with an AckRequestFrame naming the ack ids not
+// yet confirmed; receivers answer in turn, ACK_SLOT_US apart, and each Ack sets a bit in
+// a mask. When a round's window closes with receivers still silent, the frames go again
+// to those receivers alone: by unicast to the ones whose MAC an earlier Ack gave away, by
+// broadcast if any has never answered. A request naming only them follows. After
+// ACK_MAX_ROUNDS the session gives up.
+//
+// onAck() runs in the ESP-NOW receive callback; everything else belongs to the loop.
+// Nothing here touches the hardware, so the host-side simulator in
+// lib/NightDriverReceiver/examples/AckSim builds it as well.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "ESPNowProtocol.h"
+#include "Redundancy.h"
+#include "StaticPool.h"
+
+// One Ack, the SIFS and MAC ACK after it, DIFS and the largest initial backoff (15 slots
+// of 20 us), so a reply never spills into the next receiver's turn
+constexpr uint32_t ACK_SLOT_US    = 1300;
+constexpr uint32_t ACK_GUARD_US   = 4000;       // Request air time and receiver latency
+constexpr uint32_t ACK_MAX_ROUNDS = 4;
+
+static_assert(ACK_SLOT_US >= frameAirtimeMicros() + 10 + 304 + 50 + 15 * 20, "Ack slot too short");
+static_assert(ACK_SLOT_US % ACK_SLOT_UNIT_US == 0 && ACK_SLOT_US / ACK_SLOT_UNIT_US <= 255,
+              "Ack slot can't be carried in an AckRequestFrame");
+
+constexpr uint32_t countIds(uint64_t ids)
+{
+    uint32_t count = 0;
+    for (; ids; ids &= ids - 1)
+        count++;
+    return count;
+}
+
+class AckSession
+{
+  public:
+    enum class Action : uint8_t
+    {
+        None,
+        Request,            // Send the request from makeRequest()
+        Resend              // Send pendingFrames() again to the missing() receivers, then a request
+    };
+
+    // Ack ids 0 to count - 1 are expected to confirm
+    void setFleet(size_t count)
+    {
+        expected.store(count >= MAX_ACK_IDS ? ~uint64_t(0) : (uint64_t(1) << count) - 1, std::memory_order_relaxed);
+    }
+
+    size_t fleetSize() const    { return countIds(expected.load(std::memory_order_relaxed)); }
+
+    // Adds a frame just sent. Frames tracked together, before poll() asks for the request,
+    // are confirmed together; a frame tracked later starts a new transaction and abandons
+    // the old one. False if the transaction already holds MAX_ACK_SEQUENCES frames.
+    bool track(const RepeatScheduler::Frame& frame, uint16_t sequence, uint32_t nowMicros)
+    {
+        if (state != State::Gathering)
+        {
+            if (state == State::Waiting)
+                abandoned++;
+
+            key.store(0, std::memory_order_relaxed);
+            acked.store(0, std::memory_order_relaxed);
+            key.store(sequence, std::memory_order_release);
+            frames.clear();
+            sequences.clear();
+            round        = 0;
+            startMicros  = nowMicros;
+            state        = State::Gathering;
+            transactions++;
+        }
+
+        return sequences.push_back(sequence) && frames.push_back(frame);
+    }
+
+    Action poll(uint32_t nowMicros)
+    {
+        switch (state)
+        {
+            case State::Gathering:
+                return Action::Request;
+
+            case State::Waiting:
+                if (missing() == 0)
+                {
+                    uint32_t elapsed = completeMicros.load(std::memory_order_acquire) - startMicros;
+                    lastMicros  = elapsed;
+                    worstMicros = elapsed > worstMicros ? elapsed : worstMicros;
+                    lastRounds  = round;
+                    confirmed++;
+                    state = State::Idle;
+                    return Action::None;
+                }
+                if (int32_t(nowMicros - windowEndMicros) < 0)
+                    return Action::None;
+                if (round >= ACK_MAX_ROUNDS)
+                {
+                    lastRounds = round;
+                    gaveUp++;
+                    state = State::Idle;
+                    return Action::None;
+                }
+                return Action::Resend;
+
+            default:
+                return Action::None;
+        }
+    }
+
+    // Builds the request for the receivers still missing and opens its window. A
+    // 'slotMicros' of zero asks for immediate replies, for comparison.
+    void makeRequest(AckRequestFrame& out, uint8_t groups, uint32_t nowMicros, uint32_t slotMicros = ACK_SLOT_US)
+    {
+        uint64_t ids = missing();
+        out = AckRequestFrame{ids, slotMicros, groups};
+        for (uint16_t sequence : sequences)
+            out.addSequence(sequence);
+
+        if (round > 0)
+            resends++;
+        round++;
+        windowEndMicros = nowMicros + countIds(ids) * ACK_SLOT_US + ACK_GUARD_US;
+        state = State::Waiting;
+    }
+
+    // Called from the receive callback for every Ack
+    void onAck(uint32_t id, uint16_t sequence, const uint8_t* mac, uint32_t nowMicros)
+    {
+        if (id >= MAX_ACK_IDS || sequence == 0 || sequence != key.load(std::memory_order_acquire))
+            return;
+
+        uint64_t bit = uint64_t(1) << id;
+        memcpy(macs[id].data(), mac, macs[id].size());
+        known.fetch_or(bit, std::memory_order_release);
+
+        uint64_t fleet  = expected.load(std::memory_order_relaxed);
+        uint64_t before = acked.fetch_or(bit, std::memory_order_acq_rel);
+        if ((before & fleet) != fleet && ((before | bit) & fleet) == fleet)
+            completeMicros.store(nowMicros, std::memory_order_release);
+    }
+
+    uint64_t missing() const
+    {
+        return expected.load(std::memory_order_relaxed) & ~acked.load(std::memory_order_acquire);
+    }
+
+    // The MAC receiver 'id' last replied from, or nullptr if it never has
+    const uint8_t* macOf(uint8_t id) const
+    {
+        return id < MAX_ACK_IDS && (known.load(std::memory_order_acquire) >> id & 1) ? macs[id].data() : nullptr;
+    }
+
+    const StaticVector<RepeatScheduler::Frame, MAX_ACK_SEQUENCES>& pendingFrames() const { return frames; }
+
+    bool busy() const                   { return state != State::Idle; }
+
+    uint32_t transactionCount() const   { return transactions; }
+    uint32_t confirmedCount() const     { return confirmed; }
+    uint32_t gaveUpCount() const        { return gaveUp; }
+    uint32_t abandonedCount() const     { return abandoned; }
+    uint32_t resendCount() const        { return resends; }
+    uint32_t lastConfirmMicros() const  { return lastMicros; }
+    uint32_t worstConfirmMicros() const { return worstMicros; }
+    uint32_t lastRoundCount() const     { return lastRounds; }
+
+  private:
+    enum class State : uint8_t
+    {
+        Idle,
+        Gathering,          // Frames tracked, request not yet sent
+        Waiting             // Request sent, window open
+    };
+
+    State    state = State::Idle;
+    StaticVector<RepeatScheduler::Frame, MAX_ACK_SEQUENCES> frames;
+    StaticVector<uint16_t, MAX_ACK_SEQUENCES> sequences;
+    uint32_t round           = 0;
+    uint32_t startMicros     = 0;
+    uint32_t windowEndMicros = 0;
+
+    // Shared with the receive callback
+    std::atomic<uint64_t> expected{0};
+    std::atomic<uint64_t> acked{0};
+    std::atomic<uint64_t> known{0};
+    std::atomic<uint16_t> key{0};
+    std::atomic<uint32_t> completeMicros{0};
+    std::array<std::array<uint8_t, 6>, MAX_ACK_IDS> macs = {};
+
+    uint32_t transactions = 0;
+    uint32_t confirmed    = 0;
+    uint32_t gaveUp       = 0;
+    uint32_t abandoned    = 0;
+    uint32_t resends      = 0;
+    uint32_t lastMicros   = 0;
+    uint32_t worstMicros  = 0;
+    uint32_t lastRounds   = 0;
+};
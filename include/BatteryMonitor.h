@@ -0,0 +1,94 @@
+// BatteryMonitor.h - Filtered LiPo voltage and state of charge from the ADC.
+//
+// Each sample is the median of three conversions, which rejects the spikes the radio
+// induces on the ADC, and then feeds an exponential moving average. State of charge is
+// interpolated from a typical single-cell LiPo discharge curve.
+
+#pragma once
+
+#include <Arduino.h>
+#include <algorithm>
+#include <array>
+
+class BatteryMonitor
+{
+  public:
+    // 'dividerRatio' is battery voltage over pin voltage for the board's sense divider
+    BatteryMonitor(uint8_t adcPin, float dividerRatio, uint32_t sampleIntervalMillis)
+        : pin(adcPin), ratio(dividerRatio), interval(sampleIntervalMillis)
+    {
+    }
+
+    void begin()
+    {
+        analogSetPinAttenuation(pin, ADC_11db);
+        filtered = readMilliVolts() << FILTER_SHIFT;
+        lastSample = millis();
+    }
+
+    // Takes a sample if one is due; returns true if it did
+
+    bool poll()
+    {
+        if (millis() - lastSample < interval)
+            return false;
+
+        lastSample = millis();
+        int32_t sample = readMilliVolts() << FILTER_SHIFT;
+        filtered += (sample - filtered) >> FILTER_SHIFT;
+        return true;
+    }
+
+    uint32_t milliVolts() const
+    {
+        return filtered >> FILTER_SHIFT;
+    }
+
+    // 0.0 (empty) to 1.0 (full)
+
+    float stateOfCharge() const
+    {
+        uint32_t mv = milliVolts();
+        if (mv <= DISCHARGE_CURVE.front().milliVolts)
+            return 0.0f;
+
+        for (size_t i = 1; i < DISCHARGE_CURVE.size(); i++)
+        {
+            const auto& low  = DISCHARGE_CURVE[i - 1];
+            const auto& high = DISCHARGE_CURVE[i];
+            if (mv < high.milliVolts)
+                return (low.percent + (high.percent - low.percent) * float(mv - low.milliVolts) /
+                        (high.milliVolts - low.milliVolts)) / 100.0f;
+        }
+        return 1.0f;
+    }
+
+  private:
+    // Filter weight of each new sample is 1/2^FILTER_SHIFT
+    static constexpr int FILTER_SHIFT = 3;
+
+    struct CurvePoint
+    {
+        uint32_t milliVolts;
+        uint32_t percent;
+    };
+
+    static constexpr std::array<CurvePoint, 10> DISCHARGE_CURVE =
+    {{
+        {3300, 0}, {3500, 5}, {3600, 10}, {3700, 25}, {3750, 40},
+        {3800, 55}, {3900, 70}, {4000, 82}, {4100, 92}, {4200, 100}
+    }};
+
+    int32_t readMilliVolts() const
+    {
+        std::array<uint32_t, 3> reads = {analogReadMilliVolts(pin), analogReadMilliVolts(pin), analogReadMilliVolts(pin)};
+        std::sort(reads.begin(), reads.end());
+        return int32_t(reads[1] * ratio);
+    }
+
+    uint8_t  pin;
+    float    ratio;
+    uint32_t interval;
+    int32_t  filtered   = 0;
+    uint32_t lastSample = 0;
+};
@@ -0,0 +1,104 @@
+// ChannelSurvey.h - How busy each WiFi channel is, for picking the one ESP-NOW runs on.
+//
+// The radio listens in promiscuous mode on each channel the country setting allows for
+// SURVEY_DWELL_MS and adds up every frame it hears: how many, the strongest signal and,
+// from each frame's PHY rate and length, the time it held the air. That airtime as a
+// share of the dwell is the channel's busy figure, and the ranking is by busy share,
+// then by frame count. Interference that isn't a decodable 802.11 frame (Bluetooth,
+// microwave ovens) is missed, but the mean noise floor hints at it.
+//
+// run() blocks the loop for the sweep, about two and a half seconds, and puts the radio
+// back on the channel it started on. Nothing sent meanwhile goes out on the right
+// channel, and replies are missed, so run it between commands. It takes over the
+// promiscuous callback, so it can't run during a sniffer capture.
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+#include <atomic>
+#include "HotPath.h"
+#include "StaticPool.h"
+
+constexpr uint32_t SURVEY_DWELL_MS  = 180;
+constexpr size_t   MAX_WIFI_CHANNEL = 14;
+
+// Time on air, in microseconds, of a frame of 'length' bytes (FCS included) received at
+// the rate given by the radio's rx_ctrl fields. Covers 802.11b (rate codes 0-7), OFDM
+// (8-15) and HT MCS 0-31; anything else counts as 1 Mb/s.
+
+constexpr uint32_t frameAirtimeMicros(unsigned sigMode, unsigned rate, unsigned mcs, bool wide, bool shortGuard,
+                                      size_t length)
+{
+    uint32_t bits = uint32_t(length) * 8;
+    if (sigMode == 0 && rate < 8)
+    {
+        // DSSS and CCK: 1, 2, 5.5 and 11 Mb/s, long preamble below 4 and short above
+        constexpr uint32_t HALF_MBPS[8] = { 2, 4, 11, 22, 4, 4, 11, 22 };
+        uint32_t preamble = rate < 4 ? 192 : 96;
+        return preamble + (bits * 2 + HALF_MBPS[rate] - 1) / HALF_MBPS[rate];
+    }
+    if (sigMode == 0)
+    {
+        // OFDM: 16 service and 6 tail bits, 4 us symbols after a 20 us preamble
+        constexpr uint32_t MBPS[8] = { 48, 24, 12, 6, 54, 36, 18, 9 };
+        uint32_t perSymbol = MBPS[rate - 8] * 4;
+        return 20 + 4 * ((16 + bits + 6 + perSymbol - 1) / perSymbol);
+    }
+
+    // HT mixed format, one more 4 us training field per extra spatial stream
+    constexpr uint32_t BITS_20MHZ[8] = { 26, 52, 78, 104, 156, 208, 234, 260 };
+    constexpr uint32_t BITS_40MHZ[8] = { 54, 108, 162, 216, 324, 432, 486, 540 };
+    uint32_t streams   = (mcs & 31) / 8 + 1;
+    uint32_t perSymbol = (wide ? BITS_40MHZ : BITS_20MHZ)[mcs % 8] * streams;
+    uint32_t symbols   = (16 + bits + 6 + perSymbol - 1) / perSymbol;
+    return 32 + 4 * streams + (shortGuard ? (symbols * 36 + 9) / 10 : symbols * 4);
+}
+
+static_assert(frameAirtimeMicros(0, 0, 0, false, false, 100) == 992, "1 Mb/s airtime is off");
+static_assert(frameAirtimeMicros(0, 11, 0, false, false, 100) == 20 + 4 * 35, "6 Mb/s airtime is off");
+static_assert(frameAirtimeMicros(1, 0, 7, false, false, 1500) == 36 + 4 * 47, "MCS 7 airtime is off");
+
+class ChannelSurvey
+{
+  public:
+    struct Channel
+    {
+        uint8_t  number;
+        uint32_t frames;
+        uint32_t airtimeMicros;
+        uint16_t busyPermille;      // Airtime over the dwell
+        int8_t   strongestRssi;     // dBm, or 0 if nothing was heard
+        int8_t   noiseFloor;        // Mean over the frames heard, dBm
+    };
+
+    // Listens on every allowed channel in turn; false if promiscuous mode couldn't start
+    bool run();
+
+    bool hasRun() const                 { return !table.empty(); }
+
+    // Channels from least to most congested
+    const StaticVector<Channel, MAX_WIFI_CHANNEL>& ranking() const  { return table; }
+
+    // The least busy channel, if 'current' is busier than it by at least 'marginPermille';
+    // otherwise, or without a survey, 'current'
+    uint8_t recommend(uint8_t current, uint16_t marginPermille) const;
+
+    void report(Print& out, uint8_t current) const;
+
+  private:
+    static void HOT_PATH onPacket(void* buffer, wifi_promiscuous_pkt_type_t type);
+    void HOT_PATH count(const wifi_pkt_rx_ctrl_t& rx);
+    Channel listen(uint8_t channel);
+    const Channel* find(uint8_t channel) const;
+
+    static ChannelSurvey* active;
+
+    StaticVector<Channel, MAX_WIFI_CHANNEL> table;
+
+    // Written by the callback during a dwell
+    std::atomic<uint32_t> frames{0};
+    std::atomic<uint32_t> airtime{0};
+    std::atomic<int32_t>  noiseSum{0};
+    std::atomic<int32_t>  strongest{INT8_MIN};
+};
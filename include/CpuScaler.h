@@ -0,0 +1,85 @@
+// CpuScaler.h - Runs the CPU at CPU_IDLE_MHZ while waiting for input, CPU_MAX_MHZ after it.
+//
+// The remote spends nearly all its time waiting for a press, and a 240 MHz CPU waiting
+// draws more than an 80 MHz one. begin() sets up ESP-IDF power management with those two
+// limits and a CPU_FREQ_MAX lock. The input ISRs take the lock (it may be taken from an
+// ISR), so the loop that sends the frames and redraws the OLED already runs at full speed.
+// poll() gives it back once nothing has needed it for CPU_BOOST_HOLD_MS. 80 MHz is as low
+// as it goes: below that the APB clock drops with the CPU and the UART's baud rate with it.
+//
+// If the SDK was built without power management, esp_pm_configure() says so and the same
+// scheme runs on setCpuFrequencyMhz() from the loop instead. The ISR then only flags the
+// press, so the switch to full speed adds to the time to send.
+//
+// To tell whether any of this costs latency, each press's time from the edge it is acted
+// on (the button's release) to first frame is filed by the clock that edge found: low, or
+// already at full speed (within the hold, or with scaling switched off). Time spent awake at the low clock, less any light sleep,
+// is charged at CPU_IDLE_SAVING_MILLIAMPS below full speed to give the charge saved.
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_pm.h>
+#include <atomic>
+#include "HotPath.h"
+
+constexpr uint32_t CPU_MAX_MHZ               = 240;
+constexpr uint32_t CPU_IDLE_MHZ              = 80;
+constexpr uint32_t CPU_BOOST_HOLD_MS         = 250;
+constexpr float    CPU_IDLE_SAVING_MILLIAMPS = 20.0f;     // 240 vs 80 MHz with the radio listening
+
+class CpuScaler
+{
+  public:
+    // Configures power management, or falls back to setting the frequency directly
+    bool begin();
+
+    // Off holds full speed for good
+    void setEnabled(bool on);
+    bool isEnabled() const          { return enabled; }
+
+    // From an input ISR
+    void HOT_PATH boostFromIsr();
+
+    // From the loop, for work that has no ISR of its own (the console, the benchmark)
+    void boost();
+
+    // Each loop iteration. 'busy' holds full speed while frames are still going out;
+    // 'lightSleptMicros' is the running total of light sleep, which saves nothing extra.
+    void poll(bool busy, uint64_t lightSleptMicros);
+
+    // The first frame after a press has gone out, 'latencyMicros' after the edge
+    void onPressSent(uint32_t latencyMicros);
+
+    void report(Print& out) const;
+
+  private:
+    struct Latency
+    {
+        uint32_t presses;
+        uint64_t totalMicros;
+        uint32_t worstMicros;
+    };
+
+    void raise();
+    void lower();
+    static void printLatency(Print& out, const char* name, const Latency& latency);
+
+    bool                 usePmLock = false;
+    esp_pm_lock_handle_t lock      = nullptr;
+    bool                 enabled   = true;
+
+    std::atomic<bool> boosted{false};           // The lock is held, or the clock set high
+    std::atomic<bool> boostPending{false};      // A press the loop has yet to see
+    std::atomic<bool> pressFoundLow{false};
+    std::atomic<uint32_t> boosts{0};            // Times the clock went from low to full
+    uint32_t boostedAtMillis = 0;
+
+    int64_t  lastPollMicros       = 0;
+    uint64_t lastLightSleptMicros = 0;
+    uint64_t lowClockAwakeMicros  = 0;
+    uint64_t highClockMicros      = 0;
+
+    Latency lowStart  = {};
+    Latency highStart = {};
+};
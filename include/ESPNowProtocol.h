@@ -0,0 +1,810 @@
+// ESPNowProtocol.h - Wire format shared with the NightDriverStrip receiver.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Command set for ESPNOW protocol. Values must match the receiver's expectations.
+// Starting at 1 allows detection of uninitialized/corrupted commands.
+// INVALID provides error detection in network protocol.
+
+enum class ESPNowCommand : uint8_t 
+{
+    NextEffect = 1,
+    PrevEffect,
+    SetEffect,
+    SetBrightness,
+    GetManifestHash,        // Asks receivers for the MANIFEST_HASH they were built with
+    ManifestHash,           // Reply to GetManifestHash; arg1 is the hash
+    AllOff,                 // Blank immediately; arg1 is a burst id, repeats of one id are ignored
+    SetStates,              // Effect and brightness per receiver slot; a StatesFrame, not a Message
+    AckRequest,             // Asks receivers to confirm frames; an AckRequestFrame, not a Message
+    Ack,                    // Reply to AckRequest; arg1 is the ack id, the sequence the first one asked about
+    GetState,               // Asks receivers for the effect and brightness they are showing
+    State,                  // Reply to GetState; arg1 is a packState(), the sequence the request's
+    GetTelemetry,           // Asks receivers for their health readings
+    Telemetry,              // Reply to GetTelemetry; a TelemetryFrame, not a Message
+    Probe,                  // One numbered frame of a loss test stream; a ProbeFrame, not a Message
+    GetProbeReport,         // Asks receivers what they heard of a probe stream; arg1 is the stream id
+    ProbeReport,            // Reply to GetProbeReport; a ProbeReportFrame, not a Message
+    ChannelSwitch,          // Move to the WiFi channel in arg1; the remote follows once its repeats are out
+    INVALID = 255
+};
+
+// Network message format for ESPNOW communication.
+// Packed to ensure consistent wire format between different compilers/platforms.
+// Includes size field for protocol versioning and validation.
+//
+// The sequence number lets receivers drop the redundant copies of a frame that remotes
+// send to make up for broadcasts having no ACK. Zero means unsequenced: such frames are
+// never treated as copies.
+//
+// The group mask says which receivers the frame is for. Each receiver is configured with
+// the groups it belongs to and acts on a frame only if the two masks share a bit, which
+// is a single AND; see isAddressedTo(). ALL_GROUPS reaches every receiver.
+//
+// Frames from remotes that predate both fields are LEGACY_MESSAGE_SIZE bytes long and
+// decode as unsequenced and addressed to all groups.
+
+constexpr size_t  LEGACY_MESSAGE_SIZE = 6;
+constexpr uint8_t ALL_GROUPS          = 0xFF;
+
+constexpr bool isAddressedTo(uint8_t frameGroups, uint8_t memberGroups)
+{
+    return (frameGroups & memberGroups) != 0;
+}
+
+class Message 
+{
+public:
+    constexpr Message(ESPNowCommand cmd, uint32_t argument, uint16_t sequenceNumber = 0,
+                      uint8_t groupMask = ALL_GROUPS)
+        : size(sizeof(Message)), command(cmd), arg1(argument), sequence(sequenceNumber), groups(groupMask)
+    {
+    }
+
+    // A default-constructed message is INVALID, so it can never be mistaken for a command
+    constexpr Message() : Message(ESPNowCommand::INVALID, 0)
+    {
+    }
+
+    // Provides raw byte access for network transmission while maintaining type safety
+    const uint8_t* data() const 
+    {
+        return reinterpret_cast<const uint8_t*>(this);
+    }
+
+    constexpr size_t byte_size() const 
+    {
+        return sizeof(Message);
+    }
+
+    constexpr ESPNowCommand getCommand() const
+    {
+        return command;
+    }
+
+    constexpr uint32_t getArgument() const
+    {
+        return arg1;
+    }
+
+    constexpr uint16_t getSequence() const
+    {
+        return sequence;
+    }
+
+    constexpr uint8_t getGroups() const
+    {
+        return groups;
+    }
+
+private:
+    uint8_t       size;       // Protocol versioning and message validation
+    ESPNowCommand command;    // Operation to perform
+    uint32_t      arg1;       // Command-specific parameter (e.g., effect index)
+    uint16_t      sequence;   // Shared by the redundant copies of one frame; 0 if unsequenced
+    uint8_t       groups;     // Receiver groups the frame is for
+} __attribute__((packed));    // Packed on both ends (send and receive) so they agree on the size
+
+// Effect and brightness in one argument: the effect's wire index in the low byte and the
+// brightness in the next
+
+constexpr uint32_t packState(uint32_t effect, uint8_t brightness)
+{
+    return (effect & 0xFF) | uint32_t(brightness) << 8;
+}
+
+constexpr uint8_t stateEffect(uint32_t argument)        { return uint8_t(argument); }
+constexpr uint8_t stateBrightness(uint32_t argument)    { return uint8_t(argument >> 8); }
+
+// Reference decoder
+//
+// Receivers hand it whatever arrived from the air, so it trusts nothing: the frame must
+// be exactly one Message (or one legacy message) long, carry that length in its size field
+// and name a command this build knows. Fields are read byte by byte in little-endian order rather than by
+// casting the buffer, so it is independent of alignment and of the host's byte order.
+// Everything is constexpr, which lets the round trip be checked at compile time below.
+
+enum class DecodeResult : uint8_t
+{
+    Ok,
+    TooShort,           // Fewer bytes than a legacy message
+    SizeMismatch,       // Size field disagrees with the frame length, or neither is a known size
+    UnknownCommand,     // Not a command this build knows
+    InvalidCommand      // The INVALID sentinel
+};
+
+constexpr const char* decodeResultName(DecodeResult result)
+{
+    switch (result)
+    {
+        case DecodeResult::Ok:              return "ok";
+        case DecodeResult::TooShort:        return "too short";
+        case DecodeResult::SizeMismatch:    return "size mismatch";
+        case DecodeResult::UnknownCommand:  return "unknown command";
+        case DecodeResult::InvalidCommand:  return "invalid command";
+    }
+    return "?";
+}
+
+constexpr bool isKnownCommand(uint8_t value)
+{
+    switch (ESPNowCommand(value))
+    {
+        case ESPNowCommand::NextEffect:
+        case ESPNowCommand::PrevEffect:
+        case ESPNowCommand::SetEffect:
+        case ESPNowCommand::SetBrightness:
+        case ESPNowCommand::GetManifestHash:
+        case ESPNowCommand::ManifestHash:
+        case ESPNowCommand::AllOff:
+        case ESPNowCommand::Ack:
+        case ESPNowCommand::GetState:
+        case ESPNowCommand::State:
+        case ESPNowCommand::GetTelemetry:
+        case ESPNowCommand::GetProbeReport:
+        case ESPNowCommand::ChannelSwitch:
+            return true;
+        default:
+            return false;
+    }
+}
+
+constexpr DecodeResult decodeMessage(const uint8_t* data, size_t length, Message& out)
+{
+    if (length < LEGACY_MESSAGE_SIZE)
+        return DecodeResult::TooShort;
+
+    if (data[0] != length || (length != sizeof(Message) && length != LEGACY_MESSAGE_SIZE))
+        return DecodeResult::SizeMismatch;
+
+    if (data[1] == uint8_t(ESPNowCommand::INVALID))
+        return DecodeResult::InvalidCommand;
+
+    if (!isKnownCommand(data[1]))
+        return DecodeResult::UnknownCommand;
+
+    uint32_t argument = uint32_t(data[2]) | uint32_t(data[3]) << 8 | uint32_t(data[4]) << 16 | uint32_t(data[5]) << 24;
+    bool     legacy   = length == LEGACY_MESSAGE_SIZE;
+    uint16_t sequence = legacy ? 0 : uint16_t(data[6] | data[7] << 8);
+    uint8_t  groups   = legacy ? ALL_GROUPS : data[8];
+    out = Message{ESPNowCommand(data[1]), argument, sequence, groups};
+    return DecodeResult::Ok;
+}
+
+// Byte-wise encoder matching the packed layout, for compile-time checks and for hosts
+// that cannot rely on the struct layout
+
+constexpr std::array<uint8_t, sizeof(Message)> encodeMessage(const Message& msg)
+{
+    uint32_t argument = msg.getArgument();
+    uint16_t sequence = msg.getSequence();
+    return {{ uint8_t(sizeof(Message)), uint8_t(msg.getCommand()),
+              uint8_t(argument), uint8_t(argument >> 8), uint8_t(argument >> 16), uint8_t(argument >> 24),
+              uint8_t(sequence), uint8_t(sequence >> 8), msg.getGroups() }};
+}
+
+// The frame receivers built before the sequence and group fields accept, for remotes
+// that still have such receivers in service. Those fields are dropped, so every copy is
+// acted on and every receiver is addressed.
+
+constexpr std::array<uint8_t, LEGACY_MESSAGE_SIZE> encodeLegacyMessage(const Message& msg)
+{
+    uint32_t argument = msg.getArgument();
+    return {{ uint8_t(LEGACY_MESSAGE_SIZE), uint8_t(msg.getCommand()),
+              uint8_t(argument), uint8_t(argument >> 8), uint8_t(argument >> 16), uint8_t(argument >> 24) }};
+}
+
+namespace ProtocolCheck
+{
+    constexpr bool roundTrips(ESPNowCommand command, uint32_t argument, uint16_t sequence, uint8_t groups)
+    {
+        auto bytes = encodeMessage(Message{command, argument, sequence, groups});
+        Message decoded{ESPNowCommand::INVALID, 0};
+        return decodeMessage(bytes.data(), bytes.size(), decoded) == DecodeResult::Ok &&
+               decoded.getCommand() == command && decoded.getArgument() == argument &&
+               decoded.getSequence() == sequence && decoded.getGroups() == groups;
+    }
+
+    // Every known command survives encode then decode with edge-case arguments, and every
+    // other command byte is rejected
+
+    constexpr bool allCommandsRoundTrip()
+    {
+        constexpr uint32_t ARGUMENTS[] = { 0, 1, 0x80, 0xFF, 0x100, 0x12345678, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF };
+        for (unsigned value = 0; value < 256; value++)
+        {
+            for (uint32_t argument : ARGUMENTS)
+            {
+                bool survives = roundTrips(ESPNowCommand(value), argument, uint16_t(argument ^ value),
+                                           uint8_t(argument >> 3 ^ value));
+                if (survives != isKnownCommand(uint8_t(value)))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    constexpr bool rejectsMalformed()
+    {
+        auto bytes = encodeMessage(Message{ESPNowCommand::SetEffect, 3});
+        Message decoded{ESPNowCommand::INVALID, 0};
+
+        if (decodeMessage(bytes.data(), LEGACY_MESSAGE_SIZE - 1, decoded) != DecodeResult::TooShort)
+            return false;
+
+        bytes[0] = sizeof(Message) - 1;
+        if (decodeMessage(bytes.data(), sizeof(Message) - 1, decoded) != DecodeResult::SizeMismatch)
+            return false;
+
+        bytes[0] = sizeof(Message) + 1;
+        if (decodeMessage(bytes.data(), bytes.size(), decoded) != DecodeResult::SizeMismatch)
+            return false;
+
+        bytes[0] = sizeof(Message);
+        bytes[1] = uint8_t(ESPNowCommand::INVALID);
+        return decodeMessage(bytes.data(), bytes.size(), decoded) == DecodeResult::InvalidCommand;
+    }
+
+    // A frame from a remote without sequence numbers or groups decodes as unsequenced and
+    // addressed to everyone
+    constexpr bool acceptsLegacy()
+    {
+        auto bytes = encodeLegacyMessage(Message{ESPNowCommand::SetBrightness, 0x1234, 0xBEEF, 0x02});
+        Message decoded{ESPNowCommand::INVALID, 0};
+        return decodeMessage(bytes.data(), bytes.size(), decoded) == DecodeResult::Ok &&
+               decoded.getCommand() == ESPNowCommand::SetBrightness && decoded.getArgument() == 0x1234 &&
+               decoded.getSequence() == 0 && decoded.getGroups() == ALL_GROUPS;
+    }
+}
+
+// StatesFrame
+//
+// One broadcast that sets every receiver at once: a list of (slot, effect, brightness)
+// for up to MAX_STATE_SLOTS receivers, each of which applies the entry for the slot it
+// was assigned and ignores the rest. On the wire it is the length, the SetStates command,
+// the sequence number (little-endian), the group mask, the entry count and then three
+// bytes per entry.
+
+struct TargetState
+{
+    uint8_t slot;
+    uint8_t effect;             // Wire index of a PlateEffect
+    uint8_t brightness;
+};
+
+constexpr uint8_t UNASSIGNED_SLOT       = 0xFF;    // A receiver without a slot; never sent
+constexpr size_t  MAX_STATE_SLOTS       = 16;
+constexpr size_t  STATES_HEADER_SIZE    = 6;
+constexpr size_t  MAX_STATES_FRAME_SIZE = STATES_HEADER_SIZE + MAX_STATE_SLOTS * 3;
+
+class StatesFrame
+{
+public:
+    constexpr StatesFrame() = default;
+
+    constexpr explicit StatesFrame(uint16_t sequenceNumber, uint8_t groupMask = ALL_GROUPS)
+        : sequence(sequenceNumber), groups(groupMask)
+    {
+    }
+
+    // Sets the state for 'state.slot', replacing any earlier entry for it; false if full
+    constexpr bool set(const TargetState& state)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (states[i].slot == state.slot)
+            {
+                states[i] = state;
+                return true;
+            }
+        }
+
+        if (count == MAX_STATE_SLOTS)
+            return false;
+        states[count++] = state;
+        return true;
+    }
+
+    constexpr const TargetState* find(uint8_t slot) const
+    {
+        for (size_t i = 0; i < count; i++)
+            if (states[i].slot == slot)
+                return &states[i];
+        return nullptr;
+    }
+
+    constexpr const TargetState& operator[](size_t i) const { return states[i]; }
+    constexpr size_t   size() const                         { return count; }
+    constexpr uint16_t getSequence() const                  { return sequence; }
+    constexpr uint8_t  getGroups() const                    { return groups; }
+    constexpr size_t   byte_size() const                    { return STATES_HEADER_SIZE + count * 3; }
+
+private:
+    uint16_t sequence = 0;
+    uint8_t  groups   = ALL_GROUPS;
+    size_t   count    = 0;
+    std::array<TargetState, MAX_STATE_SLOTS> states = {};
+};
+
+// Writes 'frame' to 'out'; returns the number of bytes used
+
+constexpr size_t encodeStates(const StatesFrame& frame, std::array<uint8_t, MAX_STATES_FRAME_SIZE>& out)
+{
+    out[0] = uint8_t(frame.byte_size());
+    out[1] = uint8_t(ESPNowCommand::SetStates);
+    out[2] = uint8_t(frame.getSequence());
+    out[3] = uint8_t(frame.getSequence() >> 8);
+    out[4] = frame.getGroups();
+    out[5] = uint8_t(frame.size());
+    for (size_t i = 0; i < frame.size(); i++)
+    {
+        out[STATES_HEADER_SIZE + i * 3]     = frame[i].slot;
+        out[STATES_HEADER_SIZE + i * 3 + 1] = frame[i].effect;
+        out[STATES_HEADER_SIZE + i * 3 + 2] = frame[i].brightness;
+    }
+    return frame.byte_size();
+}
+
+// Checks the frame as strictly as decodeMessage does. A slot listed twice keeps its
+// last entry, as StatesFrame::set() would.
+
+constexpr DecodeResult decodeStates(const uint8_t* data, size_t length, StatesFrame& out)
+{
+    if (length < STATES_HEADER_SIZE)
+        return DecodeResult::TooShort;
+
+    if (data[1] != uint8_t(ESPNowCommand::SetStates))
+        return DecodeResult::UnknownCommand;
+
+    size_t count = data[5];
+    if (data[0] != length || count > MAX_STATE_SLOTS || length != STATES_HEADER_SIZE + count * 3)
+        return DecodeResult::SizeMismatch;
+
+    out = StatesFrame{uint16_t(data[2] | data[3] << 8), data[4]};
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t* entry = data + STATES_HEADER_SIZE + i * 3;
+        out.set({entry[0], entry[1], entry[2]});
+    }
+    return DecodeResult::Ok;
+}
+
+// True if a frame is a StatesFrame rather than a Message
+
+constexpr bool isStatesFrame(const uint8_t* data, size_t length)
+{
+    return length >= 2 && data[1] == uint8_t(ESPNowCommand::SetStates);
+}
+
+namespace ProtocolCheck
+{
+    constexpr bool statesRoundTrip()
+    {
+        StatesFrame frame{0x1234, 0x05};
+        for (uint8_t slot = 0; slot < MAX_STATE_SLOTS; slot++)
+            frame.set({uint8_t(slot * 7), uint8_t(slot), uint8_t(255 - slot)});
+        if (frame.set({200, 0, 0}))
+            return false;
+
+        std::array<uint8_t, MAX_STATES_FRAME_SIZE> bytes = {};
+        size_t length = encodeStates(frame, bytes);
+
+        StatesFrame decoded;
+        if (decodeStates(bytes.data(), length, decoded) != DecodeResult::Ok || decoded.size() != frame.size() ||
+            decoded.getSequence() != frame.getSequence() || decoded.getGroups() != frame.getGroups())
+            return false;
+
+        for (uint8_t slot = 0; slot < MAX_STATE_SLOTS; slot++)
+        {
+            const TargetState* state = decoded.find(uint8_t(slot * 7));
+            if (!state || state->effect != slot || state->brightness != 255 - slot)
+                return false;
+        }
+
+        // Truncated, and a count that disagrees with the length
+        if (decodeStates(bytes.data(), length - 1, decoded) != DecodeResult::SizeMismatch)
+            return false;
+        bytes[5]++;
+        return decodeStates(bytes.data(), length, decoded) == DecodeResult::SizeMismatch;
+    }
+}
+
+// AckRequestFrame
+//
+// Asks the receivers whose ack ids are set in a 64-bit mask to confirm that they have
+// heard every frame in a short list of sequence numbers. Each receiver that has heard
+// them all answers with an Ack after waiting its turn: the number of requested ids below
+// its own, times the slot width carried in the frame, so the replies follow one another
+// instead of colliding. A slot width of zero asks for immediate replies. On the wire it is
+// the length, the AckRequest command, the group mask, the slot width in ACK_SLOT_UNIT_US,
+// the sequence count, the sequences and then the id mask, all little-endian.
+
+constexpr size_t   MAX_ACK_IDS             = 64;
+constexpr size_t   MAX_ACK_SEQUENCES       = 4;
+constexpr uint32_t ACK_SLOT_UNIT_US        = 100;
+constexpr size_t   ACK_REQUEST_HEADER_SIZE = 5;
+constexpr size_t   MAX_ACK_REQUEST_SIZE    = ACK_REQUEST_HEADER_SIZE + MAX_ACK_SEQUENCES * 2 + 8;
+
+class AckRequestFrame
+{
+public:
+    constexpr AckRequestFrame() = default;
+
+    // 'slotMicros' is rounded down to a whole number of ACK_SLOT_UNIT_US
+    constexpr AckRequestFrame(uint64_t idMask, uint32_t slotMicros, uint8_t groupMask = ALL_GROUPS)
+        : ids(idMask), slotUnits(uint8_t(slotMicros / ACK_SLOT_UNIT_US)), groups(groupMask)
+    {
+    }
+
+    // False if the frame already lists MAX_ACK_SEQUENCES
+    constexpr bool addSequence(uint16_t sequence)
+    {
+        if (count == MAX_ACK_SEQUENCES)
+            return false;
+        sequences[count++] = sequence;
+        return true;
+    }
+
+    constexpr bool requests(uint8_t id) const
+    {
+        return id < MAX_ACK_IDS && (ids >> id & 1) != 0;
+    }
+
+    // How long receiver 'id' waits before replying
+    constexpr uint32_t replyDelayMicros(uint8_t id) const
+    {
+        uint32_t earlier = 0;
+        for (uint64_t below = id < MAX_ACK_IDS ? ids & ((uint64_t(1) << id) - 1) : 0; below; below &= below - 1)
+            earlier++;
+        return earlier * getSlotMicros();
+    }
+
+    constexpr uint16_t operator[](size_t i) const   { return sequences[i]; }
+    constexpr size_t   size() const                 { return count; }
+    constexpr uint64_t getIds() const               { return ids; }
+    constexpr uint32_t getSlotMicros() const        { return slotUnits * ACK_SLOT_UNIT_US; }
+    constexpr uint8_t  getGroups() const            { return groups; }
+    constexpr size_t   byte_size() const            { return ACK_REQUEST_HEADER_SIZE + count * 2 + 8; }
+
+private:
+    uint64_t ids       = 0;
+    uint8_t  slotUnits = 0;
+    uint8_t  groups    = ALL_GROUPS;
+    size_t   count     = 0;
+    std::array<uint16_t, MAX_ACK_SEQUENCES> sequences = {};
+};
+
+// Writes 'frame' to 'out'; returns the number of bytes used
+
+constexpr size_t encodeAckRequest(const AckRequestFrame& frame, std::array<uint8_t, MAX_ACK_REQUEST_SIZE>& out)
+{
+    out[0] = uint8_t(frame.byte_size());
+    out[1] = uint8_t(ESPNowCommand::AckRequest);
+    out[2] = frame.getGroups();
+    out[3] = uint8_t(frame.getSlotMicros() / ACK_SLOT_UNIT_US);
+    out[4] = uint8_t(frame.size());
+
+    size_t at = ACK_REQUEST_HEADER_SIZE;
+    for (size_t i = 0; i < frame.size(); i++)
+    {
+        out[at++] = uint8_t(frame[i]);
+        out[at++] = uint8_t(frame[i] >> 8);
+    }
+    for (size_t i = 0; i < 8; i++)
+        out[at++] = uint8_t(frame.getIds() >> (i * 8));
+    return at;
+}
+
+constexpr DecodeResult decodeAckRequest(const uint8_t* data, size_t length, AckRequestFrame& out)
+{
+    if (length < ACK_REQUEST_HEADER_SIZE)
+        return DecodeResult::TooShort;
+
+    if (data[1] != uint8_t(ESPNowCommand::AckRequest))
+        return DecodeResult::UnknownCommand;
+
+    size_t count = data[4];
+    if (data[0] != length || count == 0 || count > MAX_ACK_SEQUENCES ||
+        length != ACK_REQUEST_HEADER_SIZE + count * 2 + 8)
+        return DecodeResult::SizeMismatch;
+
+    const uint8_t* mask = data + ACK_REQUEST_HEADER_SIZE + count * 2;
+    uint64_t ids = 0;
+    for (size_t i = 0; i < 8; i++)
+        ids |= uint64_t(mask[i]) << (i * 8);
+
+    out = AckRequestFrame{ids, data[3] * ACK_SLOT_UNIT_US, data[2]};
+    for (size_t i = 0; i < count; i++)
+        out.addSequence(uint16_t(data[ACK_REQUEST_HEADER_SIZE + i * 2] | data[ACK_REQUEST_HEADER_SIZE + i * 2 + 1] << 8));
+    return DecodeResult::Ok;
+}
+
+constexpr bool isAckRequest(const uint8_t* data, size_t length)
+{
+    return length >= 2 && data[1] == uint8_t(ESPNowCommand::AckRequest);
+}
+
+namespace ProtocolCheck
+{
+    constexpr bool ackRequestRoundTrip()
+    {
+        AckRequestFrame frame{0x8000000000000015, 1500, 0x03};
+        frame.addSequence(0x1234);
+        frame.addSequence(0xFFFF);
+
+        std::array<uint8_t, MAX_ACK_REQUEST_SIZE> bytes = {};
+        size_t length = encodeAckRequest(frame, bytes);
+
+        AckRequestFrame decoded;
+        if (decodeAckRequest(bytes.data(), length, decoded) != DecodeResult::Ok || decoded.size() != 2 ||
+            decoded[0] != 0x1234 || decoded[1] != 0xFFFF || decoded.getIds() != frame.getIds() ||
+            decoded.getSlotMicros() != 1500 || decoded.getGroups() != 0x03)
+            return false;
+
+        // Ids 0, 2, 4 and 63 reply in that order, one slot apart; 1 isn't asked
+        if (decoded.replyDelayMicros(0) != 0 || decoded.replyDelayMicros(2) != 1500 ||
+            decoded.replyDelayMicros(4) != 3000 || decoded.replyDelayMicros(63) != 4500 || decoded.requests(1))
+            return false;
+
+        return decodeAckRequest(bytes.data(), length - 1, decoded) == DecodeResult::SizeMismatch;
+    }
+}
+
+// TelemetryFrame
+//
+// A receiver's health readings, sent in reply to GetTelemetry. On the wire it is the
+// length, the Telemetry command, the request's sequence number and then the fields of
+// ReceiverTelemetry in order, all little-endian.
+
+struct ReceiverTelemetry
+{
+    uint16_t fpsTenths;             // Frames drawn per second, times 10
+    uint32_t freeHeap;              // Bytes
+    int16_t  temperatureTenths;     // Chip temperature in tenths of a degree C
+    uint16_t powerMilliwatts;       // LED power draw, as the receiver estimates it
+};
+
+constexpr size_t TELEMETRY_FRAME_SIZE = 14;
+
+constexpr std::array<uint8_t, TELEMETRY_FRAME_SIZE> encodeTelemetry(uint16_t sequence, const ReceiverTelemetry& telemetry)
+{
+    uint16_t temperature = uint16_t(telemetry.temperatureTenths);
+    return {{ uint8_t(TELEMETRY_FRAME_SIZE), uint8_t(ESPNowCommand::Telemetry),
+              uint8_t(sequence), uint8_t(sequence >> 8),
+              uint8_t(telemetry.fpsTenths), uint8_t(telemetry.fpsTenths >> 8),
+              uint8_t(telemetry.freeHeap), uint8_t(telemetry.freeHeap >> 8),
+              uint8_t(telemetry.freeHeap >> 16), uint8_t(telemetry.freeHeap >> 24),
+              uint8_t(temperature), uint8_t(temperature >> 8),
+              uint8_t(telemetry.powerMilliwatts), uint8_t(telemetry.powerMilliwatts >> 8) }};
+}
+
+constexpr DecodeResult decodeTelemetry(const uint8_t* data, size_t length, uint16_t& sequence, ReceiverTelemetry& out)
+{
+    if (length < 2)
+        return DecodeResult::TooShort;
+
+    if (data[1] != uint8_t(ESPNowCommand::Telemetry))
+        return DecodeResult::UnknownCommand;
+
+    if (data[0] != length || length != TELEMETRY_FRAME_SIZE)
+        return DecodeResult::SizeMismatch;
+
+    sequence = uint16_t(data[2] | data[3] << 8);
+    out.fpsTenths         = uint16_t(data[4] | data[5] << 8);
+    out.freeHeap          = uint32_t(data[6]) | uint32_t(data[7]) << 8 | uint32_t(data[8]) << 16 | uint32_t(data[9]) << 24;
+    out.temperatureTenths = int16_t(uint16_t(data[10] | data[11] << 8));
+    out.powerMilliwatts   = uint16_t(data[12] | data[13] << 8);
+    return DecodeResult::Ok;
+}
+
+constexpr bool isTelemetryFrame(const uint8_t* data, size_t length)
+{
+    return length >= 2 && data[1] == uint8_t(ESPNowCommand::Telemetry);
+}
+
+namespace ProtocolCheck
+{
+    constexpr bool telemetryRoundTrip()
+    {
+        ReceiverTelemetry sent{599, 0x00054321, -125, 4321};
+        auto bytes = encodeTelemetry(0xBEEF, sent);
+
+        uint16_t          sequence = 0;
+        ReceiverTelemetry received = {};
+        return decodeTelemetry(bytes.data(), bytes.size(), sequence, received) == DecodeResult::Ok &&
+               sequence == 0xBEEF && received.fpsTenths == 599 && received.freeHeap == 0x00054321 &&
+               received.temperatureTenths == -125 && received.powerMilliwatts == 4321 &&
+               decodeTelemetry(bytes.data(), bytes.size() - 1, sequence, received) == DecodeResult::SizeMismatch;
+    }
+}
+
+// ProbeFrame
+//
+// One frame of a numbered stream the remote sends to measure loss. On the wire it is the
+// length, the Probe command, the stream id, the frame's index and the number of frames
+// in the stream, all little-endian, then zeros out to the length the test asked for.
+// Receivers note which indexes they heard and report it with a ProbeReportFrame.
+
+constexpr size_t PROBE_HEADER_SIZE    = 8;
+constexpr size_t MAX_PROBE_FRAME_SIZE = 250;
+constexpr size_t MAX_PROBE_FRAMES     = 1024;
+constexpr size_t PROBE_BITMAP_SIZE    = MAX_PROBE_FRAMES / 8;
+
+struct ProbeFrame
+{
+    uint16_t stream;
+    uint16_t index;
+    uint16_t count;
+};
+
+// Writes a 'length' byte frame to 'out'; returns 0 if 'length' is out of range
+
+constexpr size_t encodeProbe(const ProbeFrame& probe, size_t length, std::array<uint8_t, MAX_PROBE_FRAME_SIZE>& out)
+{
+    if (length < PROBE_HEADER_SIZE || length > MAX_PROBE_FRAME_SIZE)
+        return 0;
+
+    out = {};
+    out[0] = uint8_t(length);
+    out[1] = uint8_t(ESPNowCommand::Probe);
+    out[2] = uint8_t(probe.stream);
+    out[3] = uint8_t(probe.stream >> 8);
+    out[4] = uint8_t(probe.index);
+    out[5] = uint8_t(probe.index >> 8);
+    out[6] = uint8_t(probe.count);
+    out[7] = uint8_t(probe.count >> 8);
+    return length;
+}
+
+constexpr DecodeResult decodeProbe(const uint8_t* data, size_t length, ProbeFrame& out)
+{
+    if (length < PROBE_HEADER_SIZE)
+        return DecodeResult::TooShort;
+
+    if (data[1] != uint8_t(ESPNowCommand::Probe))
+        return DecodeResult::UnknownCommand;
+
+    out = { uint16_t(data[2] | data[3] << 8), uint16_t(data[4] | data[5] << 8), uint16_t(data[6] | data[7] << 8) };
+    if (data[0] != length || length > MAX_PROBE_FRAME_SIZE || out.count == 0 || out.count > MAX_PROBE_FRAMES ||
+        out.index >= out.count)
+        return DecodeResult::SizeMismatch;
+    return DecodeResult::Ok;
+}
+
+constexpr bool isProbeFrame(const uint8_t* data, size_t length)
+{
+    return length >= 2 && data[1] == uint8_t(ESPNowCommand::Probe);
+}
+
+// ProbeReportFrame
+//
+// What a receiver heard of one probe stream: a bit per index, and counts of the frames
+// that arrived after one with a higher index (late), the furthest back one of those was,
+// and the copies of a frame heard twice. On the wire it is the length, the ProbeReport
+// command, then the stream id, frame count, frames received, late, furthest back and
+// duplicates as 16-bit little-endian fields, then the bitmap, index 0 in the low bit of
+// the first byte, cut to the stream's length.
+
+constexpr size_t PROBE_REPORT_HEADER_SIZE = 14;
+constexpr size_t MAX_PROBE_REPORT_SIZE    = PROBE_REPORT_HEADER_SIZE + PROBE_BITMAP_SIZE;
+
+struct ProbeReport
+{
+    uint16_t stream;
+    uint16_t count;
+    uint16_t received;
+    uint16_t late;
+    uint16_t maxDisplacement;
+    uint16_t duplicates;
+    std::array<uint8_t, PROBE_BITMAP_SIZE> bitmap;
+
+    constexpr bool heard(size_t index) const    { return (bitmap[index / 8] >> (index % 8) & 1) != 0; }
+    constexpr size_t bitmapBytes() const        { return (size_t(count) + 7) / 8; }
+    constexpr size_t byte_size() const          { return PROBE_REPORT_HEADER_SIZE + bitmapBytes(); }
+};
+
+constexpr size_t encodeProbeReport(const ProbeReport& report, std::array<uint8_t, MAX_PROBE_REPORT_SIZE>& out)
+{
+    const uint16_t fields[] = { report.stream, report.count, report.received, report.late,
+                                report.maxDisplacement, report.duplicates };
+    out[0] = uint8_t(report.byte_size());
+    out[1] = uint8_t(ESPNowCommand::ProbeReport);
+    for (size_t i = 0; i < 6; i++)
+    {
+        out[2 + i * 2] = uint8_t(fields[i]);
+        out[3 + i * 2] = uint8_t(fields[i] >> 8);
+    }
+    for (size_t i = 0; i < report.bitmapBytes(); i++)
+        out[PROBE_REPORT_HEADER_SIZE + i] = report.bitmap[i];
+    return report.byte_size();
+}
+
+constexpr DecodeResult decodeProbeReport(const uint8_t* data, size_t length, ProbeReport& out)
+{
+    if (length < PROBE_REPORT_HEADER_SIZE)
+        return DecodeResult::TooShort;
+
+    if (data[1] != uint8_t(ESPNowCommand::ProbeReport))
+        return DecodeResult::UnknownCommand;
+
+    uint16_t fields[6] = {};
+    for (size_t i = 0; i < 6; i++)
+        fields[i] = uint16_t(data[2 + i * 2] | data[3 + i * 2] << 8);
+
+    out = { fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], {} };
+    if (data[0] != length || out.count > MAX_PROBE_FRAMES || length != out.byte_size())
+        return DecodeResult::SizeMismatch;
+
+    for (size_t i = 0; i < out.bitmapBytes(); i++)
+        out.bitmap[i] = data[PROBE_REPORT_HEADER_SIZE + i];
+    return DecodeResult::Ok;
+}
+
+constexpr bool isProbeReport(const uint8_t* data, size_t length)
+{
+    return length >= 2 && data[1] == uint8_t(ESPNowCommand::ProbeReport);
+}
+
+namespace ProtocolCheck
+{
+    constexpr bool probeRoundTrip()
+    {
+        std::array<uint8_t, MAX_PROBE_FRAME_SIZE> bytes = {};
+        size_t length = encodeProbe({0xBEEF, 999, 1000}, 32, bytes);
+
+        ProbeFrame probe = {};
+        if (length != 32 || decodeProbe(bytes.data(), length, probe) != DecodeResult::Ok || probe.stream != 0xBEEF ||
+            probe.index != 999 || probe.count != 1000 || encodeProbe(probe, PROBE_HEADER_SIZE - 1, bytes) != 0)
+            return false;
+
+        ProbeReport report{0xBEEF, 13, 11, 2, 3, 1, {}};
+        report.bitmap[0] = 0xFB;
+        report.bitmap[1] = 0x1B;
+        std::array<uint8_t, MAX_PROBE_REPORT_SIZE> reportBytes = {};
+        length = encodeProbeReport(report, reportBytes);
+
+        ProbeReport decoded = {};
+        return length == PROBE_REPORT_HEADER_SIZE + 2 &&
+               decodeProbeReport(reportBytes.data(), length, decoded) == DecodeResult::Ok &&
+               decoded.stream == 0xBEEF && decoded.count == 13 && decoded.received == 11 && decoded.late == 2 &&
+               decoded.maxDisplacement == 3 && decoded.duplicates == 1 && decoded.heard(0) && !decoded.heard(2) &&
+               decoded.heard(12) && !decoded.heard(10) &&
+               decodeProbeReport(reportBytes.data(), length - 1, decoded) == DecodeResult::SizeMismatch;
+    }
+}
+
+static_assert(sizeof(Message) == 9, "Message wire layout changed; bump the receiver too");
+static_assert(MAX_STATES_FRAME_SIZE <= 250, "StatesFrame is larger than an ESP-NOW payload");
+static_assert(MAX_ACK_IDS == 64, "The ack id mask is a uint64_t");
+static_assert(MAX_PROBE_REPORT_SIZE <= 250, "ProbeReportFrame is larger than an ESP-NOW payload");
+static_assert(ProtocolCheck::probeRoundTrip(), "Probe frame encode/decode round trip failed");
+static_assert(ProtocolCheck::telemetryRoundTrip(), "TelemetryFrame encode/decode round trip failed");
+static_assert(ProtocolCheck::ackRequestRoundTrip(), "AckRequestFrame encode/decode round trip failed");
+static_assert(ProtocolCheck::statesRoundTrip(), "StatesFrame encode/decode round trip failed");
+static_assert(ProtocolCheck::allCommandsRoundTrip(), "Message encode/decode round trip failed");
+static_assert(ProtocolCheck::rejectsMalformed(), "Message decoder accepted a malformed frame");
+static_assert(ProtocolCheck::acceptsLegacy(), "Message decoder rejected a legacy frame");
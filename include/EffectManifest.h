@@ -0,0 +1,139 @@
+// EffectManifest.h - Compile-time tables generated from Effects.def.
+//
+// The preprocessor expands the manifest into the PlateEffect enum, the receiver's name
+// table and the remote's EFFECTS cycle, and the static_asserts below reject a manifest
+// with duplicate names, out of range indices or brightness values. MANIFEST_HASH is an
+// FNV-1a hash of the receiver list that both ends compute from the same file; the remote
+// asks each receiver for its hash at boot, so a stale receiver shows up as a mismatch
+// on the OLED rather than as the wrong effect.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Effects in PLATECOVER order; the underlying value is the wire index
+
+enum class PlateEffect : uint32_t
+{
+#define PLATE_EFFECT(identifier, name) identifier,
+#include "Effects.def"
+    COUNT
+};
+
+constexpr std::array<const char*, size_t(PlateEffect::COUNT)> PLATE_EFFECT_NAMES =
+{{
+#define PLATE_EFFECT(identifier, name) name,
+#include "Effects.def"
+}};
+
+// One step of the remote's button cycle
+
+struct LightEffect
+{
+    const char* name;
+    uint32_t    index;          // Wire index of the PlateEffect to select
+    uint8_t     brightness;
+};
+
+namespace ManifestCheck
+{
+    // Brightness as written in the manifest, before it is narrowed to uint8_t
+
+    constexpr int PRESET_BRIGHTNESS[] =
+    {
+#define REMOTE_PRESET(label, identifier, brightness) brightness,
+#include "Effects.def"
+    };
+
+    constexpr bool equal(const char* a, const char* b)
+    {
+        while (*a && *a == *b)
+        {
+            a++;
+            b++;
+        }
+        return *a == *b;
+    }
+
+    template <size_t N>
+    constexpr bool allUnique(const std::array<const char*, N>& names)
+    {
+        for (size_t i = 0; i < N; i++)
+            for (size_t j = i + 1; j < N; j++)
+                if (equal(names[i], names[j]))
+                    return false;
+        return true;
+    }
+
+    template <size_t N>
+    constexpr bool allBrightnessInRange(const int (&values)[N])
+    {
+        for (size_t i = 0; i < N; i++)
+            if (values[i] < 0 || values[i] > 255)
+                return false;
+        return true;
+    }
+
+    // FNV-1a over every receiver effect name, each followed by a NUL, in wire order
+
+    constexpr uint32_t hashNames(const std::array<const char*, size_t(PlateEffect::COUNT)>& names)
+    {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            const char* c = names[i];
+            do
+            {
+                hash = (hash ^ uint8_t(*c)) * 16777619u;
+            } while (*c++);
+        }
+        return hash;
+    }
+}
+
+static_assert(ManifestCheck::allBrightnessInRange(ManifestCheck::PRESET_BRIGHTNESS),
+              "Effects.def: REMOTE_PRESET brightness must be 0-255");
+
+constexpr std::array<LightEffect, sizeof(ManifestCheck::PRESET_BRIGHTNESS) / sizeof(int)> EFFECTS =
+{{
+#define REMOTE_PRESET(label, identifier, brightness) \
+    {label, uint32_t(PlateEffect::identifier), uint8_t(brightness)},
+#include "Effects.def"
+}};
+
+constexpr std::array<const char*, EFFECTS.size()> PRESET_LABELS =
+{{
+#define REMOTE_PRESET(label, identifier, brightness) label,
+#include "Effects.def"
+}};
+
+static_assert(EFFECTS.size() > 1, "Effects.def: the remote needs at least two presets to cycle through");
+static_assert(ManifestCheck::allUnique(PLATE_EFFECT_NAMES), "Effects.def: PLATE_EFFECT names must be unique");
+static_assert(ManifestCheck::allUnique(PRESET_LABELS), "Effects.def: REMOTE_PRESET labels must be unique");
+
+namespace ManifestCheck
+{
+    constexpr bool allIndicesValid()
+    {
+        for (const auto& effect : EFFECTS)
+            if (effect.index >= uint32_t(PlateEffect::COUNT))
+                return false;
+        return true;
+    }
+}
+
+static_assert(ManifestCheck::allIndicesValid(), "Effects.def: REMOTE_PRESET refers to a missing PLATE_EFFECT");
+
+constexpr uint32_t MANIFEST_HASH = ManifestCheck::hashNames(PLATE_EFFECT_NAMES);
+
+// Index of the first preset in EFFECTS that selects 'effect', or EFFECTS.size() if none does
+
+constexpr size_t findPreset(PlateEffect effect)
+{
+    for (size_t i = 0; i < EFFECTS.size(); i++)
+        if (EFFECTS[i].index == uint32_t(effect))
+            return i;
+    return EFFECTS.size();
+}
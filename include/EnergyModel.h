@@ -0,0 +1,186 @@
+// EnergyModel.h - Per-state energy accounting and battery runtime estimates.
+//
+// The power scheduler reports each state transition; the time spent in each state is
+// integrated against the current that state draws, plus a fixed charge per transmitted
+// frame. The average current since the last power-on, together with the remaining
+// charge estimated from the battery voltage, gives the runtime shown on the OLED.
+//
+// This header is plain C++ with no Arduino dependencies, so the same model (and
+// projectAverageMilliAmps() in particular) can be compiled into host-side tools.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+enum class PowerState : uint8_t
+{
+    DisplayOn,      // Awake with the OLED lit
+    DisplayOff,     // Awake between light sleeps, OLED off
+    LightSleep,
+    DeepSleep,
+    COUNT
+};
+
+// Current draw per state, in milliamps. These are typical figures for the Heltec WiFi
+// Kit 32 V2 with WiFi in STA mode; measure your own board and adjust.
+
+struct PowerProfile
+{
+    float    awakeMilliAmps;        // CPU and radio idle, display off
+    float    displayMilliAmps;      // Added by the OLED while it is on
+    float    lightSleepMilliAmps;
+    float    deepSleepMilliAmps;
+    float    transmitMilliAmps;     // While a frame is on the air
+    uint32_t transmitMicros;        // Air time charged per frame
+    float    batteryMilliAmpHours;
+};
+
+constexpr PowerProfile DEFAULT_POWER_PROFILE = { 45.0f, 12.0f, 1.5f, 0.15f, 180.0f, 600, 1000.0f };
+
+// Durations the power scheduler waits before stepping down, used for projections
+
+struct PowerTimeouts
+{
+    uint32_t displayMillis;         // Input to display off
+    uint32_t deepSleepMillis;       // Input to deep sleep, 0 for never
+    uint32_t bootMillis;            // Awake time spent booting after a deep sleep wake
+};
+
+class EnergyModel
+{
+  public:
+    explicit EnergyModel(const PowerProfile& powerProfile) : profile(powerProfile)
+    {
+    }
+
+    // Charges the time since the previous transition to the state being left
+
+    void transition(PowerState next, uint64_t nowMicros)
+    {
+        stateMicros[size_t(state)] += nowMicros - enteredAt;
+        enteredAt = nowMicros;
+        state = next;
+    }
+
+    // Adds time spent in a state without changing the current one, e.g. a deep sleep
+    // measured after the fact on wake
+
+    void credit(PowerState which, uint64_t micros)
+    {
+        stateMicros[size_t(which)] += micros;
+    }
+
+    void addTransmit(uint32_t frames = 1)
+    {
+        transmitFrames += frames;
+    }
+
+    // Accumulated totals, so the model can be carried across a deep sleep in RTC memory
+
+    struct Totals
+    {
+        std::array<uint64_t, size_t(PowerState::COUNT)> stateMicros;
+        uint32_t transmitFrames;
+    };
+
+    Totals totals() const
+    {
+        return {stateMicros, transmitFrames};
+    }
+
+    void restore(const Totals& saved)
+    {
+        stateMicros    = saved.stateMicros;
+        transmitFrames = saved.transmitFrames;
+    }
+
+    PowerState currentState() const             { return state; }
+    uint64_t timeIn(PowerState which) const     { return stateMicros[size_t(which)]; }
+    uint32_t framesSent() const                 { return transmitFrames; }
+
+    uint64_t totalMicros() const
+    {
+        uint64_t total = 0;
+        for (auto micros : stateMicros)
+            total += micros;
+        return total;
+    }
+
+    // Charge drawn so far, in milliamp-seconds
+
+    float consumedMilliAmpSeconds() const
+    {
+        float charge = 0;
+        for (size_t i = 0; i < stateMicros.size(); i++)
+            charge += stateMilliAmps(PowerState(i)) * (stateMicros[i] / 1e6f);
+        return charge + transmitChargePerFrame() * transmitFrames;
+    }
+
+    float averageMilliAmps() const
+    {
+        uint64_t total = totalMicros();
+        return total ? consumedMilliAmpSeconds() / (total / 1e6f) : stateMilliAmps(state);
+    }
+
+    // Runtime left at the average current, given the battery's state of charge (0-1)
+
+    float remainingHours(float stateOfCharge) const
+    {
+        return stateOfCharge * profile.batteryMilliAmpHours / averageMilliAmps();
+    }
+
+    float stateMilliAmps(PowerState which) const
+    {
+        switch (which)
+        {
+            case PowerState::DisplayOn:  return profile.awakeMilliAmps + profile.displayMilliAmps;
+            case PowerState::DisplayOff: return profile.awakeMilliAmps;
+            case PowerState::LightSleep: return profile.lightSleepMilliAmps;
+            case PowerState::DeepSleep:  return profile.deepSleepMilliAmps;
+            default:                     return 0;
+        }
+    }
+
+    // Average current for a remote pressed 'pressesPerHour' times an hour, each press
+    // sending 'framesPerPress' frames, assuming the scheduler light-sleeps whenever the
+    // display is off. Idle time is the gap between evenly spaced presses.
+
+    static float projectAverageMilliAmps(const PowerProfile& profile, const PowerTimeouts& timeouts,
+                                         float pressesPerHour, uint32_t framesPerPress)
+    {
+        EnergyModel model(profile);
+        if (pressesPerHour <= 0)
+            return model.stateMilliAmps(timeouts.deepSleepMillis ? PowerState::DeepSleep : PowerState::LightSleep);
+
+        float interval  = 3600.0f / pressesPerHour;
+        float displayOn = timeouts.displayMillis / 1000.0f;
+        float deepAfter = timeouts.deepSleepMillis / 1000.0f;
+        bool  deepSleep = timeouts.deepSleepMillis != 0 && interval > deepAfter;
+
+        float on    = displayOn < interval ? displayOn : interval;
+        float light = (deepSleep ? deepAfter : interval) - on;
+        float deep  = deepSleep ? interval - deepAfter : 0.0f;
+        float boot  = deepSleep ? timeouts.bootMillis / 1000.0f : 0.0f;
+
+        model.credit(PowerState::DisplayOn,  uint64_t((on + boot) * 1e6f));
+        model.credit(PowerState::LightSleep, uint64_t(light * 1e6f));
+        model.credit(PowerState::DeepSleep,  uint64_t(deep * 1e6f));
+        model.addTransmit(framesPerPress);
+        return model.averageMilliAmps();
+    }
+
+  private:
+    float transmitChargePerFrame() const
+    {
+        // The radio's draw over the awake baseline, for the frame's air time
+        return (profile.transmitMilliAmps - profile.awakeMilliAmps) * (profile.transmitMicros / 1e6f);
+    }
+
+    PowerProfile profile;
+    PowerState   state     = PowerState::DisplayOn;
+    uint64_t     enteredAt = 0;
+    std::array<uint64_t, size_t(PowerState::COUNT)> stateMicros = {};
+    uint32_t     transmitFrames = 0;
+};
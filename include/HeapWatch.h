@@ -0,0 +1,64 @@
+// HeapWatch.h - Heap allocation instrumentation.
+//
+// Built with -DHEAP_WATCH (see the heltec_wifi_kit_32_v2_heapwatch env), malloc, calloc
+// and realloc are wrapped at link time and every allocation made after arm() is logged
+// with the address of its caller; feed those to xtensa-esp32-elf-addr2line to find the
+// culprit. Allocations made by the loop task while inside update() are steady-state
+// allocations, and with -DHEAP_WATCH_STRICT the first one halts the firmware.
+//
+// Without HEAP_WATCH everything here compiles away to nothing.
+
+#pragma once
+
+#include <Arduino.h>
+
+struct AllocationRecord
+{
+    uintptr_t caller;       // Return address of the malloc/calloc/realloc call
+    uint32_t  size;         // Bytes requested
+    uint32_t  timestamp;    // millis() at the time of the call
+    bool      inUpdate;     // Made by the loop task from inside update()
+};
+
+namespace HeapWatch
+{
+#ifdef HEAP_WATCH
+
+    // Starts recording; called once at the end of setup()
+    void arm();
+
+    // Bracket update() so that steady-state allocations can be told apart
+    void enterUpdate();
+    void leaveUpdate();
+
+    uint32_t totalAllocations();
+    uint32_t updateAllocations();
+
+    // True when allocations have been recorded since the last report()
+    bool hasNewRecords();
+    void report(Print& out);
+
+#else
+
+    inline void arm()                   {}
+    inline void enterUpdate()           {}
+    inline void leaveUpdate()           {}
+    inline uint32_t totalAllocations()  { return 0; }
+    inline uint32_t updateAllocations() { return 0; }
+    inline bool hasNewRecords()         { return false; }
+    inline void report(Print&)          {}
+
+#endif
+}
+
+// Marks the lifetime of update() for HeapWatch
+
+class HeapWatchScope
+{
+  public:
+    HeapWatchScope()  { HeapWatch::enterUpdate(); }
+    ~HeapWatchScope() { HeapWatch::leaveUpdate(); }
+
+    HeapWatchScope(const HeapWatchScope&) = delete;
+    HeapWatchScope& operator=(const HeapWatchScope&) = delete;
+};
@@ -0,0 +1,20 @@
+// HotPath.h - Placement of latency-critical code in IRAM.
+//
+// Code run from flash goes through the flash cache, and the first run after a wake from
+// light sleep, or after the cache has been evicted, stalls on flash reads. HOT_PATH puts
+// a function in IRAM so it never waits on the cache. It is applied to the button ISR,
+// the transmit path and the ESP-NOW send callback; anything they call into outside of
+// this project still runs from flash.
+//
+// Build with -DHOT_PATH_IN_FLASH to leave those functions in flash, so cold and warm
+// timings from PathProfiler can be compared between the two placements.
+
+#pragma once
+
+#include <Arduino.h>
+
+#ifdef HOT_PATH_IN_FLASH
+#define HOT_PATH
+#else
+#define HOT_PATH IRAM_ATTR
+#endif
@@ -0,0 +1,96 @@
+// LoopProfiler.h - Per-iteration timing of update() and stall attribution.
+//
+// Each pass through update() is one iteration. Work inside it is attributed to a stage
+// via StageScope, and the iteration's duration lands in a log2 histogram. The longest
+// iteration is kept along with the stage that consumed most of it, and iterations that
+// overrun the deadline are counted so the caller can kick off recovery.
+//
+// The current stage is also mirrored to RTC memory that survives a watchdog reset, so
+// after a hard hang the next boot can still say where the loop was stuck.
+
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+
+enum class LoopStage : uint8_t
+{
+    Idle,
+    Input,
+    Transmit,
+    Display,
+    Console,
+    Persist,
+    COUNT
+};
+
+const char* loopStageName(LoopStage stage);
+
+class LoopProfiler
+{
+  public:
+    // Bucket i holds iterations of [2^(i+BUCKET_SHIFT), 2^(i+BUCKET_SHIFT+1)) microseconds,
+    // with the first and last buckets open-ended
+    static constexpr size_t BUCKET_COUNT = 14;
+    static constexpr int    BUCKET_SHIFT = 6;
+
+    explicit LoopProfiler(uint32_t deadlineMicros) : deadline(deadlineMicros)
+    {
+    }
+
+    // RAII marker for the stage being executed; nests, with time charged exclusively
+
+    class StageScope
+    {
+      public:
+        StageScope(LoopProfiler& owner, LoopStage stage) : profiler(owner), previous(owner.currentStage)
+        {
+            profiler.switchTo(stage);
+        }
+
+        ~StageScope()
+        {
+            profiler.switchTo(previous);
+        }
+
+        StageScope(const StageScope&) = delete;
+        StageScope& operator=(const StageScope&) = delete;
+
+      private:
+        LoopProfiler& profiler;
+        LoopStage     previous;
+    };
+
+    void beginIteration();
+
+    // Returns true if the iteration overran the deadline; 'culprit' receives the stage
+    // that used the most time during it
+    bool endIteration(LoopStage& culprit);
+
+    void setDeadline(uint32_t micros)   { deadline = micros; }
+    uint32_t getDeadline() const        { return deadline; }
+    uint32_t consecutiveMisses() const  { return missesInARow; }
+    void clearMisses()                  { missesInARow = 0; }
+
+    void reset();
+    void report(Print& out) const;
+
+    // Reports the stage recorded before an unexpected reset, if there was one
+    static void reportLastReset(Print& out);
+
+  private:
+    void switchTo(LoopStage stage);
+
+    uint32_t deadline;
+    LoopStage currentStage = LoopStage::Idle;
+    uint32_t  stageStart   = 0;
+    uint32_t  iterationStart = 0;
+    std::array<uint32_t, size_t(LoopStage::COUNT)> stageTime = {};
+
+    std::array<uint32_t, BUCKET_COUNT> histogram = {};
+    uint32_t  iterations    = 0;
+    uint32_t  longest       = 0;
+    LoopStage longestStage  = LoopStage::Idle;
+    uint32_t  deadlineMisses = 0;
+    uint32_t  missesInARow  = 0;
+};
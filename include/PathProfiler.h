@@ -0,0 +1,68 @@
+// PathProfiler.h - Cold versus warm cycle counts for the hot paths.
+//
+// Built with -DPATH_PROFILE, each HOT_PATH function measures itself in CPU cycles and
+// the press to send latency is measured in microseconds. After a wake from light sleep
+// (and at boot) markCold() flags every path, so its next sample is filed as cold; the
+// rest are warm. 'paths' on the console prints both sets side by side.
+//
+// Without PATH_PROFILE everything here compiles away to nothing.
+
+#pragma once
+
+#include <Arduino.h>
+#include <hal/cpu_hal.h>
+#include "HotPath.h"
+
+enum class ProfiledPath : uint8_t
+{
+    InputIsr,
+    Transmit,
+    SendCallback,
+    PressToSend,        // Microseconds from the button's release to esp_now_send
+    COUNT
+};
+
+namespace PathProfiler
+{
+#ifdef PATH_PROFILE
+
+    void markCold();
+    void HOT_PATH record(ProfiledPath path, uint32_t value);
+    void report(Print& out);
+
+    inline uint32_t HOT_PATH cycles()
+    {
+        return cpu_hal_get_cycle_count();
+    }
+
+#else
+
+    inline void markCold()                      {}
+    inline void record(ProfiledPath, uint32_t)  {}
+    inline void report(Print& out)              { out.println(F("Build with -DPATH_PROFILE to profile hot paths")); }
+    inline uint32_t cycles()                    { return 0; }
+
+#endif
+}
+
+// Times the enclosing scope in cycles
+
+class PathScope
+{
+  public:
+    explicit PathScope(ProfiledPath profiledPath) : path(profiledPath), start(PathProfiler::cycles())
+    {
+    }
+
+    ~PathScope()
+    {
+        PathProfiler::record(path, PathProfiler::cycles() - start);
+    }
+
+    PathScope(const PathScope&) = delete;
+    PathScope& operator=(const PathScope&) = delete;
+
+  private:
+    ProfiledPath path;
+    uint32_t     start;
+};
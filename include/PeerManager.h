@@ -0,0 +1,139 @@
+// PeerManager.h - A receiver roster larger than the ESP-NOW peer table.
+//
+// esp_now_add_peer() takes at most ESP_NOW_MAX_TOTAL_PEER_NUM peers, fewer if encrypted,
+// and addPeer() already uses one for broadcast. The roster holds up to ROSTER_CAPACITY
+// receivers in RAM, persisted to NVS. Each receiver is swapped into the peer table when
+// it is sent to, and the least recently used resident is evicted to make room. Every add
+// and delete is counted and timed, since that churn is what a roster larger than the
+// table costs.
+//
+// fanOut() unicasts one frame to every rostered receiver; unlike broadcast, each send is
+// ACKed. It visits the receivers already in the table first and the rest after, so each
+// receiver that isn't resident costs exactly one swap, which is the fewest possible.
+//
+// A peer isn't deleted while a frame to it may still be waiting in the driver: it stays
+// in the table until SendOrder says the callback for its last frame has come back. A
+// send that would need such a peer's slot is queued, along with every send after it so
+// each receiver still gets its frames in order, and sendPending() sends them as slots
+// free up: from the loop, or from the transmit benchmark while it holds the loop.
+//
+// Changes to the roster are staged rather than written to NVS at once, as StateStore
+// does: poll() saves the roster once it has been left alone for the settle time, so a
+// receiver learned mid-transaction doesn't stall the loop on a flash write.
+
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <array>
+#include "ESPNowProtocol.h"
+#include "StaticPool.h"
+
+constexpr size_t   ROSTER_CAPACITY          = 64;
+constexpr size_t   PEER_FRAME_CAPACITY      = MAX_STATES_FRAME_SIZE;   // The largest frame sent by unicast
+
+using MacAddress = std::array<uint8_t, 6>;
+
+class PeerManager
+{
+  public:
+    // 'tableSlots' is how much of the ESP-NOW peer table the roster may use; changes are
+    // saved once the roster has been left alone for 'settleMillis'
+    PeerManager(size_t tableSlots, uint32_t settleMillis) : slots(tableSlots), settleTime(settleMillis)
+    {
+    }
+
+    // Loads the roster saved in NVS
+    bool begin();
+
+    // Adds 'mac' to the roster and stages a save; false if the roster is full
+    bool add(const MacAddress& mac);
+    bool remove(const MacAddress& mac);
+
+    // Saves a staged roster once it has settled
+    void poll();
+
+    // Saves a staged roster now
+    bool flush();
+
+    // Unicasts to every rostered receiver; returns the number of sends the driver took or
+    // queued behind a peer still awaiting its send callback
+    size_t fanOut(const uint8_t* data, size_t length);
+
+    // Unicasts to one receiver, adding it to the roster first if it isn't on it
+    bool sendTo(const MacAddress& mac, const uint8_t* data, size_t length);
+
+    // Called with each receiver's MAC just before a frame is sent to it, e.g. to set the
+    // transmit power for that link
+    using SendHook = void (*)(void* context, const MacAddress& mac);
+    void setSendHook(SendHook hook, void* context)
+    {
+        beforeSend  = hook;
+        sendContext = context;
+    }
+
+    // Sends queued unicasts for as long as there is a slot to send them through
+    void sendPending();
+    bool hasPending() const     { return !queued.empty(); }
+
+    // Called after esp_now_deinit(), which empties the peer table
+    void tableCleared();
+
+    size_t size() const         { return roster.size(); }
+    const MacAddress& at(size_t index) const  { return roster[index].mac; }
+
+    void report(Print& out) const;
+
+    // Parses "aa:bb:cc:dd:ee:ff"
+    static bool parseMac(const char* text, MacAddress& mac);
+
+  private:
+    struct Entry
+    {
+        MacAddress mac;
+        uint32_t   lastUsed;        // Value of 'clock' at the last send
+        bool       resident;        // In the ESP-NOW peer table
+        uint32_t   ticket   = 0;    // SendOrder ticket of the last frame sent to it
+    };
+
+    struct Pending
+    {
+        MacAddress mac;
+        uint8_t    length;
+        std::array<uint8_t, PEER_FRAME_CAPACITY> bytes;
+    };
+
+    bool send(Entry& entry, const uint8_t* data, size_t length);
+    bool transmit(Entry& entry, const uint8_t* data, size_t length);
+    bool enqueue(const MacAddress& mac, const uint8_t* data, size_t length);
+    bool canMakeResident(const Entry& entry);
+    bool makeResident(Entry& entry);
+    Entry* leastRecentEvictable();
+    int  find(const MacAddress& mac) const;
+    void stageSave();
+    bool save();
+
+    Preferences prefs;
+    StaticVector<Entry, ROSTER_CAPACITY> roster;
+    StaticRing<Pending, ROSTER_CAPACITY> queued;
+    size_t   slots;
+    size_t   residents = 0;
+    SendHook beforeSend  = nullptr;
+    void*    sendContext = nullptr;
+    uint32_t clock     = 0;
+
+    // Staged saves
+    uint32_t settleTime;
+    bool     dirty     = false;
+    uint32_t changedAt = 0;
+    uint32_t saves     = 0;
+
+    // Churn
+    uint32_t adds            = 0;
+    uint32_t removes         = 0;
+    uint64_t swapMicros      = 0;
+    uint32_t worstSwapMicros = 0;
+    uint32_t sends           = 0;
+    uint32_t failures        = 0;
+    uint32_t deferred        = 0;     // Sends queued behind an eviction
+};
@@ -0,0 +1,64 @@
+// PowerScheduler.h - Steps the remote down through its power states when idle.
+//
+// Input keeps the remote in DisplayOn. After the display timeout the OLED is switched off
+// and the loop light-sleeps between polls, waking on the button or the poll timer. After
+// the deep sleep timeout the board deep-sleeps until the button is pressed, which reboots
+// it; the energy model's totals ride through the deep sleep in RTC memory. An optional
+// auxiliary input also wakes the board from either sleep.
+//
+// Every transition is reported to the EnergyModel, which does the accounting.
+
+#pragma once
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include "EnergyModel.h"
+#include "StaticPool.h"
+
+class PowerScheduler
+{
+  public:
+    enum class Action
+    {
+        None,
+        DisplayOff,         // Caller should blank the OLED
+        DeepSleep           // Caller should save its state and call deepSleep()
+    };
+
+    // 'auxPin', if used, must be an RTC GPIO so that it can wake the board from deep sleep
+    PowerScheduler(EnergyModel& energyModel, const PowerTimeouts& powerTimeouts, gpio_num_t buttonPin,
+                   gpio_num_t auxPin = GPIO_NUM_NC)
+        : model(energyModel), timeouts(powerTimeouts), wakePin(buttonPin), auxWakePin(auxPin)
+    {
+    }
+
+    // Picks up the energy totals saved before a deep sleep, crediting the time slept
+    void begin();
+
+    // Input happened; returns true if the display was off and should be turned back on
+    bool noteActivity();
+
+    Action update();
+
+    // Waits out the rest of the loop iteration, light-sleeping if the display is off
+    // unless 'stayAwake' says something needs the CPU to keep running
+    void idle(uint32_t awakeMillis, uint32_t asleepMillis, bool stayAwake = false);
+
+    // Another input, active low, that wakes the board from light sleep
+    bool addWakePin(gpio_num_t pin) { return lightSleepWakePins.push_back(pin); }
+
+    [[noreturn]] void deepSleep();
+
+    uint32_t idleMillis() const { return millis() - lastActivity; }
+
+    // True if this boot is a wake from deep sleep caused by the auxiliary pin
+    bool wokeByAuxPin() const;
+
+  private:
+    EnergyModel&  model;
+    PowerTimeouts timeouts;
+    gpio_num_t    wakePin;
+    gpio_num_t    auxWakePin;
+    StaticVector<gpio_num_t, 4> lightSleepWakePins;
+    uint32_t      lastActivity = 0;
+};
@@ -0,0 +1,15 @@
+// PrintFormat.h - printf() to a Print without touching the heap.
+//
+// Print::printf() formats into a 64 byte buffer on the stack and mallocs a bigger one for
+// any line that doesn't fit. From inside update() that is a steady-state allocation,
+// which HeapWatch reports and HEAP_WATCH_STRICT halts on, and most reports and console
+// replies have lines longer than that. printFormat() formats into PRINT_FORMAT_MAX bytes
+// on the stack instead; a longer line is cut short rather than allocated for.
+
+#pragma once
+
+#include <Arduino.h>
+
+constexpr size_t PRINT_FORMAT_MAX = 256;
+
+size_t printFormat(Print& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
@@ -0,0 +1,115 @@
+// ProbeSession.h - Loss, burst and reordering statistics from a probe stream.
+//
+// The remote sends a stream of numbered Probe frames at a fixed rate, then asks every
+// receiver that took part for a ProbeReportFrame: a bitmap of the indexes it heard and
+// its counts of late and duplicate frames. Each report is turned into a row per
+// receiver: frames lost, how the losses bunch up (runs of consecutive missing indexes,
+// in log2 buckets, and the longest run) and how far out of order frames arrived. Bursts
+// matter more than the loss rate alone: a lost copy of a state frame is made up by the
+// next copy only if the two aren't lost together.
+//
+// Reports arrive on the WiFi task; the loop drains them into the session with
+// onReport(). Nothing here touches the hardware, so it builds on the host as well.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "ESPNowProtocol.h"
+#include "StaticPool.h"
+
+constexpr size_t MAX_PROBED_RECEIVERS = 8;
+constexpr size_t PROBE_BURST_BUCKETS  = 7;      // 1, 2, 3-4, 5-8, 9-16, 17-32, 33 and up
+
+struct ProbeReply
+{
+    std::array<uint8_t, 6> mac;
+    ProbeReport            report;
+};
+
+class ProbeSession
+{
+  public:
+    struct Receiver
+    {
+        std::array<uint8_t, 6> mac;
+        uint32_t received;
+        uint32_t lost;
+        uint32_t late;
+        uint32_t maxDisplacement;
+        uint32_t duplicates;
+        uint32_t longestBurst;
+        std::array<uint32_t, PROBE_BURST_BUCKETS> bursts;
+    };
+
+    // Forgets the last stream's results
+    void begin(uint16_t streamId, uint16_t frameCount)
+    {
+        stream = streamId;
+        count  = frameCount;
+        table.clear();
+        overflows = 0;
+    }
+
+    // The first report from each receiver counts; repeats of the request bring copies
+    void onReport(const std::array<uint8_t, 6>& mac, const ProbeReport& report)
+    {
+        if (report.stream != stream || report.count != count || find(mac))
+            return;
+
+        Receiver receiver = { mac, report.received, 0, report.late, report.maxDisplacement, report.duplicates, 0, {} };
+        uint32_t run = 0;
+        for (size_t index = 0; index <= count; index++)
+        {
+            if (index < count && !report.heard(index))
+            {
+                run++;
+                continue;
+            }
+            if (run != 0)
+            {
+                receiver.lost += run;
+                receiver.longestBurst = run > receiver.longestBurst ? run : receiver.longestBurst;
+                receiver.bursts[burstBucket(run)]++;
+                run = 0;
+            }
+        }
+
+        if (!table.push_back(receiver))
+            overflows++;
+    }
+
+    // Bucket 0 holds runs of 1, bucket b > 0 runs of 2^(b-1) + 1 to 2^b
+    static constexpr size_t burstBucket(uint32_t run)
+    {
+        size_t bucket = 0;
+        for (uint32_t limit = 1; run > limit && bucket + 1 < PROBE_BURST_BUCKETS; limit *= 2)
+            bucket++;
+        return bucket;
+    }
+
+    uint16_t streamId() const       { return stream; }
+    uint16_t frameCount() const     { return count; }
+    uint32_t overflowCount() const  { return overflows; }
+
+    const StaticVector<Receiver, MAX_PROBED_RECEIVERS>& receivers() const { return table; }
+
+  private:
+    const Receiver* find(const std::array<uint8_t, 6>& mac) const
+    {
+        for (const Receiver& receiver : table)
+            if (receiver.mac == mac)
+                return &receiver;
+        return nullptr;
+    }
+
+    StaticVector<Receiver, MAX_PROBED_RECEIVERS> table;
+    uint16_t stream    = 0;
+    uint16_t count     = 0;
+    uint32_t overflows = 0;
+};
+
+static_assert(ProbeSession::burstBucket(1) == 0 && ProbeSession::burstBucket(2) == 1 &&
+              ProbeSession::burstBucket(4) == 2 && ProbeSession::burstBucket(5) == 3 &&
+              ProbeSession::burstBucket(33) == 6 && ProbeSession::burstBucket(1000) == 6,
+              "Probe burst buckets are off");
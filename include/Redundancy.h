@@ -0,0 +1,227 @@
+// Redundancy.h - Time-diversity repeats for broadcast state frames.
+//
+// Broadcast ESP-NOW frames get no MAC ACK, so the send callback reports success whether
+// or not any plate heard them. Each state frame is therefore sent K times under a single
+// sequence number, with random gaps between the copies so that one burst of interference
+// can't take them all, and receivers drop the extra copies. In Adaptive mode K follows
+// the loss measured from the replies to manifest probes.
+//
+// Nothing here touches the hardware, so the host-side simulator in
+// lib/NightDriverReceiver/examples/RedundancySim builds it as well.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include "ESPNowProtocol.h"
+#include "StaticPool.h"
+
+enum class RedundancyMode : uint8_t
+{
+    Off,                // One copy of everything
+    Fixed,              // A set number of copies
+    Adaptive            // Enough copies to reach TARGET_DELIVERY at the measured loss
+};
+
+constexpr uint32_t MAX_COPIES      = 4;
+constexpr float    TARGET_DELIVERY = 0.999f;
+constexpr float    DEFAULT_LOSS    = 0.1f;      // Assumed until a probe has been answered
+constexpr uint32_t MIN_GAP_MS      = 5;         // Random gap between copies
+constexpr uint32_t MAX_GAP_MS      = 40;
+
+// Air time of one ESP-NOW frame at the default 1 Mbps rate: the long preamble and PLCP
+// header, then the vendor-specific action frame (MAC header, category, OUI, random bytes,
+// vendor element, FCS; 43 bytes) around the payload
+
+constexpr uint32_t frameAirtimeMicros(size_t payloadBytes = sizeof(Message))
+{
+    return 192 + uint32_t(43 + payloadBytes) * 8;
+}
+
+// Chance that at least one of 'copies' frames arrives if each is lost independently
+
+inline float deliveryProbability(float loss, uint32_t copies)
+{
+    return 1.0f - powf(loss, float(copies));
+}
+
+// Fewest copies that reach 'target' at 'loss', capped at MAX_COPIES
+
+inline uint32_t copiesFor(float loss, float target = TARGET_DELIVERY)
+{
+    for (uint32_t copies = 1; copies < MAX_COPIES; copies++)
+        if (deliveryProbability(loss, copies) >= target - 1e-6f)
+            return copies;
+    return MAX_COPIES;
+}
+
+// SequenceCounter
+//
+// Hands out sequence numbers, skipping zero, to every task that transmits. It should be
+// seeded at random at boot so that a rebooted remote doesn't repeat the numbers it used
+// just before, which receivers would take for copies.
+
+class SequenceCounter
+{
+  public:
+    void seed(uint16_t value)   { last.store(value, std::memory_order_relaxed); }
+
+    uint16_t take()
+    {
+        uint16_t sequence;
+        do
+        {
+            sequence = uint16_t(last.fetch_add(1, std::memory_order_relaxed) + 1);
+        } while (sequence == 0);
+        return sequence;
+    }
+
+  private:
+    std::atomic<uint16_t> last{0};
+};
+
+// LinkEstimator
+//
+// Every receiver in range answers a GetManifestHash, so the replies to one probe, against
+// the most heard for any of the last few probes, give the round-trip loss. The one-way
+// loss is what a state frame sees; assuming both directions are alike it is
+// 1 - sqrt(1 - round trip). Estimates are smoothed across probes.
+
+class LinkEstimator
+{
+  public:
+    void addProbe(uint32_t replies)
+    {
+        history.pushOverwrite(replies);
+
+        uint32_t expected = expectedReplies();
+        if (expected == 0)
+            return;
+
+        float roundTrip = 1.0f - float(replies) / float(expected);
+        float oneWay    = 1.0f - sqrtf(1.0f - roundTrip);
+        estimate = measured ? estimate + (oneWay - estimate) * SMOOTHING : oneWay;
+        measured = true;
+    }
+
+    // Receivers in range, as far as can be told
+    uint32_t expectedReplies() const
+    {
+        uint32_t most = 0;
+        for (size_t i = 0; i < history.size(); i++)
+            most = history[i] > most ? history[i] : most;
+        return most;
+    }
+
+    float loss() const          { return measured ? estimate : DEFAULT_LOSS; }
+    bool  hasMeasured() const   { return measured; }
+    size_t probes() const       { return history.size(); }
+
+  private:
+    static constexpr float SMOOTHING = 0.25f;
+
+    StaticRing<uint32_t, 8> history;
+    float estimate = 0;
+    bool  measured = false;
+};
+
+// RepeatScheduler
+//
+// Holds the copies still to be sent after the first, as encoded frames so that Messages
+// and StatesFrames can share it. A newer frame with the same command replaces the repeats
+// of an older one, since only the latest state matters.
+
+class RepeatScheduler
+{
+  public:
+    struct Frame
+    {
+        std::array<uint8_t, MAX_STATES_FRAME_SIZE> bytes = {};
+        size_t length = 0;
+
+        ESPNowCommand command() const   { return ESPNowCommand(bytes[1]); }
+
+        static Frame from(const Message& msg)
+        {
+            Frame frame;
+            auto encoded = encodeMessage(msg);
+            std::copy(encoded.begin(), encoded.end(), frame.bytes.begin());
+            frame.length = encoded.size();
+            return frame;
+        }
+
+        static Frame from(const StatesFrame& states)
+        {
+            Frame frame;
+            frame.length = encodeStates(states, frame.bytes);
+            return frame;
+        }
+    };
+
+    static_assert(MAX_STATES_FRAME_SIZE >= sizeof(Message), "Frame can't hold a Message");
+
+    // Queues 'copies' - 1 repeats of 'frame'; 'random' picks the gap before the first
+    void schedule(const Frame& frame, uint32_t copies, uint32_t now, uint32_t random)
+    {
+        cancel(frame.command());
+        if (copies > 1)
+            pending.push_back({frame, now + gap(random), copies - 1});
+    }
+
+    void schedule(const Message& msg, uint32_t copies, uint32_t now, uint32_t random)
+    {
+        schedule(Frame::from(msg), copies, now, random);
+    }
+
+    void schedule(const StatesFrame& states, uint32_t copies, uint32_t now, uint32_t random)
+    {
+        schedule(Frame::from(states), copies, now, random);
+    }
+
+    // Takes the next repeat due by 'now', if any; 'random' picks the gap to the one after
+    bool due(uint32_t now, uint32_t random, Frame& out)
+    {
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            Pending& repeat = pending[i];
+            if (int32_t(now - repeat.dueMillis) < 0)
+                continue;
+
+            out = repeat.frame;
+            if (--repeat.remaining == 0)
+                pending.erase(i);
+            else
+                repeat.dueMillis = now + gap(random);
+            return true;
+        }
+        return false;
+    }
+
+    void cancel(ESPNowCommand command)
+    {
+        for (size_t i = 0; i < pending.size(); i++)
+            if (pending[i].frame.command() == command)
+                pending.erase(i--);
+    }
+
+    void clear()                { pending.clear(); }
+    bool empty() const          { return pending.empty(); }
+
+  private:
+    struct Pending
+    {
+        Frame    frame;
+        uint32_t dueMillis;
+        uint32_t remaining;
+    };
+
+    static uint32_t gap(uint32_t random)
+    {
+        return MIN_GAP_MS + random % (MAX_GAP_MS - MIN_GAP_MS + 1);
+    }
+
+    StaticVector<Pending, 8> pending;
+};
@@ -0,0 +1,33 @@
+// SendOrder.h - Tells which frame an ESP-NOW send callback is reporting on.
+//
+// The send callback is given the peer's MAC and a status, not the frame. ESP-NOW reports
+// on frames in the order esp_now_send() queued them, so numbering every frame that was
+// queued, and counting callbacks, is enough to know when a particular frame has left.
+// That only holds if every esp_now_send() in the firmware goes through send() and every
+// callback calls onCallback() first, whatever else it then does with the result.
+//
+// send() holds a mutex across numbering and queueing, so the vehicle signal task, which
+// preempts the loop, can't queue a frame between the loop numbering one and queueing it.
+
+#pragma once
+
+#include <Arduino.h>
+#include "HotPath.h"
+
+namespace SendOrder
+{
+    // Creates the mutex; before this, send() doesn't lock
+    bool begin();
+
+    // esp_now_send() with a number; returns the frame's ticket, or 0 if it was refused
+    uint32_t send(const uint8_t* peer, const uint8_t* data, size_t length);
+
+    // First thing in the send callback
+    void HOT_PATH onCallback();
+
+    // True once the callback for 'ticket' has come back
+    bool HOT_PATH hasLeft(uint32_t ticket);
+
+    // After esp_now_deinit(), which drops frames still queued along with their callbacks
+    void resync();
+}
@@ -0,0 +1,96 @@
+// SerialConsole.h - Line-oriented command console on the USB serial port.
+//
+// Subsystems register named commands with a handler and a context pointer. Input is
+// accumulated into a fixed buffer and dispatched when a newline arrives; the first word
+// selects the command and the remainder is passed to the handler as its arguments.
+
+#pragma once
+
+#include <Arduino.h>
+#include <cstring>
+#include "PrintFormat.h"
+#include "StaticPool.h"
+
+class SerialConsole
+{
+  public:
+    using Handler = void (*)(void* context, const char* args, Print& out);
+
+    static constexpr size_t MAX_COMMANDS = 32;
+    static constexpr size_t MAX_LINE     = 64;
+
+    bool addCommand(const char* name, const char* help, Handler handler, void* context)
+    {
+        return commands.push_back({name, help, handler, context});
+    }
+
+    // Consumes whatever input is pending without blocking
+
+    void poll(Stream& in, Print& out)
+    {
+        while (in.available() > 0)
+        {
+            int c = in.read();
+            if (c < 0)
+                break;
+
+            if (c == '\r' || c == '\n')
+            {
+                line[length] = '\0';
+                if (length > 0)
+                    dispatch(out);
+                length = 0;
+            }
+            else if (length < MAX_LINE - 1)
+            {
+                line[length++] = static_cast<char>(c);
+            }
+        }
+    }
+
+  private:
+    struct Command
+    {
+        const char* name;
+        const char* help;
+        Handler     handler;
+        void*       context;
+    };
+
+    void dispatch(Print& out)
+    {
+        char* args = strchr(line.data(), ' ');
+        if (args)
+        {
+            *args++ = '\0';
+            while (*args == ' ')
+                args++;
+        }
+        else
+        {
+            args = line.data() + length;
+        }
+
+        if (strcmp(line.data(), "help") == 0)
+        {
+            for (const auto& command : commands)
+                printFormat(out, "  %-12s %s\n", command.name, command.help);
+            return;
+        }
+
+        for (const auto& command : commands)
+        {
+            if (strcmp(line.data(), command.name) == 0)
+            {
+                command.handler(command.context, args, out);
+                return;
+            }
+        }
+
+        printFormat(out, "Unknown command '%s', try 'help'\n", line.data());
+    }
+
+    StaticVector<Command, MAX_COMMANDS> commands;
+    std::array<char, MAX_LINE> line = {};
+    size_t length = 0;
+};
@@ -0,0 +1,96 @@
+// Sniffer.h - Promiscuous capture of ESP-NOW frames, streamed to a host as pcap records.
+//
+// While capturing, the radio hands every management frame it hears on the current
+// channel to onPacket() on the WiFi task. Anything but an ESP-NOW vendor action frame
+// (category 127, Espressif OUI, type 4) is dropped there and then. The rest are
+// timestamped and copied into a ring of SNIFFER_RING_BYTES with a single producer and a
+// single consumer, so the callback takes no lock, allocates nothing and runs from IRAM.
+// A frame that doesn't fit is counted as dropped rather than overwriting one not yet
+// sent. Frames this remote sends itself are not seen.
+//
+// A task of its own drains the ring to the serial port: SNIFFER_SYNC and a pcap file
+// header first, then each frame as SNIFFER_SYNC, a pcap record header, a radiotap header
+// with the channel and RSSI, and the 802.11 frame without its FCS. The sync words let
+// scripts/espnow_pcap.py pick the records out from among console text and write a plain
+// .pcap file. Each record goes out in one write, which Serial locks, so the loop's
+// console output can only fall between records. The port runs at SNIFFER_BAUD during a
+// capture, since at the console's usual rate it would fall behind a busy channel.
+//
+// Draining from the loop left the ring to cover the loop's worst stall, an OLED flush or
+// anything up to the loop deadline. The task only waits on the serial port, which carries
+// about 280 full-size frames a second; at that rate the ring holds some 45 ms of them.
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+#include <array>
+#include <atomic>
+#include "HotPath.h"
+
+constexpr size_t   SNIFFER_RING_BYTES  = 4096;
+constexpr size_t   SNIFFER_SNAPLEN     = 320;      // A whole ESP-NOW frame with a 250 byte body
+constexpr size_t   SNIFFER_DRAIN_BYTES = 2048;     // Per drain() pass, between checks for a stop
+constexpr uint32_t SNIFFER_DRAIN_MS    = 5;        // The drain task's wait while the ring is empty
+constexpr uint32_t SNIFFER_BAUD        = 921600;
+
+constexpr std::array<uint8_t, 4> SNIFFER_SYNC = {{ 'N', 'D', 'S', 'R' }};
+
+static_assert((SNIFFER_RING_BYTES & (SNIFFER_RING_BYTES - 1)) == 0, "The sniffer ring size must be a power of two");
+
+class Sniffer
+{
+  public:
+    // Starts the drain task, which writes captures to 'out'; called once from setup()
+    bool begin(Print& out);
+
+    // Starts capturing on the current channel
+    bool start();
+
+    // Stops capturing, and returns once everything captured has been written out
+    void stop();
+
+    bool isRunning() const      { return running.load(std::memory_order_relaxed); }
+
+    void report(Print& out) const;
+
+  private:
+    // Stored ahead of each frame in the ring
+    struct Record
+    {
+        int64_t  micros;
+        uint16_t length;            // Bytes captured
+        uint16_t originalLength;    // Of the frame on air, without the FCS
+        int8_t   rssi;
+        uint8_t  channel;
+    };
+
+    static void HOT_PATH onPacket(void* buffer, wifi_promiscuous_pkt_type_t type);
+    void HOT_PATH capture(const wifi_promiscuous_pkt_t& packet);
+    void HOT_PATH put(uint32_t position, const void* data, size_t length);
+    void get(uint32_t position, void* data, size_t length) const;
+    static void taskEntry(void* context);
+    void run();
+    void writeFileHeader();
+
+    // Writes out up to SNIFFER_DRAIN_BYTES of what has been captured; false once the
+    // ring is empty
+    bool drain();
+
+    static Sniffer* active;
+
+    Print*       output = nullptr;
+    TaskHandle_t task   = nullptr;
+
+    std::atomic<bool> running{false};
+    std::atomic<bool> draining{false};          // From start() until the task has written the capture out
+    std::array<uint8_t, SNIFFER_RING_BYTES> ring = {};
+    std::atomic<uint32_t> head{0};              // Written by the callback
+    std::atomic<uint32_t> tail{0};              // Written by the drain task
+
+    std::atomic<uint32_t> captured{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> ignored{0};           // Management frames that weren't ESP-NOW
+    std::atomic<uint32_t> sent{0};
+    std::atomic<uint32_t> sentBytes{0};
+};
@@ -0,0 +1,131 @@
+// StateReconciler.h - What each receiver reports showing, against what the remote sent.
+//
+// The remote's current effect is only what it believes the plates show: a receiver may
+// have missed the frames, or another remote may have changed it since. After each change
+// the remote asks with GetState, and every receiver that hears the query replies with
+// the effect and brightness it is showing. Receivers are told apart by MAC. A query
+// closes once its replies have had time to arrive. A receiver that answered with
+// something else is then a mismatch, to be flagged and sent the state again, and one
+// heard before that didn't answer is silent.
+//
+// Replies arrive on the WiFi task; the loop drains them into the table with onReply().
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include "StaticPool.h"
+
+constexpr size_t MAX_RECONCILED_RECEIVERS = 16;
+
+struct StateReport
+{
+    std::array<uint8_t, 6> mac;
+    uint8_t  effect;                // Wire index of a PlateEffect
+    uint8_t  brightness;
+    uint16_t sequence;              // Of the GetState answered
+};
+
+class StateReconciler
+{
+  public:
+    struct Receiver
+    {
+        std::array<uint8_t, 6> mac;
+        uint8_t  effect;            // As last reported
+        uint8_t  brightness;
+        bool     answered;          // Replied to the current or last query
+        bool     matches;           // And its state was the expected one
+        uint32_t resends;           // Since the last change
+    };
+
+    // Opens a query; replies carrying 'sequence' are checked against 'effect' and
+    // 'brightness'. 'changed' is false for a query that follows a resend, which keeps
+    // the resend counts running.
+    void beginQuery(uint16_t sequence, uint8_t effect, uint8_t brightness, bool changed)
+    {
+        query            = sequence;
+        expectEffect     = effect;
+        expectBrightness = brightness;
+        open             = true;
+        queries++;
+        for (Receiver& receiver : table)
+        {
+            receiver.answered = false;
+            if (changed)
+                receiver.resends = 0;
+        }
+    }
+
+    void onReply(const StateReport& report)
+    {
+        if (!open || report.sequence != query)
+            return;
+
+        Receiver* receiver = find(report.mac);
+        if (!receiver)
+        {
+            if (!table.push_back({report.mac, 0, 0, false, false, 0}))
+            {
+                overflows++;
+                return;
+            }
+            receiver = &table[table.size() - 1];
+        }
+
+        receiver->effect     = report.effect;
+        receiver->brightness = report.brightness;
+        receiver->answered   = true;
+        receiver->matches    = report.effect == expectEffect && report.brightness == expectBrightness;
+    }
+
+    // Closes the query; returns the number of receivers that answered with the wrong state
+    size_t closeQuery()
+    {
+        open = false;
+        return mismatches();
+    }
+
+    size_t mismatches() const
+    {
+        size_t count = 0;
+        for (const Receiver& receiver : table)
+            count += receiver.answered && !receiver.matches;
+        return count;
+    }
+
+    size_t silent() const
+    {
+        size_t count = 0;
+        for (const Receiver& receiver : table)
+            count += !receiver.answered;
+        return count;
+    }
+
+    bool isOpen() const                 { return open; }
+    uint8_t expectedEffect() const      { return expectEffect; }
+    uint8_t expectedBrightness() const  { return expectBrightness; }
+    uint32_t queryCount() const         { return queries; }
+    uint32_t overflowCount() const      { return overflows; }
+
+    StaticVector<Receiver, MAX_RECONCILED_RECEIVERS>& receivers()             { return table; }
+    const StaticVector<Receiver, MAX_RECONCILED_RECEIVERS>& receivers() const { return table; }
+
+  private:
+    Receiver* find(const std::array<uint8_t, 6>& mac)
+    {
+        for (Receiver& receiver : table)
+            if (receiver.mac == mac)
+                return &receiver;
+        return nullptr;
+    }
+
+    StaticVector<Receiver, MAX_RECONCILED_RECEIVERS> table;
+    uint16_t query            = 0;
+    uint8_t  expectEffect     = 0;
+    uint8_t  expectBrightness = 0;
+    bool     open             = false;
+    uint32_t queries          = 0;
+    uint32_t overflows        = 0;
+};
@@ -0,0 +1,132 @@
+// StateStore.h - Persists the remote's selected effect, brightness, group and channel to NVS.
+//
+// Flash endurance is finite, so changes are not written as they happen. stage() records
+// the new state and poll() commits it only once it has been stable for the settle time;
+// a burst of presses costs a single write, and ending up back where we started costs none.
+
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include "PrintFormat.h"
+
+struct RemoteState
+{
+    uint32_t effect;        // Index into EFFECTS
+    uint8_t  brightness;
+    uint8_t  group;         // Index into the remote's TARGET_GROUPS
+    uint8_t  channel;       // WiFi channel ESP-NOW runs on, 0 for the radio's default
+
+    bool operator==(const RemoteState& other) const
+    {
+        return effect == other.effect && brightness == other.brightness && group == other.group &&
+               channel == other.channel;
+    }
+
+    bool operator!=(const RemoteState& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+class StateStore
+{
+  public:
+    explicit StateStore(uint32_t settleMillis) : settleTime(settleMillis)
+    {
+    }
+
+    bool begin()
+    {
+        return prefs.begin(NAMESPACE, false);
+    }
+
+    // Fills 'state' with the persisted state; returns false if there is none or it is
+    // from an incompatible layout
+
+    bool load(RemoteState& state)
+    {
+        StoredState blob;
+        if (prefs.getBytesLength(KEY) != sizeof(blob) || prefs.getBytes(KEY, &blob, sizeof(blob)) != sizeof(blob))
+            return false;
+
+        if (blob.version != LAYOUT_VERSION)
+            return false;
+
+        state = stored = {blob.effect, blob.brightness, blob.group, blob.channel};
+        return true;
+    }
+
+    // Notes a new state; it is written once it has been left alone for the settle time
+
+    void stage(const RemoteState& state)
+    {
+        pending   = state;
+        dirty     = true;
+        changedAt = millis();
+    }
+
+    void poll()
+    {
+        if (dirty && millis() - changedAt >= settleTime)
+            flush();
+    }
+
+    // Writes any staged state immediately, skipping the write if flash already holds it
+
+    bool flush()
+    {
+        if (!dirty)
+            return true;
+
+        dirty = false;
+        if (pending == stored)
+            return true;
+
+        StoredState blob = {LAYOUT_VERSION, pending.brightness, pending.group, pending.channel, pending.effect};
+        if (prefs.putBytes(KEY, &blob, sizeof(blob)) != sizeof(blob))
+        {
+            Serial.println(F("Failed to persist state"));
+            return false;
+        }
+
+        stored = pending;
+        writes++;
+        return true;
+    }
+
+    bool isDirty() const            { return dirty; }
+    uint32_t writeCount() const     { return writes; }
+
+    void report(Print& out) const
+    {
+        printFormat(out, "Stored: effect %u, brightness %u, group %u, channel %u; %s; %u writes since boot\n",
+                    unsigned(stored.effect), unsigned(stored.brightness), unsigned(stored.group), unsigned(stored.channel),
+                    dirty ? "change pending" : "clean", unsigned(writes));
+    }
+
+  private:
+    static constexpr const char* NAMESPACE      = "remote";
+    static constexpr const char* KEY            = "state";
+    static constexpr uint8_t     LAYOUT_VERSION = 1;
+
+    // The group and the channel took over reserved bytes that were always written as zero,
+    // which means the "all" group and the default channel, so the layout version didn't
+    // change
+    struct StoredState
+    {
+        uint8_t  version;
+        uint8_t  brightness;
+        uint8_t  group;
+        uint8_t  channel;
+        uint32_t effect;
+    };
+
+    Preferences prefs;
+    uint32_t    settleTime;
+    RemoteState pending   = {};
+    RemoteState stored    = {};
+    bool        dirty     = false;
+    uint32_t    changedAt = 0;
+    uint32_t    writes    = 0;
+};
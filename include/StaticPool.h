@@ -0,0 +1,130 @@
+// StaticPool.h - Compile-time sized containers for project-owned buffers.
+//
+// The remote is expected to run for months without a reboot, so nothing the project
+// owns is allowed to come from the heap after setup(). Queues, catalogs, logs and
+// rosters use these containers instead of std::vector/std::deque; their storage is
+// sized at compile time and lives in .bss alongside the object that owns them.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// StaticRing
+//
+// Fixed capacity FIFO. push() refuses new entries when full, pushOverwrite() drops the
+// oldest entry instead, which is what logs and histories want.
+
+template <typename T, size_t N>
+class StaticRing
+{
+    static_assert(N > 0, "StaticRing needs a non-zero capacity");
+
+  public:
+    bool push(const T& value)
+    {
+        if (full())
+            return false;
+
+        items[(head + count) % N] = value;
+        count++;
+        return true;
+    }
+
+    void pushOverwrite(const T& value)
+    {
+        if (full())
+            pop();
+        push(value);
+    }
+
+    // Removes the oldest entry, copying it to 'value' if one was present
+    bool pop(T& value)
+    {
+        if (empty())
+            return false;
+
+        value = items[head];
+        return pop();
+    }
+
+    bool pop()
+    {
+        if (empty())
+            return false;
+
+        head = (head + 1) % N;
+        count--;
+        return true;
+    }
+
+    const T& front() const          { return items[head]; }
+    const T& back() const           { return items[(head + count - 1) % N]; }
+
+    // Index 0 is the oldest entry
+    T& operator[](size_t i)              { return items[(head + i) % N]; }
+    const T& operator[](size_t i) const  { return items[(head + i) % N]; }
+
+    size_t size() const             { return count; }
+    bool empty() const              { return count == 0; }
+    bool full() const               { return count == N; }
+    void clear()                    { head = count = 0; }
+
+    static constexpr size_t capacity() { return N; }
+
+  private:
+    std::array<T, N> items = {};
+    size_t head  = 0;
+    size_t count = 0;
+};
+
+// StaticVector
+//
+// Fixed capacity array with a run-time length, for catalogs and rosters.
+
+template <typename T, size_t N>
+class StaticVector
+{
+    static_assert(N > 0, "StaticVector needs a non-zero capacity");
+
+  public:
+    bool push_back(const T& value)
+    {
+        if (full())
+            return false;
+
+        items[count++] = value;
+        return true;
+    }
+
+    // Removes the entry at 'index', preserving the order of the rest
+    bool erase(size_t index)
+    {
+        if (index >= count)
+            return false;
+
+        for (size_t i = index + 1; i < count; i++)
+            items[i - 1] = items[i];
+        count--;
+        return true;
+    }
+
+    T* begin()                      { return items.data(); }
+    T* end()                        { return items.data() + count; }
+    const T* begin() const          { return items.data(); }
+    const T* end() const            { return items.data() + count; }
+
+    T& operator[](size_t i)              { return items[i]; }
+    const T& operator[](size_t i) const  { return items[i]; }
+
+    size_t size() const             { return count; }
+    bool empty() const              { return count == 0; }
+    bool full() const               { return count == N; }
+    void clear()                    { count = 0; }
+
+    static constexpr size_t capacity() { return N; }
+
+  private:
+    std::array<T, N> items = {};
+    size_t count = 0;
+};
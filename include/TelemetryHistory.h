@@ -0,0 +1,301 @@
+// TelemetryHistory.h - Receiver health readings kept on the remote as compact time series.
+//
+// Each receiver's readings go into fixed-size byte rings, one per field. A ring holds the
+// oldest sample in full and every later one as the difference from the sample before,
+// zigzag encoded into a varint. Readings change slowly, so most samples take a byte per
+// field instead of two to four. When a new sample doesn't fit, the oldest ones are
+// dropped from every field together, folding each dropped difference into the new
+// oldest value. The polling rate adapts too: the interval doubles each time nothing
+// moved much and drops back to the minimum when something did.
+//
+// Nothing here touches the hardware, so it builds on the host as well.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include "ESPNowProtocol.h"
+#include "StaticPool.h"
+
+constexpr size_t   MAX_TELEMETRY_RECEIVERS = 4;
+constexpr size_t   TELEMETRY_SERIES_BYTES  = 256;       // Per field, per receiver
+constexpr uint32_t TELEMETRY_MIN_MS        = 30 * 1000;
+constexpr uint32_t TELEMETRY_MAX_MS        = 8 * 60 * 1000;
+
+// DeltaSeries
+//
+// One field's ring of zigzag varint differences
+
+template <size_t Bytes>
+class DeltaSeries
+{
+  public:
+    // Walks the series from the oldest sample
+    struct Cursor
+    {
+        size_t  position;
+        size_t  remaining;
+        int32_t value;
+    };
+
+    bool fits(int32_t value) const
+    {
+        return count == 0 || varintLength(zigzag(int64_t(value) - newest)) <= Bytes - used;
+    }
+
+    // The caller makes room with popOldest() first
+    void push(int32_t value)
+    {
+        if (count++ == 0)
+            oldest = value;
+        else
+            writeVarint(zigzag(int64_t(value) - newest));
+        newest = value;
+    }
+
+    void popOldest()
+    {
+        if (count <= 1)
+        {
+            count = used = head = 0;
+            return;
+        }
+
+        size_t position = head;
+        oldest = int32_t(oldest + unzigzag(readVarint(position)));
+        used  -= position - head;
+        head   = position % Bytes;
+        count--;
+    }
+
+    Cursor begin() const        { return { head, count, oldest }; }
+
+    // Returns the sample under 'cursor' and moves it on; false at the end
+    bool next(Cursor& cursor, int32_t& value) const
+    {
+        if (cursor.remaining == 0)
+            return false;
+
+        value = cursor.value;
+        if (--cursor.remaining != 0)
+            cursor.value = int32_t(cursor.value + unzigzag(readVarint(cursor.position)));
+        return true;
+    }
+
+    size_t  size() const        { return count; }
+    int32_t latest() const      { return newest; }
+    size_t  bytesUsed() const   { return count ? used + sizeof(oldest) : 0; }
+
+  private:
+    static uint64_t zigzag(int64_t value)   { return uint64_t(value) << 1 ^ uint64_t(value >> 63); }
+    static int64_t unzigzag(uint64_t value) { return int64_t(value >> 1) ^ -int64_t(value & 1); }
+
+    static size_t varintLength(uint64_t value)
+    {
+        size_t length = 1;
+        for (; value >= 0x80; value >>= 7)
+            length++;
+        return length;
+    }
+
+    void writeVarint(uint64_t value)
+    {
+        for (;;)
+        {
+            uint8_t byte = value & 0x7F;
+            value >>= 7;
+            bytes[(head + used++) % Bytes] = byte | (value ? 0x80 : 0);
+            if (!value)
+                return;
+        }
+    }
+
+    // Reads from 'position', leaving it just past the varint; it isn't wrapped
+    uint64_t readVarint(size_t& position) const
+    {
+        uint64_t value = 0;
+        for (unsigned shift = 0;; shift += 7)
+        {
+            uint8_t byte = bytes[position++ % Bytes];
+            value |= uint64_t(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+    }
+
+    std::array<uint8_t, Bytes> bytes = {};
+    size_t  head   = 0;
+    size_t  used   = 0;             // Bytes of differences after the oldest sample
+    size_t  count  = 0;
+    int32_t oldest = 0;
+    int32_t newest = 0;
+};
+
+// A reply as the receive callback hands it to the loop
+
+struct TelemetryReply
+{
+    std::array<uint8_t, 6> mac;
+    uint16_t               sequence;
+    ReceiverTelemetry      readings;
+};
+
+struct TelemetrySample
+{
+    uint32_t          seconds;      // Since the remote booted
+    ReceiverTelemetry readings;
+};
+
+// TelemetryHistory
+//
+// The series for one receiver, kept in step
+
+class TelemetryHistory
+{
+  public:
+    void push(const TelemetrySample& sample)
+    {
+        std::array<int32_t, FIELDS> values = toFields(sample);
+        while (series[0].size() != 0 && !fitsAll(values))
+            for (Series& field : series)
+                field.popOldest();
+
+        for (size_t i = 0; i < FIELDS; i++)
+            series[i].push(values[i]);
+    }
+
+    // Calls 'visit' with every sample, oldest first
+    template <typename Visitor>
+    void forEach(Visitor visit) const
+    {
+        std::array<Series::Cursor, FIELDS> cursors;
+        for (size_t i = 0; i < FIELDS; i++)
+            cursors[i] = series[i].begin();
+
+        std::array<int32_t, FIELDS> values;
+        for (;;)
+        {
+            for (size_t i = 0; i < FIELDS; i++)
+                if (!series[i].next(cursors[i], values[i]))
+                    return;
+            visit(fromFields(values));
+        }
+    }
+
+    TelemetrySample latest() const
+    {
+        std::array<int32_t, FIELDS> values;
+        for (size_t i = 0; i < FIELDS; i++)
+            values[i] = series[i].latest();
+        return fromFields(values);
+    }
+
+    size_t size() const         { return series[0].size(); }
+
+    size_t bytesUsed() const
+    {
+        size_t total = 0;
+        for (const Series& field : series)
+            total += field.bytesUsed();
+        return total;
+    }
+
+    // What the same samples would take stored whole
+    size_t rawBytes() const     { return size() * (sizeof(uint32_t) + 2 + 4 + 2 + 2); }
+
+  private:
+    static constexpr size_t FIELDS = 5;
+    using Series = DeltaSeries<TELEMETRY_SERIES_BYTES>;
+
+    static std::array<int32_t, FIELDS> toFields(const TelemetrySample& sample)
+    {
+        return {{ int32_t(sample.seconds), sample.readings.fpsTenths, int32_t(sample.readings.freeHeap),
+                  sample.readings.temperatureTenths, sample.readings.powerMilliwatts }};
+    }
+
+    static TelemetrySample fromFields(const std::array<int32_t, FIELDS>& values)
+    {
+        return { uint32_t(values[0]), { uint16_t(values[1]), uint32_t(values[2]), int16_t(values[3]), uint16_t(values[4]) } };
+    }
+
+    bool fitsAll(const std::array<int32_t, FIELDS>& values) const
+    {
+        for (size_t i = 0; i < FIELDS; i++)
+            if (!series[i].fits(values[i]))
+                return false;
+        return true;
+    }
+
+    std::array<Series, FIELDS> series;
+};
+
+// TelemetryStore
+//
+// Histories for up to MAX_TELEMETRY_RECEIVERS receivers, told apart by MAC, and the
+// adaptive poll interval
+
+class TelemetryStore
+{
+  public:
+    struct Receiver
+    {
+        std::array<uint8_t, 6> mac;
+        TelemetryHistory       history;
+    };
+
+    // Adds a reply; false if the receiver is new and there's no room for it
+    bool record(const std::array<uint8_t, 6>& mac, const TelemetrySample& sample)
+    {
+        Receiver* receiver = find(mac);
+        if (!receiver)
+        {
+            if (!receivers.push_back({mac, {}}))
+                return false;
+            receiver = &receivers[receivers.size() - 1];
+            moved    = true;
+        }
+        else if (hasMoved(receiver->history.latest().readings, sample.readings))
+        {
+            moved = true;
+        }
+
+        receiver->history.push(sample);
+        return true;
+    }
+
+    // Ends a poll: the interval to the next one doubles unless a reading moved
+    void pollFinished()
+    {
+        interval = moved ? TELEMETRY_MIN_MS : std::min(interval * 2, TELEMETRY_MAX_MS);
+        moved    = false;
+    }
+
+    uint32_t pollInterval() const   { return interval; }
+
+    const StaticVector<Receiver, MAX_TELEMETRY_RECEIVERS>& all() const { return receivers; }
+
+  private:
+    // A change worth polling faster for: 10% of the frame rate or power, 2 degrees, or
+    // 4 KB of heap
+    static bool hasMoved(const ReceiverTelemetry& before, const ReceiverTelemetry& now)
+    {
+        return std::abs(int(now.fpsTenths) - int(before.fpsTenths)) * 10 > int(before.fpsTenths) ||
+               std::abs(int(now.powerMilliwatts) - int(before.powerMilliwatts)) * 10 > int(before.powerMilliwatts) ||
+               std::abs(int(now.temperatureTenths) - int(before.temperatureTenths)) >= 20 ||
+               std::abs(int64_t(now.freeHeap) - int64_t(before.freeHeap)) >= 4096;
+    }
+
+    Receiver* find(const std::array<uint8_t, 6>& mac)
+    {
+        for (Receiver& receiver : receivers)
+            if (receiver.mac == mac)
+                return &receiver;
+        return nullptr;
+    }
+
+    StaticVector<Receiver, MAX_TELEMETRY_RECEIVERS> receivers;
+    uint32_t interval = TELEMETRY_MIN_MS;
+    bool     moved    = false;
+};
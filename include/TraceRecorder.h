@@ -0,0 +1,233 @@
+// TraceRecorder.h - Span recorder that exports Chrome/Perfetto trace JSON.
+//
+// Spans are recorded as complete ("X") events with a start time and duration, tagged
+// with the thread they ran on. The recorder is a template over its buffer: the firmware
+// uses a StaticRing that keeps the most recent events, while host builds can use the
+// UnboundedTraceBuffer below to keep everything. writeJson() emits a document that
+// chrome://tracing and ui.perfetto.dev open directly.
+//
+// The header builds on the host too. There the lock is a std::mutex and spans are timed
+// with std::chrono; simulators that keep their own clock call record() with simulated
+// times instead, and give their actors threads of their own with nameThread().
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include "StaticPool.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#include <mutex>
+#include <vector>
+#endif
+
+enum class TraceThread : uint8_t
+{
+    Loop = 1,
+    WiFi = 2,
+    FirstSimulated = 3          // Host simulators number their own threads from here
+};
+
+constexpr size_t TRACE_THREADS = 16;    // Thread ids that can be given a name
+
+struct TraceEvent
+{
+    const char* name;           // Must be a string literal; only the pointer is stored
+    uint32_t    start;          // Microseconds
+    uint32_t    duration;
+    TraceThread thread;
+};
+
+#ifdef ARDUINO
+
+inline uint32_t traceMicros()
+{
+    return micros();
+}
+
+#else
+
+inline uint32_t traceMicros()
+{
+    static const auto origin = std::chrono::steady_clock::now();
+    return uint32_t(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count());
+}
+
+// Host builds keep every event
+
+class UnboundedTraceBuffer
+{
+  public:
+    void pushOverwrite(const TraceEvent& event)         { events.push_back(event); }
+    size_t size() const                                 { return events.size(); }
+    const TraceEvent& operator[](size_t i) const        { return events[i]; }
+    void clear()                                        { events.clear(); }
+
+  private:
+    std::vector<TraceEvent> events;
+};
+
+// Lets writeJson() write to a file on the host, where there is no Print
+
+class TraceFile
+{
+  public:
+    explicit TraceFile(FILE* file) : out(file)
+    {
+    }
+
+    void print(const char* text)    { fputs(text, out); }
+
+  private:
+    FILE* out;
+};
+
+#endif
+
+template <typename Buffer>
+class BasicTraceRecorder
+{
+  public:
+    void record(const char* name, uint32_t start, uint32_t duration, TraceThread thread)
+    {
+        if (!enabled)
+            return;
+
+        lock();
+        events.pushOverwrite({name, start, duration, thread});
+        recorded++;
+        unlock();
+    }
+
+    // Names a thread in the exported trace; 'name' must be a string literal, or outlive
+    // the recorder
+    void nameThread(TraceThread thread, const char* name)
+    {
+        if (size_t(thread) < TRACE_THREADS)
+            threadNames[size_t(thread)] = name;
+    }
+
+    void setEnabled(bool enable)    { enabled = enable; }
+    bool isEnabled() const          { return enabled; }
+    size_t bufferedCount() const    { return events.size(); }
+
+    // Total events recorded since boot, including any that have since been overwritten
+    uint32_t recordedCount() const  { return recorded; }
+
+    void clear()
+    {
+        lock();
+        events.clear();
+        unlock();
+    }
+
+    // Writes the buffered events as a Chrome trace to anything with print(const char*):
+    // a Print on the device, a TraceFile on the host. Recording is paused while writing,
+    // since printing a full buffer over serial takes a while.
+
+    template <typename Output>
+    void writeJson(Output& out)
+    {
+        bool wasEnabled = enabled;
+        enabled = false;
+
+        // Let a record() already in progress on the other core finish
+        lock();
+        unlock();
+
+        char line[160];
+        out.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        const char* separator = "";
+        for (size_t tid = 0; tid < TRACE_THREADS; tid++)
+        {
+            if (!threadNames[tid])
+                continue;
+            snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                     separator, unsigned(tid), threadNames[tid]);
+            out.print(line);
+            separator = ",\n";
+        }
+
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            const auto& event = events[i];
+            snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":1,\"tid\":%u}",
+                     separator, event.name, unsigned(event.start), unsigned(event.duration), unsigned(event.thread));
+            out.print(line);
+            separator = ",\n";
+        }
+
+        out.print("\n]}\n");
+        enabled = wasEnabled;
+    }
+
+  private:
+#ifdef ARDUINO
+    void lock()     { portENTER_CRITICAL_SAFE(&mux); }
+    void unlock()   { portEXIT_CRITICAL_SAFE(&mux); }
+
+    portMUX_TYPE  mux      = portMUX_INITIALIZER_UNLOCKED;
+    volatile bool enabled  = true;
+#else
+    void lock()     { mutex.lock(); }
+    void unlock()   { mutex.unlock(); }
+
+    std::mutex        mutex;
+    std::atomic<bool> enabled{true};
+#endif
+
+    Buffer       events;
+    uint32_t     recorded = 0;
+    std::array<const char*, TRACE_THREADS> threadNames = {{ nullptr, "loop", "wifi" }};
+};
+
+// RAII span. With 'onlyIfNested' the span is dropped unless something else was recorded
+// while it was open, which keeps idle loop iterations out of the buffer.
+
+template <typename Recorder>
+class BasicTraceSpan
+{
+  public:
+    BasicTraceSpan(Recorder& recorder, const char* spanName, TraceThread spanThread = TraceThread::Loop,
+                   bool onlyIfNested = false)
+        : owner(recorder), name(spanName), thread(spanThread), nestedOnly(onlyIfNested),
+          countAtStart(recorder.recordedCount()), start(traceMicros())
+    {
+    }
+
+    ~BasicTraceSpan()
+    {
+        if (!nestedOnly || owner.recordedCount() != countAtStart)
+            owner.record(name, start, traceMicros() - start, thread);
+    }
+
+    BasicTraceSpan(const BasicTraceSpan&) = delete;
+    BasicTraceSpan& operator=(const BasicTraceSpan&) = delete;
+
+  private:
+    Recorder&   owner;
+    const char* name;
+    TraceThread thread;
+    bool        nestedOnly;
+    uint32_t    countAtStart;
+    uint32_t    start;
+};
+
+// The firmware's recorder keeps the most recent TRACE_CAPACITY events
+
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY 256
+#endif
+
+using TraceRecorder = BasicTraceRecorder<StaticRing<TraceEvent, TRACE_CAPACITY>>;
+using TraceSpan     = BasicTraceSpan<TraceRecorder>;
+
+#ifndef ARDUINO
+using HostTraceRecorder = BasicTraceRecorder<UnboundedTraceBuffer>;
+using HostTraceSpan     = BasicTraceSpan<HostTraceRecorder>;
+#endif
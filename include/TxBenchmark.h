@@ -0,0 +1,85 @@
+// TxBenchmark.h - Transmit throughput of esp_now_send(), measured on the remote itself.
+//
+// Sweeps payload size, destination and queue depth. Each point sends BENCH_FRAMES frames
+// as fast as the driver takes them, with no more than 'depth' awaiting their send
+// callback. Broadcasts go to the broadcast peer; unicasts go round robin to the first
+// 1, PEER_TABLE_SLOTS or all receivers on the roster, so the last step also pays for
+// peer table swaps. Frames carry the INVALID command, which every receiver drops.
+//
+// Per point it records frames per second (first send to last callback), the send call
+// to callback latency at the 50th, 90th and 99th percentile and worst, and how many
+// frames failed, either refused by esp_now_send() or reported failed by the callback.
+// The report is JSON, one object per run, for comparing firmware versions.
+//
+// The run blocks the loop. Callbacks are matched to sends in order, which is how the
+// driver delivers them; other frames sent meanwhile, by the vehicle signal task, would
+// throw the matching off.
+
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include <atomic>
+#include "PeerManager.h"
+
+constexpr size_t   BENCH_FRAMES     = 200;
+constexpr uint32_t BENCH_TIMEOUT_US = 100 * 1000;     // For one callback, before giving up on the rest
+
+constexpr std::array<size_t, 5>   BENCH_PAYLOADS = {{ 9, 32, 64, 128, 250 }};
+constexpr std::array<uint32_t, 3> BENCH_DEPTHS   = {{ 1, 4, 16 }};
+
+class TxBenchmark
+{
+  public:
+    // 'broadcastMac' is a registered peer; 'tableSlots' is the roster's share of the table
+    TxBenchmark(const uint8_t* broadcastMac, size_t tableSlots) : broadcast(broadcastMac), slots(tableSlots)
+    {
+    }
+
+    // Runs the sweep over 'roster' and prints the report; returns the number of frames sent
+    uint32_t run(PeerManager& roster, Print& out);
+
+    // True while run() owns the send callback
+    bool isRunning() const      { return running.load(std::memory_order_acquire); }
+
+    // Called from the ESP-NOW send callback while isRunning()
+    void onSent(bool success);
+
+  private:
+    struct Point
+    {
+        size_t   payload;
+        uint32_t depth;
+        size_t   peerCount;         // 0 for broadcast
+        uint32_t sent;
+        uint32_t rejected;          // Refused by esp_now_send()
+        uint32_t failed;            // Reported failed by the callback
+        uint32_t lost;              // No callback before the timeout
+        uint32_t elapsedMicros;
+        uint32_t p50;
+        uint32_t p90;
+        uint32_t p99;
+        uint32_t worst;
+    };
+
+    Point measure(size_t payload, uint32_t depth, size_t peerCount);
+    bool  send(const uint8_t* data, size_t length, size_t peerCount, uint32_t frame);
+    bool  waitForCallbacks(uint32_t outstanding);
+    static void print(Print& out, const Point& point, bool last);
+
+    const uint8_t* broadcast;
+    size_t         slots;
+    PeerManager*   peers = nullptr;
+
+    // The k-th frame the driver accepts is sent at sendMicros[k] and completed by the k-th
+    // callback. A slot is written before esp_now_send() and only claimed once it returns
+    // ESP_OK, so a callback that beats the return still finds its time.
+    std::array<int64_t, BENCH_FRAMES>  sendMicros = {};
+    std::array<uint32_t, BENCH_FRAMES> latencies  = {};
+    std::atomic<uint32_t> accepted{0};
+    std::atomic<uint32_t> callbacks{0};
+    std::atomic<uint32_t> failures{0};
+    std::atomic<int64_t>  lastCallbackMicros{0};
+
+    std::atomic<bool> running{false};
+};
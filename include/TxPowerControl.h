@@ -0,0 +1,186 @@
+// TxPowerControl.h - Closed-loop transmit power, per link.
+//
+// The radio sends at its full 19.5 dBm unless told otherwise, which is wasted on a plate
+// a metre away. Each link (the broadcast, and each receiver the remote unicasts to) gets
+// its own level from TX_POWER_LEVELS. A link starts at full power and steps down one
+// level after TX_STEP_DOWN_AFTER deliveries in a row. That many without a loss is the
+// evidence that loss at that level is under TX_LOSS_TARGET. A failure ramps the link up
+// TX_RAMP_STEPS levels at once and raises its floor above the level that failed, so it
+// doesn't walk straight back into the loss. The floor relaxes one level after
+// TX_FLOOR_HOLD more step-down windows without a failure, to follow a receiver that has
+// moved closer.
+//
+// Unicasts learn from the MAC-layer ACK reported by the send callback. Broadcasts have
+// no ACK, so the broadcast link learns from replies: a link probe or state query that
+// hears fewer receivers than have lately been answering counts the missing ones as
+// failures. The broadcast link therefore moves far more slowly.
+//
+// All-off and channel switch frames don't adapt: they go out at full power, so the frames
+// that have to arrive aren't the ones risked on a level that has crept down to its floor.
+//
+// The radio has one transmit power, not one per frame, and esp_now_send() only queues.
+// A frame still queued when the power is changed for the next one goes out at the new
+// level. Within a fan-out to several peers a frame can therefore leave at its neighbour's
+// level; the links learn from what was set, not what was on air. A full power frame holds
+// the top level for TX_FULL_POWER_HOLD_MS, long enough for the queue to drain, so that
+// doesn't happen to one of those.
+//
+// The saving is reckoned against full power, from the current each level draws
+// (TX_POWER_MILLIAMPS, estimates shaped after the datasheet and topped out at the power
+// profile's transmit current) over the air time charged per frame.
+//
+// Nothing here touches the radio; the remote applies a link's level just before each
+// send. Plain C++, so it builds on the host as well.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "StaticPool.h"
+
+// esp_wifi_set_max_tx_power() units of 0.25 dBm: 2, 5, 8.5, 11, 13, 15, 17 and 19.5 dBm
+constexpr std::array<int8_t, 8>   TX_POWER_LEVELS    = {{ 8, 20, 34, 44, 52, 60, 68, 78 }};
+constexpr std::array<uint16_t, 8> TX_POWER_MILLIAMPS = {{ 110, 115, 125, 135, 145, 155, 165, 180 }};
+constexpr size_t                  TX_TOP_LEVEL       = TX_POWER_LEVELS.size() - 1;
+
+constexpr float    TX_LOSS_TARGET        = 0.02f;
+constexpr uint32_t TX_STEP_DOWN_AFTER    = uint32_t(1 / TX_LOSS_TARGET + 0.5f);
+constexpr uint32_t TX_RAMP_STEPS         = 2;
+constexpr uint32_t TX_FLOOR_HOLD         = 4;
+constexpr uint32_t TX_FULL_POWER_HOLD_MS = 20;
+constexpr size_t   MAX_POWER_LINKS       = 64;        // The roster's capacity
+
+constexpr float BATTERY_NOMINAL_VOLTS = 3.7f;
+
+// A unicast's fate, queued by the send callback for the loop
+struct UnicastResult
+{
+    std::array<uint8_t, 6> mac;
+    bool                   delivered;
+};
+
+class LinkPower
+{
+  public:
+    size_t level() const            { return current; }
+    float  dbm() const              { return TX_POWER_LEVELS[current] / 4.0f; }
+
+    void onDelivered(uint32_t count = 1)
+    {
+        delivered += count;
+        streak    += count;
+        for (; streak >= TX_STEP_DOWN_AFTER; streak -= TX_STEP_DOWN_AFTER)
+        {
+            if (++quietWindows >= TX_FLOOR_HOLD && floor > 0)
+            {
+                floor--;
+                quietWindows = 0;
+            }
+            if (current > floor)
+                current--;
+        }
+    }
+
+    void onFailed(uint32_t count = 1)
+    {
+        if (count == 0)
+            return;
+
+        failed += count;
+        rampUps++;
+        floor        = uint8_t(current < TX_TOP_LEVEL ? current + 1 : TX_TOP_LEVEL);
+        current      = uint8_t(current + TX_RAMP_STEPS < TX_TOP_LEVEL ? current + TX_RAMP_STEPS : TX_TOP_LEVEL);
+        streak       = 0;
+        quietWindows = 0;
+    }
+
+    uint32_t deliveredCount() const { return delivered; }
+    uint32_t failedCount() const    { return failed; }
+    uint32_t rampUpCount() const    { return rampUps; }
+
+  private:
+    uint8_t  current      = TX_TOP_LEVEL;
+    uint8_t  floor        = 0;
+    uint32_t streak       = 0;
+    uint32_t quietWindows = 0;
+    uint32_t delivered    = 0;
+    uint32_t failed       = 0;
+    uint32_t rampUps      = 0;
+};
+
+class TxPowerControl
+{
+  public:
+    struct Peer
+    {
+        std::array<uint8_t, 6> mac;
+        LinkPower              link;
+    };
+
+    // 'frameMicros' is the air time charged per frame, as in the power profile
+    explicit TxPowerControl(uint32_t frameMicros) : airtime(frameMicros)
+    {
+    }
+
+    // Off sends everything at full power; the links keep learning meanwhile
+    void setEnabled(bool on)        { enabled = on; }
+    bool isEnabled() const          { return enabled; }
+
+    LinkPower& broadcast()                      { return broadcastLink; }
+    const LinkPower& broadcast() const          { return broadcastLink; }
+
+    // The link to 'mac', added at full power the first time; when the table is full the
+    // oldest entry makes room
+    LinkPower& peer(const std::array<uint8_t, 6>& mac)
+    {
+        for (Peer& entry : peers)
+            if (entry.mac == mac)
+                return entry.link;
+
+        if (peers.full())
+            peers.erase(0);
+        peers.push_back({ mac, LinkPower() });
+        return peers[peers.size() - 1].link;
+    }
+
+    // The level to send at on 'link' at 'nowMillis', counting the frame towards the saving
+    int8_t levelFor(const LinkPower& link, uint32_t nowMillis)
+    {
+        bool   held  = fullPowerSent && nowMillis - fullPowerAt < TX_FULL_POWER_HOLD_MS;
+        size_t level = enabled && !held ? link.level() : TX_TOP_LEVEL;
+        frames++;
+        savedMilliAmpMicros += uint64_t(TX_POWER_MILLIAMPS[TX_TOP_LEVEL] - TX_POWER_MILLIAMPS[level]) * airtime;
+        return TX_POWER_LEVELS[level];
+    }
+
+    // The level for an all-off or channel switch frame sent at 'nowMillis'
+    int8_t fullPower(uint32_t nowMillis)
+    {
+        frames++;
+        fullPowerSent = true;
+        fullPowerAt   = nowMillis;
+        return TX_POWER_LEVELS[TX_TOP_LEVEL];
+    }
+
+    // A state change sent, however many frames and copies it took
+    void noteCommand()              { commands++; }
+
+    float savedMicroJoules() const  { return savedMilliAmpMicros * BATTERY_NOMINAL_VOLTS / 1000.0f; }
+    float savedPerCommand() const   { return commands ? savedMicroJoules() / commands : 0; }
+    uint32_t frameCount() const     { return frames; }
+    uint32_t commandCount() const   { return commands; }
+
+    const StaticVector<Peer, MAX_POWER_LINKS>& peerLinks() const  { return peers; }
+
+  private:
+    LinkPower broadcastLink;
+    StaticVector<Peer, MAX_POWER_LINKS> peers;
+    uint32_t airtime;
+    bool     enabled             = true;
+    bool     fullPowerSent       = false;
+    uint32_t fullPowerAt         = 0;
+    uint32_t frames              = 0;
+    uint32_t commands            = 0;
+    uint64_t savedMilliAmpMicros = 0;
+};
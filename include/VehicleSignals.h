@@ -0,0 +1,160 @@
+// VehicleSignals.h - Brake, turn and reverse inputs that override the selected effect.
+//
+// Each signal comes in through an optocoupler that pulls its GPIO low while the lamp
+// circuit is live. Its interrupt fires on both edges and wakes a high priority task,
+// which waits for the inputs to stay quiet for SIGNAL_GLITCH_MS (giving up on a
+// chattering input after SIGNAL_SETTLE_LIMIT_MS), samples them and, if the winning
+// override has changed, sends it straight away. The loop is not involved, so the time
+// from edge to frame on air doesn't depend on its poll interval; it is measured on every
+// change and must stay under SIGNAL_BUDGET_US. The measurement ends at the send callback
+// for the override's own effect frame, told apart from any other frame's by SendOrder,
+// so a repeat or an ack request already queued ahead of it can't end it early.
+//
+// The active override with the highest priority in SIGNAL_OVERRIDES wins. When the last
+// one clears, the effect the user had selected is sent again. Turn signals blink, so a
+// signal counts as active until its input has been off for its holdMillis.
+
+#pragma once
+
+#include <Arduino.h>
+#include <driver/gpio.h>
+#include <array>
+#include <atomic>
+#include "EffectManifest.h"
+#include "ESPNowProtocol.h"
+#include "HotPath.h"
+#include "Redundancy.h"
+#include "StaticPool.h"
+
+enum class VehicleSignal : uint8_t
+{
+    Brake,
+    Turn,
+    Reverse,
+    COUNT
+};
+
+constexpr std::array<const char*, size_t(VehicleSignal::COUNT)> VEHICLE_SIGNAL_NAMES =
+    {{ "brake", "turn", "reverse" }};
+
+// Where a signal is wired; GPIO_NUM_NC if it isn't
+
+struct SignalInput
+{
+    gpio_num_t pin;
+    uint32_t   holdMillis;
+};
+
+struct SignalOverride
+{
+    VehicleSignal signal;
+    PlateEffect   effect;
+    uint8_t       brightness;
+};
+
+// Highest priority first
+
+constexpr std::array<SignalOverride, size_t(VehicleSignal::COUNT)> SIGNAL_OVERRIDES =
+{{
+    { VehicleSignal::Brake,   PlateEffect::SolidRed,   255 },
+    { VehicleSignal::Reverse, PlateEffect::SolidWhite, 255 },
+    { VehicleSignal::Turn,    PlateEffect::SolidAmber, 255 },
+}};
+
+constexpr uint32_t SIGNAL_GLITCH_MS       = 2;
+constexpr uint32_t SIGNAL_SETTLE_LIMIT_MS = 5;
+constexpr uint32_t SIGNAL_BUDGET_US       = 10 * 1000;
+constexpr size_t   SIGNAL_SENT_CAPACITY   = 16;     // Frames awaiting the loop, two per change
+
+static_assert((SIGNAL_SETTLE_LIMIT_MS + SIGNAL_GLITCH_MS + 1) * 1000 < SIGNAL_BUDGET_US,
+              "The glitch filter leaves too little of the edge to air budget for sending");
+
+// True if any signal in 'inputs' is wired
+
+template <size_t N>
+constexpr bool anySignalWired(const std::array<SignalInput, N>& inputs)
+{
+    for (const SignalInput& input : inputs)
+        if (input.pin != GPIO_NUM_NC)
+            return true;
+    return false;
+}
+
+class VehicleSignals
+{
+  public:
+    using Inputs = std::array<SignalInput, size_t(VehicleSignal::COUNT)>;
+
+    // Sets up the pins and starts the task; returns true without doing anything if no
+    // signal is wired. Frames go to 'peer', numbered from 'sequences'.
+    bool begin(const Inputs& signalInputs, SequenceCounter& sequences, const uint8_t* peer);
+
+    // The effect to go back to when the overrides clear; called by the loop whenever the
+    // user selects one. The task doesn't act on any signal until the first call.
+    void setBase(uint32_t effect, uint8_t brightness);
+
+    // The receiver groups overrides are sent to, following the operator's choice
+    void setGroups(uint8_t groupMask)   { groups.store(groupMask, std::memory_order_relaxed); }
+
+    // Sends overrides as legacy frames, for receivers that predate sequences and groups
+    void setLegacyWire(bool legacy)     { legacyWire.store(legacy, std::memory_order_relaxed); }
+
+    // True while any signal is active or being held, in which case the remote must not
+    // light-sleep: a signal clearing doesn't wake it
+    bool isActive() const       { return activeMask.load(std::memory_order_relaxed) != 0; }
+
+    // True while an override rather than the user's effect is on the plates
+    bool isOverriding() const   { return winner.load(std::memory_order_relaxed) >= 0; }
+
+    // Takes the oldest frame the task has sent and the loop has yet to schedule repeats of
+    // and account for; false once there are none. If the loop falls more than
+    // SIGNAL_SENT_CAPACITY frames behind, the oldest are dropped and counted.
+    bool takeSent(Message& sent);
+
+    // Called from the ESP-NOW send callback, after SendOrder::onCallback(); completes the
+    // latency measurement once the override's frame has left
+    void HOT_PATH onFrameSent();
+
+    void report(Print& out) const;
+
+  private:
+    static void HOT_PATH onEdge(void* context);
+    void HOT_PATH restoreEdgeTriggers();
+    static void taskEntry(void* context);
+
+    void run();
+    void evaluate();
+    TickType_t nextHoldExpiry() const;
+    void send(uint32_t effect, uint8_t brightness);
+
+    Inputs           inputs = {};
+    SequenceCounter* sequenceCounter = nullptr;
+    const uint8_t*   peerAddress     = nullptr;
+    TaskHandle_t     task            = nullptr;
+
+    // Task only
+    std::array<uint32_t, size_t(VehicleSignal::COUNT)> lastSeenMillis = {};
+    uint32_t liveMask = 0;                           // Inputs low at the last sample
+
+    std::atomic<uint32_t> activeMask{0};
+    std::atomic<int32_t>  winner{-1};                // Index into SIGNAL_OVERRIDES, or -1
+    std::atomic<uint32_t> baseEffect{0};
+    std::atomic<uint8_t>  baseBrightness{0};
+    std::atomic<bool>     baseSet{false};
+    std::atomic<uint8_t>  groups{ALL_GROUPS};
+    std::atomic<bool>     legacyWire{false};
+
+    // Frames for takeSent()
+    portMUX_TYPE                                  sentLock = portMUX_INITIALIZER_UNLOCKED;
+    StaticRing<Message, SIGNAL_SENT_CAPACITY>     sentFrames;
+    std::atomic<uint32_t>                         sentDropped{0};
+
+    // Edge to air latency
+    std::atomic<int64_t>  firstEdgeMicros{0};        // Earliest edge not yet acted on
+    std::atomic<int64_t>  awaitingSince{0};          // Edge behind the frame in flight
+    std::atomic<uint32_t> awaitingTicket{0};         // SendOrder ticket of that frame
+    std::atomic<uint32_t> lastLatency{0};
+    std::atomic<uint32_t> worstLatency{0};
+    std::atomic<uint32_t> changes{0};
+    std::atomic<uint32_t> overBudget{0};
+};
@@ -0,0 +1,387 @@
+// AckSim.cpp - Time to confirm a state frame across a fleet, staggered against immediate acks.
+//
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++17 -Iinclude -Ilib/NightDriverReceiver/src -o ack_sim
+//         lib/NightDriverReceiver/examples/AckSim/AckSim.cpp
+//     ./ack_sim [trace.json]
+//
+// A remote running AckSession sends a state frame to a fleet of NightDriverReceivers and
+// asks for acks. Every broadcast is lost independently at each receiver. Replies contend
+// for the air roughly as 802.11 DCF does: each waits for the medium, DIFS and a random
+// backoff; two that start in the same backoff slot collide, and a unicast frame that
+// collides or is lost is retried by the MAC with a doubled contention window. Resends to
+// a receiver whose MAC is known are unicast and get the same retries. Each fleet runs a
+// few hundred transactions in a row, so later ones benefit from the MACs learned earlier.
+//
+// Given a file name, the first TRACE_TRANSACTIONS of the staggered 10-receiver fleet are
+// written there as a Chrome trace in simulated time: the remote's broadcasts, requests
+// and unicasts on one thread, and each receiver's replies, collisions included, on one
+// thread per receiver.
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+#include "AckSession.h"
+#include "NightDriverReceiver.h"
+#include "TraceRecorder.h"
+
+namespace
+{
+    constexpr float    LOSS          = 0.05f;
+    constexpr uint32_t TRANSACTIONS  = 300;
+    constexpr uint32_t DIFS_US       = 50;
+    constexpr uint32_t SIFS_US       = 10;
+    constexpr uint32_t MAC_ACK_US    = 304;
+    constexpr uint32_t BACKOFF_US    = 20;
+    constexpr uint32_t CW_MIN        = 15;
+    constexpr uint32_t CW_MAX        = 1023;
+    constexpr uint32_t MAC_RETRIES   = 7;
+    constexpr uint32_t MIN_LATENCY_US = 50;     // Receive callback to sendReplyAfter()
+    constexpr uint32_t MAX_LATENCY_US = 250;
+    constexpr uint32_t TICK_US       = 100;
+
+    constexpr size_t      TRACE_FLEET        = 10;
+    constexpr uint32_t    TRACE_TRANSACTIONS = 20;
+    constexpr TraceThread REMOTE_THREAD      = TraceThread::FirstSimulated;
+
+    constexpr TraceThread receiverThread(size_t device)
+    {
+        return TraceThread(uint8_t(REMOTE_THREAD) + 1 + device);
+    }
+
+    static_assert(size_t(receiverThread(TRACE_FLEET - 1)) < TRACE_THREADS, "Too many receivers to trace");
+
+    const char* const RECEIVER_NAMES[TRACE_FLEET] =
+    {
+        "receiver 0", "receiver 1", "receiver 2", "receiver 3", "receiver 4",
+        "receiver 5", "receiver 6", "receiver 7", "receiver 8", "receiver 9",
+    };
+
+    const uint8_t REMOTE_MAC[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0xFE };
+
+    struct Reply
+    {
+        uint32_t readyMicros;
+        uint8_t  device;
+        Message  message;
+    };
+
+    struct AckEvent
+    {
+        uint32_t micros;
+        uint8_t  device;
+        Message  message;
+    };
+
+    struct SimTarget
+    {
+        uint8_t              device = 0;
+        const uint32_t*      now    = nullptr;
+        std::vector<Reply>*  replies = nullptr;
+        std::mt19937*        random = nullptr;
+
+        void nextEffect()                               { }
+        void prevEffect()                               { }
+        void setEffect(uint32_t)                        { }
+        void setBrightness(uint8_t)                     { }
+        void allOff()                                   { }
+        uint32_t getEffect() const                      { return 0; }
+        uint8_t getBrightness() const                   { return 0; }
+        ReceiverTelemetry getTelemetry() const          { return {}; }
+        void setChannel(uint8_t)                        { }
+        void sendReply(const uint8_t*, const Message&)  { }
+        void sendReply(const uint8_t*, const uint8_t*, size_t) { }
+
+        void sendReplyAfter(const uint8_t*, const Message& reply, uint32_t delayMicros)
+        {
+            uint32_t latency = MIN_LATENCY_US + (*random)() % (MAX_LATENCY_US - MIN_LATENCY_US);
+            replies->push_back({*now + latency + delayMicros, device, reply});
+        }
+    };
+
+    using Receiver = NightDriverReceiver<SimTarget, 16>;
+
+    class Fleet
+    {
+      public:
+        Fleet(size_t size, uint32_t slotMicros, std::mt19937& rng) : slot(slotMicros), random(rng)
+        {
+            targets.resize(size);
+            for (size_t i = 0; i < size; i++)
+            {
+                targets[i] = {uint8_t(i), &now, &replies, &random};
+                receivers.push_back(std::make_unique<Receiver>(targets[i]));
+                receivers[i]->setAckId(uint8_t(i));
+            }
+            session.setFleet(size);
+        }
+
+        // Runs one transaction; returns false if the session gave up
+        bool transact(uint16_t sequence)
+        {
+            Message state{ESPNowCommand::SetBrightness, uint32_t(sequence & 0xFF), sequence};
+            RepeatScheduler::Frame frame = RepeatScheduler::Frame::from(state);
+            session.track(frame, sequence, now);
+            broadcast(frame.bytes.data(), frame.length);
+
+            uint32_t gaveUp = session.gaveUpCount();
+            do
+            {
+                switch (session.poll(now))
+                {
+                    case AckSession::Action::Resend:
+                        resend();
+                        [[fallthrough]];
+                    case AckSession::Action::Request:
+                        request();
+                        break;
+
+                    default:
+                        now += TICK_US;
+                        deliverAcks();
+                        break;
+                }
+            } while (session.busy());
+
+            for (auto& receiver : receivers)
+                receiver->applyPending();
+            now += 100 * 1000;
+            return session.gaveUpCount() == gaveUp;
+        }
+
+        const AckSession& stats() const     { return session; }
+        uint32_t collisionCount() const     { return collisions; }
+
+        // Records what goes on the air from here on, or stops with nullptr
+        void setTrace(HostTraceRecorder* recorder)
+        {
+            trace = recorder;
+            if (!trace)
+                return;
+            trace->nameThread(REMOTE_THREAD, "remote");
+            for (size_t i = 0; i < receivers.size() && i < TRACE_FLEET; i++)
+                trace->nameThread(receiverThread(i), RECEIVER_NAMES[i]);
+        }
+
+      private:
+        static uint32_t airtime(size_t length)
+        {
+            return frameAirtimeMicros(length);
+        }
+
+        void deliver(size_t device, const uint8_t* data, size_t length)
+        {
+            receivers[device]->onReceive(REMOTE_MAC, data, int(length));
+        }
+
+        void onAir(const char* name, TraceThread thread, uint32_t start, uint32_t duration)
+        {
+            if (trace && size_t(thread) < TRACE_THREADS)
+                trace->record(name, start, duration, thread);
+        }
+
+        void broadcast(const uint8_t* data, size_t length, const char* name = "broadcast")
+        {
+            onAir(name, REMOTE_THREAD, now + DIFS_US, airtime(length));
+            now += DIFS_US + airtime(length);
+            for (size_t i = 0; i < receivers.size(); i++)
+                if (chance(random) >= LOSS)
+                    deliver(i, data, length);
+        }
+
+        // A unicast is retried until its MAC ACK comes back
+        void unicast(size_t device, const uint8_t* data, size_t length)
+        {
+            for (uint32_t attempt = 0; attempt <= MAC_RETRIES; attempt++)
+            {
+                onAir(attempt ? "unicast retry" : "unicast", REMOTE_THREAD, now + DIFS_US, airtime(length));
+                now += DIFS_US + airtime(length) + SIFS_US + MAC_ACK_US;
+                if (chance(random) >= LOSS)
+                {
+                    deliver(device, data, length);
+                    return;
+                }
+            }
+        }
+
+        void resend()
+        {
+            uint64_t missing   = session.missing();
+            bool     broadcastNeeded = false;
+            for (uint8_t id = 0; id < receivers.size(); id++)
+            {
+                if ((missing >> id & 1) == 0)
+                    continue;
+                if (!session.macOf(id))
+                {
+                    broadcastNeeded = true;
+                    continue;
+                }
+                for (const RepeatScheduler::Frame& frame : session.pendingFrames())
+                    unicast(id, frame.bytes.data(), frame.length);
+            }
+
+            if (broadcastNeeded)
+                for (const RepeatScheduler::Frame& frame : session.pendingFrames())
+                    broadcast(frame.bytes.data(), frame.length);
+        }
+
+        void request()
+        {
+            AckRequestFrame request;
+            session.makeRequest(request, ALL_GROUPS, now, slot);
+
+            std::array<uint8_t, MAX_ACK_REQUEST_SIZE> bytes;
+            size_t length = encodeAckRequest(request, bytes);
+            broadcast(bytes.data(), length, "ack request");
+            contend();
+        }
+
+        // Plays the replies through the contention model into timestamped Acks
+        void contend()
+        {
+            struct Contender
+            {
+                Reply    reply;
+                uint32_t cw;
+                uint32_t attempts;
+                uint32_t start;
+            };
+
+            std::vector<Contender> contenders;
+            for (const Reply& reply : replies)
+                contenders.push_back({reply, CW_MIN, 0, 0});
+            replies.clear();
+
+            uint32_t mediumFree = now;
+            uint32_t airAck     = airtime(sizeof(Message));
+            while (!contenders.empty())
+            {
+                for (Contender& c : contenders)
+                    c.start = std::max(c.reply.readyMicros, mediumFree) + DIFS_US +
+                              uint32_t(random() % (c.cw + 1)) * BACKOFF_US;
+
+                uint32_t first = std::min_element(contenders.begin(), contenders.end(),
+                    [](const Contender& a, const Contender& b) { return a.start < b.start; })->start;
+
+                std::vector<size_t> transmitting;
+                for (size_t i = 0; i < contenders.size(); i++)
+                    if (contenders[i].start < first + BACKOFF_US)
+                        transmitting.push_back(i);
+
+                bool collided = transmitting.size() > 1;
+                if (collided)
+                    collisions += transmitting.size();
+                mediumFree = first + airAck + SIFS_US + (collided ? 0 : MAC_ACK_US);
+
+                for (size_t t = transmitting.size(); t-- > 0;)
+                {
+                    Contender& c = contenders[transmitting[t]];
+                    bool heard = !collided && chance(random) >= LOSS;
+                    onAir(collided ? "collision" : heard ? "ack" : "ack lost", receiverThread(c.reply.device), first, airAck);
+                    if (heard)
+                    {
+                        events.push_back({first + airAck, c.reply.device, c.reply.message});
+                        contenders.erase(contenders.begin() + long(transmitting[t]));
+                    }
+                    else if (++c.attempts > MAC_RETRIES)
+                    {
+                        contenders.erase(contenders.begin() + long(transmitting[t]));
+                    }
+                    else
+                    {
+                        c.cw = std::min(c.cw * 2 + 1, CW_MAX);
+                        c.reply.readyMicros = mediumFree;
+                    }
+                }
+            }
+        }
+
+        void deliverAcks()
+        {
+            for (size_t i = 0; i < events.size();)
+            {
+                if (int32_t(events[i].micros - now) > 0)
+                {
+                    i++;
+                    continue;
+                }
+                const AckEvent& ack = events[i];
+                uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, ack.device };
+                session.onAck(uint8_t(ack.message.getArgument()), ack.message.getSequence(), mac, ack.micros);
+                events.erase(events.begin() + long(i));
+            }
+        }
+
+        uint32_t slot;
+        uint32_t now = 0;
+        std::mt19937& random;
+        std::uniform_real_distribution<float> chance{0, 1};
+        std::vector<SimTarget> targets;
+        std::vector<std::unique_ptr<Receiver>> receivers;
+        std::vector<Reply>    replies;
+        std::vector<AckEvent> events;
+        AckSession session;
+        uint32_t   collisions = 0;
+        HostTraceRecorder* trace = nullptr;
+    };
+
+    void run(size_t devices, uint32_t slotMicros, std::mt19937& random, HostTraceRecorder* trace)
+    {
+        Fleet fleet(devices, slotMicros, random);
+        fleet.setTrace(trace);
+        std::vector<uint32_t> times;
+        uint32_t rounds = 0;
+        for (uint16_t sequence = 1; sequence <= TRANSACTIONS; sequence++)
+        {
+            if (sequence == TRACE_TRANSACTIONS + 1)
+                fleet.setTrace(nullptr);
+            if (fleet.transact(sequence))
+            {
+                times.push_back(fleet.stats().lastConfirmMicros());
+                rounds += fleet.stats().lastRoundCount();
+            }
+        }
+
+        std::sort(times.begin(), times.end());
+        auto percentile = [&](float p) { return times.empty() ? 0.0f : times[size_t(p * (times.size() - 1))] / 1000.0f; };
+        printf("  %5u  %-9s  %6.1f ms  %6.1f ms  %6.1f ms  %6.2f  %10.1f  %6.1f%%\n", unsigned(devices),
+               slotMicros ? "staggered" : "immediate", percentile(0.5f), percentile(0.9f), percentile(1.0f),
+               times.empty() ? 0.0f : float(rounds) / float(times.size()),
+               float(fleet.collisionCount()) / TRANSACTIONS, 100.0f * float(TRANSACTIONS - times.size()) / TRANSACTIONS);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::mt19937 random(1);
+    HostTraceRecorder trace;
+
+    printf("Time to full fleet confirmation, %.0f%% loss per frame, %u transactions each\n", LOSS * 100,
+           unsigned(TRANSACTIONS));
+    printf("  fleet  acks         median       p90     worst  rounds  collisions  gave up\n");
+    for (size_t devices : { 2, 10, 50 })
+    {
+        run(devices, 0, random, nullptr);
+        run(devices, ACK_SLOT_US, random, argc > 1 && devices == TRACE_FLEET ? &trace : nullptr);
+    }
+
+    if (argc > 1)
+    {
+        FILE* file = fopen(argv[1], "w");
+        if (!file)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+        TraceFile out(file);
+        trace.writeJson(out);
+        fclose(file);
+        printf("Traced %u transactions of the staggered %u-receiver fleet to %s: %u events\n",
+               unsigned(TRACE_TRANSACTIONS), unsigned(TRACE_FLEET), argv[1], unsigned(trace.bufferedCount()));
+    }
+    return 0;
+}
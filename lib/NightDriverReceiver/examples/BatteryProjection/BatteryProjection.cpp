@@ -0,0 +1,59 @@
+// BatteryProjection.cpp - The remote's battery life against how often it is pressed.
+//
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++17 -Iinclude -o battery_projection
+//         lib/NightDriverReceiver/examples/BatteryProjection/BatteryProjection.cpp
+//     ./battery_projection [frames per press] [presses/hour ...]
+//
+// The remote's EnergyModel projects the average current for evenly spaced presses, the
+// same figure `battery project` prints on the device. Each row is shown twice: with the
+// remote deep-sleeping after 10 minutes idle, and never deep-sleeping, as it does with
+// vehicle signals wired. Edit PROFILE to match currents measured on your own board.
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "EnergyModel.h"
+
+namespace
+{
+    constexpr PowerProfile  PROFILE            = DEFAULT_POWER_PROFILE;
+    constexpr PowerTimeouts WITH_DEEP_SLEEP    = { 30 * 1000, 10 * 60 * 1000, 400 };  // POWER_TIMEOUTS in main.cpp
+    constexpr PowerTimeouts WITHOUT_DEEP_SLEEP = { 30 * 1000, 0, 400 };
+    constexpr uint32_t      FRAMES_PER_PRESS   = 2;     // As `battery project` assumes
+
+    const float DEFAULT_RATES[] = { 0, 0.5f, 1, 2, 5, 10, 30, 60, 120, 600 };
+
+    float days(float milliAmps)
+    {
+        return PROFILE.batteryMilliAmpHours / milliAmps / 24;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t framesPerPress = argc > 1 ? uint32_t(strtoul(argv[1], nullptr, 10)) : FRAMES_PER_PRESS;
+
+    std::vector<float> rates;
+    for (int i = 2; i < argc; i++)
+        rates.push_back(strtof(argv[i], nullptr));
+    if (rates.empty())
+        rates.assign(std::begin(DEFAULT_RATES), std::end(DEFAULT_RATES));
+
+    printf("%.0f mAh battery, %u frames per press\n\n", PROFILE.batteryMilliAmpHours, unsigned(framesPerPress));
+    printf("%14s  %22s  %22s\n", "", "deep sleep at 10 min", "never deep sleep");
+    printf("%14s  %10s  %10s  %10s  %10s\n", "presses/hour", "mA", "days", "mA", "days");
+    for (float rate : rates)
+    {
+        if (rate < 0)
+        {
+            fprintf(stderr, "Skipping negative rate %g\n", rate);
+            continue;
+        }
+        float deep  = EnergyModel::projectAverageMilliAmps(PROFILE, WITH_DEEP_SLEEP, rate, framesPerPress);
+        float light = EnergyModel::projectAverageMilliAmps(PROFILE, WITHOUT_DEEP_SLEEP, rate, framesPerPress);
+        printf("%14.2f  %10.3f  %10.1f  %10.3f  %10.1f\n", rate, deep, days(deep), light, days(light));
+    }
+    return 0;
+}
@@ -0,0 +1,555 @@
+// DecoderFuzz.cpp - Randomized and differential testing of the frame decoders.
+//
+// Two builds. The first is a libFuzzer target, coverage guided, starting from the seed
+// corpus next to this file:
+//
+//     clang++ -O1 -g -std=c++17 -fsanitize=fuzzer,address,undefined -DDECODER_FUZZ_LIBFUZZER
+//         -Iinclude -Ilib/NightDriverReceiver/src -o decoder_libfuzzer
+//         lib/NightDriverReceiver/examples/DecoderFuzz/DecoderFuzz.cpp
+//     ./decoder_libfuzzer -max_total_time=300 corpus lib/NightDriverReceiver/examples/DecoderFuzz/corpus
+//
+// The second, without DECODER_FUZZ_LIBFUZZER, is a seeded random run that needs nothing
+// but g++ and adds the encode/decode round trips as a property test. It is what the
+// native PlatformIO env builds and runs (pio run -e native -t exec):
+//
+//     g++ -O1 -g -std=c++17 -fsanitize=address,undefined -Iinclude -Ilib/NightDriverReceiver/src
+//         -o decoder_fuzz lib/NightDriverReceiver/examples/DecoderFuzz/DecoderFuzz.cpp
+//     ./decoder_fuzz [iterations] [seed]
+//     ./decoder_fuzz --replay <file>...       Runs files, e.g. a libFuzzer crash, through the target
+//     ./decoder_fuzz --seed-corpus <dir>      Writes a valid frame of each type to <dir>
+//
+// Every frame is copied into a heap buffer of exactly its length, then:
+//
+//   - decodeMessage() is compared against an oracle written from the wire format's
+//     description, with the Message fields read through memcpy as the receiver once did;
+//     an accepted frame must re-encode to the same bytes
+//   - every decoder is run over it, and each proper prefix of a frame any decoder
+//     accepted must be rejected
+//   - valid frames of every type, with random fields, must survive encode then decode
+//   - it is fed to a NightDriverReceiver, whose target fails the run if an unknown
+//     effect, a channel outside 1 to 14 or an AllOff that wasn't sent ever reaches it
+//
+// Inputs are random lengths of random bytes, valid frames with one to three bytes
+// mutated, and valid frames with the size field, command or argument pushed out of range.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "NightDriverReceiver.h"
+
+namespace
+{
+    constexpr uint64_t DEFAULT_ITERATIONS = 200000;
+    constexpr uint32_t DEFAULT_SEED       = 1;
+    constexpr size_t   MAX_REPORTED       = 10;
+
+    uint64_t failures = 0;
+
+    void fail(const char* what, const std::vector<uint8_t>& frame)
+    {
+        if (++failures > MAX_REPORTED)
+            return;
+        printf("FAIL %s:", what);
+        for (uint8_t byte : frame)
+            printf(" %02x", byte);
+        printf("\n");
+
+#ifdef DECODER_FUZZ_LIBFUZZER
+        abort();        // libFuzzer saves the input that got here
+#endif
+    }
+
+    // The wire format as the protocol describes it, independently of decodeMessage()
+
+    struct Expected
+    {
+        DecodeResult result;
+        uint8_t      command;
+        uint32_t     argument;
+        uint16_t     sequence;
+        uint8_t      groups;
+    };
+
+    bool oracleKnows(uint8_t command)
+    {
+        static const uint8_t KNOWN[] =
+        {
+            uint8_t(ESPNowCommand::NextEffect), uint8_t(ESPNowCommand::PrevEffect), uint8_t(ESPNowCommand::SetEffect),
+            uint8_t(ESPNowCommand::SetBrightness), uint8_t(ESPNowCommand::GetManifestHash),
+            uint8_t(ESPNowCommand::ManifestHash), uint8_t(ESPNowCommand::AllOff), uint8_t(ESPNowCommand::Ack),
+            uint8_t(ESPNowCommand::GetState), uint8_t(ESPNowCommand::State), uint8_t(ESPNowCommand::GetTelemetry),
+            uint8_t(ESPNowCommand::GetProbeReport), uint8_t(ESPNowCommand::ChannelSwitch),
+        };
+        for (uint8_t known : KNOWN)
+            if (command == known)
+                return true;
+        return false;
+    }
+
+    Expected oracle(const std::vector<uint8_t>& frame)
+    {
+        Expected expected = {};
+        if (frame.size() < LEGACY_MESSAGE_SIZE)
+        {
+            expected.result = DecodeResult::TooShort;
+            return expected;
+        }
+        if (frame[0] != frame.size() || (frame.size() != sizeof(Message) && frame.size() != LEGACY_MESSAGE_SIZE))
+        {
+            expected.result = DecodeResult::SizeMismatch;
+            return expected;
+        }
+        if (frame[1] == 0xFF)
+        {
+            expected.result = DecodeResult::InvalidCommand;
+            return expected;
+        }
+        if (!oracleKnows(frame[1]))
+        {
+            expected.result = DecodeResult::UnknownCommand;
+            return expected;
+        }
+
+        // Little-endian fields at fixed offsets; memcpy reads them on a little-endian host
+        expected.result  = DecodeResult::Ok;
+        expected.command = frame[1];
+        memcpy(&expected.argument, &frame[2], sizeof(expected.argument));
+        expected.sequence = 0;
+        expected.groups   = ALL_GROUPS;
+        if (frame.size() == sizeof(Message))
+        {
+            memcpy(&expected.sequence, &frame[6], sizeof(expected.sequence));
+            expected.groups = frame[8];
+        }
+        return expected;
+    }
+
+    // A receiver that checks what reaches it
+
+    struct CheckingTarget
+    {
+        uint32_t effect         = 0;
+        uint8_t  brightness     = 0;
+        uint32_t allOffsAllowed = 0;
+        uint32_t dispatched     = 0;
+
+        void nextEffect()                       { dispatched++; }
+        void prevEffect()                       { dispatched++; }
+        void setBrightness(uint8_t value)       { brightness = value; dispatched++; }
+        uint32_t getEffect() const              { return effect; }
+        uint8_t getBrightness() const           { return brightness; }
+        ReceiverTelemetry getTelemetry() const  { return {600, 100000, 400, 1000}; }
+        void sendReply(const uint8_t*, const Message&) {}
+        void sendReply(const uint8_t*, const uint8_t*, size_t) {}
+        void sendReplyAfter(const uint8_t*, const Message&, uint32_t) {}
+
+        void setEffect(uint32_t index)
+        {
+            if (index >= uint32_t(PlateEffect::COUNT))
+                fail("receiver applied an unknown effect", {});
+            effect = index;
+            dispatched++;
+        }
+
+        void allOff()
+        {
+            if (allOffsAllowed == 0)
+                fail("receiver blanked without an AllOff", {});
+            else
+                allOffsAllowed--;
+            dispatched++;
+        }
+
+        void setChannel(uint8_t channel)
+        {
+            if (channel < 1 || channel > 14)
+                fail("receiver moved to an invalid channel", {});
+            dispatched++;
+        }
+    };
+
+    using Receiver = NightDriverReceiver<CheckingTarget, 16>;
+    using Rng      = std::mt19937;
+
+    uint32_t anyArgument(Rng& rng)
+    {
+        // Edge values half the time, so the boundaries are hit often
+        static const uint32_t EDGES[] = { 0, 1, 14, 15, uint32_t(PlateEffect::COUNT) - 1, uint32_t(PlateEffect::COUNT),
+                                          0xFF, 0x100, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF };
+        return rng() & 1 ? EDGES[rng() % (sizeof(EDGES) / sizeof(EDGES[0]))] : uint32_t(rng());
+    }
+
+    std::vector<uint8_t> validMessage(Rng& rng)
+    {
+        Message msg{ESPNowCommand(rng() % 256), anyArgument(rng), uint16_t(rng()), uint8_t(rng())};
+        auto bytes = encodeMessage(msg);
+        std::vector<uint8_t> frame(bytes.begin(), bytes.end());
+        if (rng() % 8 == 0)
+        {
+            frame.resize(LEGACY_MESSAGE_SIZE);
+            frame[0] = LEGACY_MESSAGE_SIZE;
+        }
+        return frame;
+    }
+
+    std::vector<uint8_t> validStates(Rng& rng, StatesFrame& frame)
+    {
+        frame = StatesFrame{uint16_t(rng()), uint8_t(rng())};
+        for (size_t i = rng() % (MAX_STATE_SLOTS + 1); i > 0; i--)
+            frame.set({uint8_t(rng() % 255), uint8_t(rng()), uint8_t(rng())});
+        std::array<uint8_t, MAX_STATES_FRAME_SIZE> bytes = {};
+        size_t length = encodeStates(frame, bytes);
+        return std::vector<uint8_t>(bytes.begin(), bytes.begin() + length);
+    }
+
+    std::vector<uint8_t> validAckRequest(Rng& rng, AckRequestFrame& frame)
+    {
+        frame = AckRequestFrame{uint64_t(rng()) << 32 | rng(), uint32_t(rng() % 256) * ACK_SLOT_UNIT_US, uint8_t(rng())};
+        for (size_t i = 1 + rng() % MAX_ACK_SEQUENCES; i > 0; i--)
+            frame.addSequence(uint16_t(rng()));
+        std::array<uint8_t, MAX_ACK_REQUEST_SIZE> bytes = {};
+        size_t length = encodeAckRequest(frame, bytes);
+        return std::vector<uint8_t>(bytes.begin(), bytes.begin() + length);
+    }
+
+    std::vector<uint8_t> validTelemetry(Rng& rng, uint16_t& sequence, ReceiverTelemetry& telemetry)
+    {
+        sequence  = uint16_t(rng());
+        telemetry = {uint16_t(rng()), uint32_t(rng()), int16_t(uint16_t(rng())), uint16_t(rng())};
+        auto bytes = encodeTelemetry(sequence, telemetry);
+        return std::vector<uint8_t>(bytes.begin(), bytes.end());
+    }
+
+    std::vector<uint8_t> validProbe(Rng& rng, ProbeFrame& probe)
+    {
+        uint16_t count = uint16_t(1 + rng() % MAX_PROBE_FRAMES);
+        probe = {uint16_t(rng()), uint16_t(rng() % count), count};
+        std::array<uint8_t, MAX_PROBE_FRAME_SIZE> bytes = {};
+        size_t length = encodeProbe(probe, PROBE_HEADER_SIZE + rng() % (MAX_PROBE_FRAME_SIZE - PROBE_HEADER_SIZE + 1), bytes);
+        return std::vector<uint8_t>(bytes.begin(), bytes.begin() + length);
+    }
+
+    std::vector<uint8_t> validProbeReport(Rng& rng, ProbeReport& report)
+    {
+        report = {uint16_t(rng()), uint16_t(rng() % (MAX_PROBE_FRAMES + 1)), uint16_t(rng()), uint16_t(rng()),
+                  uint16_t(rng()), uint16_t(rng()), {}};
+        for (size_t i = 0; i < report.bitmapBytes(); i++)
+            report.bitmap[i] = uint8_t(rng());
+        // Bits past the count aren't sent
+        if (report.count % 8 != 0)
+            report.bitmap[report.bitmapBytes() - 1] &= uint8_t((1u << (report.count % 8)) - 1);
+        std::array<uint8_t, MAX_PROBE_REPORT_SIZE> bytes = {};
+        size_t length = encodeProbeReport(report, bytes);
+        return std::vector<uint8_t>(bytes.begin(), bytes.begin() + length);
+    }
+
+    // Encode then decode, field by field
+
+    void checkRoundTrips(Rng& rng)
+    {
+        {
+            StatesFrame sent, received;
+            auto frame = validStates(rng, sent);
+            bool same = decodeStates(frame.data(), frame.size(), received) == DecodeResult::Ok &&
+                        received.size() == sent.size() && received.getSequence() == sent.getSequence() &&
+                        received.getGroups() == sent.getGroups();
+            for (size_t i = 0; same && i < sent.size(); i++)
+                same = received[i].slot == sent[i].slot && received[i].effect == sent[i].effect &&
+                       received[i].brightness == sent[i].brightness;
+            if (!same)
+                fail("StatesFrame round trip", frame);
+        }
+        {
+            AckRequestFrame sent, received;
+            auto frame = validAckRequest(rng, sent);
+            bool same = decodeAckRequest(frame.data(), frame.size(), received) == DecodeResult::Ok &&
+                        received.size() == sent.size() && received.getIds() == sent.getIds() &&
+                        received.getSlotMicros() == sent.getSlotMicros() && received.getGroups() == sent.getGroups();
+            for (size_t i = 0; same && i < sent.size(); i++)
+                same = received[i] == sent[i];
+            if (!same)
+                fail("AckRequestFrame round trip", frame);
+        }
+        {
+            uint16_t sentSequence = 0, receivedSequence = 0;
+            ReceiverTelemetry sent = {}, received = {};
+            auto frame = validTelemetry(rng, sentSequence, sent);
+            if (decodeTelemetry(frame.data(), frame.size(), receivedSequence, received) != DecodeResult::Ok ||
+                receivedSequence != sentSequence || received.fpsTenths != sent.fpsTenths ||
+                received.freeHeap != sent.freeHeap || received.temperatureTenths != sent.temperatureTenths ||
+                received.powerMilliwatts != sent.powerMilliwatts)
+                fail("TelemetryFrame round trip", frame);
+        }
+        {
+            ProbeFrame sent = {}, received = {};
+            auto frame = validProbe(rng, sent);
+            if (decodeProbe(frame.data(), frame.size(), received) != DecodeResult::Ok || received.stream != sent.stream ||
+                received.index != sent.index || received.count != sent.count)
+                fail("ProbeFrame round trip", frame);
+        }
+        {
+            ProbeReport sent = {}, received = {};
+            auto frame = validProbeReport(rng, sent);
+            if (decodeProbeReport(frame.data(), frame.size(), received) != DecodeResult::Ok ||
+                received.stream != sent.stream || received.count != sent.count || received.received != sent.received ||
+                received.late != sent.late || received.maxDisplacement != sent.maxDisplacement ||
+                received.duplicates != sent.duplicates || received.bitmap != sent.bitmap)
+                fail("ProbeReportFrame round trip", frame);
+        }
+    }
+
+    // Runs every decoder over 'frame'; true if any accepted it
+    bool anyDecoderAccepts(const std::vector<uint8_t>& frame)
+    {
+        Message           message;
+        StatesFrame       states;
+        AckRequestFrame   request;
+        uint16_t          sequence = 0;
+        ReceiverTelemetry telemetry = {};
+        ProbeFrame        probe = {};
+        ProbeReport       report = {};
+
+        const uint8_t* data   = frame.data();
+        size_t         length = frame.size();
+        bool accepted = false;
+        accepted |= decodeMessage(data, length, message) == DecodeResult::Ok;
+        accepted |= decodeStates(data, length, states) == DecodeResult::Ok;
+        accepted |= decodeAckRequest(data, length, request) == DecodeResult::Ok;
+        accepted |= decodeTelemetry(data, length, sequence, telemetry) == DecodeResult::Ok;
+        accepted |= decodeProbe(data, length, probe) == DecodeResult::Ok;
+        accepted |= decodeProbeReport(data, length, report) == DecodeResult::Ok;
+        return accepted;
+    }
+
+    // Every shorter copy of a valid frame is rejected by every decoder; the length byte
+    // can't match a truncated frame
+    void checkPrefixes(const std::vector<uint8_t>& frame)
+    {
+        for (size_t length = 0; length < frame.size(); length++)
+        {
+            std::vector<uint8_t> prefix(frame.begin(), frame.begin() + length);
+            if (anyDecoderAccepts(prefix))
+                fail("a decoder accepted a truncated frame", prefix);
+        }
+    }
+
+    void checkMessage(const std::vector<uint8_t>& frame)
+    {
+        Message  decoded;
+        Expected expected = oracle(frame);
+        DecodeResult result = decodeMessage(frame.data(), frame.size(), decoded);
+        if (result != expected.result)
+        {
+            fail(decodeResultName(result), frame);
+            return;
+        }
+        if (result != DecodeResult::Ok)
+            return;
+
+        if (uint8_t(decoded.getCommand()) != expected.command || decoded.getArgument() != expected.argument ||
+            decoded.getSequence() != expected.sequence || decoded.getGroups() != expected.groups)
+            fail("decoded fields differ from the oracle", frame);
+
+        auto again = encodeMessage(decoded);
+        if (frame.size() == sizeof(Message) && !std::equal(frame.begin(), frame.end(), again.begin()))
+            fail("accepted frame does not re-encode to itself", frame);
+    }
+
+    std::vector<uint8_t> randomFrame(Rng& rng)
+    {
+        // Mostly around the sizes that matter, sometimes anything up to an ESP-NOW payload
+        size_t length = rng() % 4 ? rng() % (sizeof(Message) + 4) : rng() % 251;
+        std::vector<uint8_t> frame(length);
+        for (uint8_t& byte : frame)
+            byte = uint8_t(rng());
+        if (length > 0 && rng() % 2)
+            frame[0] = uint8_t(length);
+        return frame;
+    }
+
+    std::vector<uint8_t> anyValidFrame(Rng& rng)
+    {
+        StatesFrame       states;
+        AckRequestFrame   request;
+        uint16_t          sequence = 0;
+        ReceiverTelemetry telemetry = {};
+        ProbeFrame        probe = {};
+        ProbeReport       report = {};
+
+        switch (rng() % 6)
+        {
+            case 0:  return validStates(rng, states);
+            case 1:  return validAckRequest(rng, request);
+            case 2:  return validTelemetry(rng, sequence, telemetry);
+            case 3:  return validProbe(rng, probe);
+            case 4:  return validProbeReport(rng, report);
+            default: return validMessage(rng);
+        }
+    }
+
+    // Runs one input through every check and the receiver; true if a decoder accepted it
+
+    bool checkFrame(Receiver& receiver, CheckingTarget& target, const std::vector<uint8_t>& exact)
+    {
+        const uint8_t mac[6] = { 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC };
+
+        checkMessage(exact);
+        bool accepted = anyDecoderAccepts(exact);
+        if (accepted)
+            checkPrefixes(exact);
+
+        Message message;
+        if (decodeMessage(exact.data(), exact.size(), message) == DecodeResult::Ok &&
+            message.getCommand() == ESPNowCommand::AllOff)
+            target.allOffsAllowed++;
+        receiver.onReceive(mac, exact.data(), int(exact.size()));
+        receiver.applyPending();
+        return accepted;
+    }
+
+    void mutate(Rng& rng, std::vector<uint8_t>& frame)
+    {
+        if (frame.empty())
+            return;
+        for (size_t flips = 1 + rng() % 3; flips > 0; flips--)
+        {
+            switch (rng() % 4)
+            {
+                case 0:  frame[rng() % frame.size()] ^= uint8_t(1u << (rng() % 8)); break;
+                case 1:  frame[rng() % frame.size()] = uint8_t(rng()); break;
+                case 2:  frame[0] = uint8_t(frame[0] + (rng() % 2 ? 1 : -1)); break;
+                default: if (frame.size() > 1) frame[1] = uint8_t(rng()); break;
+            }
+        }
+    }
+}
+
+// The libFuzzer entry point. The receiver lives across inputs, as it does on a plate.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static CheckingTarget target;
+    static Receiver       receiver(target);
+
+    std::vector<uint8_t> frame(data, data + size);
+    checkFrame(receiver, target, frame);
+    return 0;
+}
+
+#ifndef DECODER_FUZZ_LIBFUZZER
+
+namespace
+{
+    int replay(int count, char** paths)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            FILE* file = fopen(paths[i], "rb");
+            if (!file)
+            {
+                perror(paths[i]);
+                return 1;
+            }
+            std::vector<uint8_t> input;
+            for (int c; (c = fgetc(file)) != EOF;)
+                input.push_back(uint8_t(c));
+            fclose(file);
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+        }
+        printf("%d inputs replayed, %llu failures\n", count, (unsigned long long)failures);
+        return failures == 0 ? 0 : 1;
+    }
+
+    int writeSeedCorpus(const char* directory)
+    {
+        StatesFrame       states;
+        AckRequestFrame   request;
+        uint16_t          sequence = 0;
+        ReceiverTelemetry telemetry = {};
+        ProbeFrame        probe = {};
+        ProbeReport       report = {};
+
+        Rng rng(DEFAULT_SEED);
+        std::vector<std::pair<const char*, std::vector<uint8_t>>> seeds =
+        {
+            { "states",       validStates(rng, states) },
+            { "ack_request",  validAckRequest(rng, request) },
+            { "telemetry",    validTelemetry(rng, sequence, telemetry) },
+            { "probe",        validProbe(rng, probe) },
+            { "probe_report", validProbeReport(rng, report) },
+        };
+        for (ESPNowCommand command : { ESPNowCommand::NextEffect, ESPNowCommand::SetEffect, ESPNowCommand::SetBrightness,
+                                       ESPNowCommand::AllOff, ESPNowCommand::ChannelSwitch, ESPNowCommand::GetState })
+        {
+            auto bytes = encodeMessage(Message{command, 1, 1, ALL_GROUPS});
+            seeds.push_back({"message", std::vector<uint8_t>(bytes.begin(), bytes.end())});
+        }
+        auto legacy = seeds.back().second;
+        legacy.resize(LEGACY_MESSAGE_SIZE);
+        legacy[0] = LEGACY_MESSAGE_SIZE;
+        seeds.push_back({"legacy_message", legacy});
+
+        for (size_t i = 0; i < seeds.size(); i++)
+        {
+            std::string path = std::string(directory) + "/" + seeds[i].first + "_" + std::to_string(i);
+            FILE* file = fopen(path.c_str(), "wb");
+            if (!file || fwrite(seeds[i].second.data(), 1, seeds[i].second.size(), file) != seeds[i].second.size())
+            {
+                perror(path.c_str());
+                return 1;
+            }
+            fclose(file);
+        }
+        printf("%u seeds written to %s\n", unsigned(seeds.size()), directory);
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--replay") == 0)
+        return replay(argc - 2, argv + 2);
+    if (argc > 2 && strcmp(argv[1], "--seed-corpus") == 0)
+        return writeSeedCorpus(argv[2]);
+
+    uint64_t iterations = argc > 1 ? strtoull(argv[1], nullptr, 10) : DEFAULT_ITERATIONS;
+    uint32_t seed       = argc > 2 ? uint32_t(strtoul(argv[2], nullptr, 10)) : DEFAULT_SEED;
+    Rng rng(seed);
+
+    CheckingTarget target;
+    Receiver       receiver(target);
+    receiver.setSlot(uint8_t(rng() % MAX_STATE_SLOTS));
+    receiver.setAckId(uint8_t(rng() % MAX_ACK_IDS));
+
+    uint64_t accepted = 0;
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        std::vector<uint8_t> frame;
+        switch (i % 4)
+        {
+            case 0:  frame = randomFrame(rng); break;
+            case 1:  frame = validMessage(rng); break;
+            case 2:  frame = anyValidFrame(rng); mutate(rng, frame); break;
+            default: frame = anyValidFrame(rng); break;
+        }
+
+        // Exactly sized, so the sanitizer sees any read past the end
+        std::vector<uint8_t> exact(frame);
+        exact.shrink_to_fit();
+
+        accepted += checkFrame(receiver, target, exact);
+        if (i % 16 == 0)
+            checkRoundTrips(rng);
+    }
+
+    printf("%llu frames from seed %u: %llu accepted by some decoder, %u rejected by the receiver, %u dispatched\n",
+           (unsigned long long)iterations, unsigned(seed), (unsigned long long)accepted,
+           unsigned(receiver.rejectedCount()), unsigned(target.dispatched));
+    printf("%llu failures\n", (unsigned long long)failures);
+    return failures == 0 ? 0 : 1;
+}
+
+#endif
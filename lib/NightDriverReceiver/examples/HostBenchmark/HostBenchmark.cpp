@@ -0,0 +1,107 @@
+// HostBenchmark.cpp - Decode and dispatch cost per frame, measured on the host.
+//
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++17 -Iinclude -Ilib/NightDriverReceiver/src -o receiver_bench
+//         lib/NightDriverReceiver/examples/HostBenchmark/HostBenchmark.cpp
+//     ./receiver_bench
+//
+// Frames cycle through every command plus malformed ones, and applyPending() runs
+// every few frames as a render loop would.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "NightDriverReceiver.h"
+
+namespace
+{
+    struct CountingTarget
+    {
+        uint32_t effect     = 0;
+        uint32_t brightness = 0;
+        uint32_t replies    = 0;
+
+        void nextEffect()                           { effect++; }
+        void prevEffect()                           { effect--; }
+        void setEffect(uint32_t index)              { effect = index; }
+        void setBrightness(uint8_t value)           { brightness = value; }
+        void allOff()                               { brightness = 0; }
+        uint32_t getEffect() const                  { return effect; }
+        uint8_t getBrightness() const               { return uint8_t(brightness); }
+        ReceiverTelemetry getTelemetry() const      { return {600, 100000, 400, 1000}; }
+        void setChannel(uint8_t)                    { }
+        void sendReply(const uint8_t*, const Message&) { replies++; }
+        void sendReply(const uint8_t*, const uint8_t*, size_t) { replies++; }
+        void sendReplyAfter(const uint8_t*, const Message&, uint32_t) { replies++; }
+    };
+
+    constexpr size_t FRAMES          = 20000000;
+    constexpr size_t FRAMES_PER_DRAW = 4;
+
+    std::vector<std::array<uint8_t, sizeof(Message)>> makeFrames()
+    {
+        std::vector<std::array<uint8_t, sizeof(Message)>> frames;
+        for (uint32_t i = 0; i < 64; i++)
+        {
+            auto command = ESPNowCommand(1 + i % uint8_t(ESPNowCommand::ManifestHash));
+            frames.push_back(encodeMessage(Message{command, i}));
+        }
+
+        auto bad = encodeMessage(Message{ESPNowCommand::SetEffect, 1});
+        bad[0] = 0;
+        frames.push_back(bad);
+        bad = encodeMessage(Message{ESPNowCommand::INVALID, 0});
+        frames.push_back(bad);
+        return frames;
+    }
+
+    template <typename Function>
+    double nanosPerFrame(Function body)
+    {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / FRAMES;
+    }
+}
+
+int main()
+{
+    const auto frames = makeFrames();
+    const uint8_t mac[6] = { 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC };
+
+    CountingTarget target;
+    NightDriverReceiver<CountingTarget, 16> receiver(target);
+
+    volatile uint32_t sink = 0;
+    double decodeOnly = nanosPerFrame([&]
+    {
+        Message msg;
+        for (size_t i = 0; i < FRAMES; i++)
+        {
+            const auto& frame = frames[i % frames.size()];
+            if (decodeMessage(frame.data(), frame.size(), msg) == DecodeResult::Ok)
+                sink = sink + msg.getArgument();
+        }
+    });
+
+    double endToEnd = nanosPerFrame([&]
+    {
+        for (size_t i = 0; i < FRAMES; i++)
+        {
+            const auto& frame = frames[i % frames.size()];
+            receiver.onReceive(mac, frame.data(), int(frame.size()));
+            if (i % FRAMES_PER_DRAW == FRAMES_PER_DRAW - 1)
+                receiver.applyPending();
+        }
+        receiver.applyPending();
+    });
+
+    printf("decode only:           %6.2f ns/frame\n", decodeOnly);
+    printf("decode+queue+dispatch: %6.2f ns/frame\n", endToEnd);
+    printf("applied %u, rejected %u, dropped %u (effect %u, brightness %u, replies %u)\n",
+           unsigned(receiver.appliedCount()), unsigned(receiver.rejectedCount()), unsigned(receiver.droppedCount()),
+           unsigned(target.effect), unsigned(target.brightness), unsigned(target.replies));
+    return sink == 0xFFFFFFFF;
+}
@@ -0,0 +1,171 @@
+// Receiver.cpp - Minimal NightDriverReceiver integration on an ESP32.
+//
+// Prints the commands it would apply; in NightDriverStrip the Target methods switch
+// effects and brightness instead, and applyPending() is called from the draw loop.
+
+#include <Arduino.h>
+#include <esp_now.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <Preferences.h>
+#include <WiFi.h>
+#include "NightDriverReceiver.h"
+
+namespace
+{
+    class PrintingTarget
+    {
+      public:
+        static constexpr uint32_t EFFECT_COUNT = uint32_t(PlateEffect::COUNT);
+
+        void nextEffect()                       { setEffect((effect + 1) % EFFECT_COUNT); }
+        void prevEffect()                       { setEffect((effect + EFFECT_COUNT - 1) % EFFECT_COUNT); }
+
+        void allOff()
+        {
+            setEffect(uint32_t(PlateEffect::Off));
+            setBrightness(0);
+        }
+
+        void setEffect(uint32_t index)
+        {
+            effect = index;
+            Serial.printf("Effect %s\n", PLATE_EFFECT_NAMES[index]);
+        }
+
+        void setBrightness(uint8_t value)
+        {
+            brightness = value;
+            Serial.printf("Brightness %u\n", value);
+        }
+
+        // What GetState reports
+        uint32_t getEffect() const              { return effect; }
+        uint8_t getBrightness() const           { return brightness; }
+
+        // What GetTelemetry reports. There is no LED driver here to estimate power for;
+        // NightDriverStrip would report its power limiter's figure.
+        ReceiverTelemetry getTelemetry() const
+        {
+            return { fpsTenths, ESP.getFreeHeap(), int16_t(temperatureRead() * 10), 0 };
+        }
+
+        // Called once per drawn frame; works out the frame rate every second
+        void frameDrawn()
+        {
+            frames++;
+            uint32_t elapsed = millis() - rateStartMillis;
+            if (elapsed >= 1000)
+            {
+                fpsTenths       = uint16_t(frames * 10000 / elapsed);
+                frames          = 0;
+                rateStartMillis = millis();
+            }
+        }
+
+        // The remote moving everyone off a crowded channel. The channel is saved, so the
+        // receiver comes back on it after a power cycle; a receiver that is also joined to
+        // an access point has to stay on the AP's channel and would ignore this instead.
+        void setChannel(uint8_t channel)
+        {
+            esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+            Preferences prefs;
+            if (prefs.begin("receiver", false))
+            {
+                prefs.putUChar("channel", channel);
+                prefs.end();
+            }
+            Serial.printf("Channel %u\n", channel);
+        }
+
+        // Back to the channel saved by setChannel(), if there is one
+        void restoreChannel()
+        {
+            Preferences prefs;
+            if (!prefs.begin("receiver", true))
+                return;
+            uint8_t channel = prefs.getUChar("channel", 0);
+            prefs.end();
+            if (channel != 0)
+                esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+        }
+
+        void sendReply(const uint8_t* mac, const Message& reply)
+        {
+            sendReply(mac, reply.data(), reply.byte_size());
+        }
+
+        void sendReply(const uint8_t* mac, const uint8_t* frame, size_t length)
+        {
+            if (!esp_now_is_peer_exist(mac))
+            {
+                esp_now_peer_info_t peer = {};
+                memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+                peer.ifidx = WIFI_IF_STA;
+                esp_now_add_peer(&peer);
+            }
+            esp_now_send(mac, frame, length);
+        }
+
+        // Ack replies wait for this receiver's turn on a one-shot timer; a newer request
+        // replaces one still waiting
+        void sendReplyAfter(const uint8_t* mac, const Message& reply, uint32_t delayMicros)
+        {
+            esp_timer_stop(replyTimer);
+            memcpy(delayedMac, mac, ESP_NOW_ETH_ALEN);
+            delayedReply = reply;
+            esp_timer_start_once(replyTimer, delayMicros);
+        }
+
+        void begin()
+        {
+            esp_timer_create_args_t args = {};
+            args.callback = [](void* context)
+            {
+                auto& self = *static_cast<PrintingTarget*>(context);
+                self.sendReply(self.delayedMac, self.delayedReply);
+            };
+            args.arg  = this;
+            args.name = "ackReply";
+            esp_timer_create(&args, &replyTimer);
+        }
+
+      private:
+        uint32_t           effect     = 0;
+        uint8_t            brightness = 255;
+        uint16_t           fpsTenths  = 0;
+        uint32_t           frames     = 0;
+        uint32_t           rateStartMillis = 0;
+        esp_timer_handle_t replyTimer = nullptr;
+        uint8_t            delayedMac[ESP_NOW_ETH_ALEN] = {};
+        Message            delayedReply;
+    };
+
+    PrintingTarget target;
+    NightDriverReceiver<PrintingTarget> receiver(target);
+
+    void onReceive(const uint8_t* mac, const uint8_t* data, int length)
+    {
+        receiver.onReceive(mac, data, length);
+    }
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    WiFi.mode(WIFI_STA);
+    target.restoreChannel();
+    receiver.setSlot(0);        // This plate's entry in SetStates frames, e.g. 0 front, 1 back
+    receiver.setGroups(0x01);   // Member of group bit 0, the remote's "front"
+    receiver.setAckId(0);       // Unique in the fleet; the remote's 'acks fleet' counts from 0
+    target.begin();
+    esp_now_init();
+    esp_now_register_recv_cb(onReceive);
+}
+
+void loop()
+{
+    receiver.applyPending();    // Frame boundary
+    target.frameDrawn();
+    delay(16);
+}
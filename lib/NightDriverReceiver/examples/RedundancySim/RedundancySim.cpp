@@ -0,0 +1,197 @@
+// RedundancySim.cpp - Delivery probability against air time for each number of copies.
+//
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++17 -Iinclude -Ilib/NightDriverReceiver/src -o redundancy_sim
+//         lib/NightDriverReceiver/examples/RedundancySim/RedundancySim.cpp
+//     ./redundancy_sim [trace.json]
+//
+// State frames are scheduled with the remote's RepeatScheduler and fed through a lossy
+// channel into a NightDriverReceiver, one millisecond at a time. A frame counts as
+// delivered if the receiver applies it at least once. The channel is a Gilbert-Elliott
+// model: mostly good, with bursts of heavy loss, which is what the random gaps between
+// copies are meant to ride out. Each row also shows what the independent-loss model
+// that Adaptive mode uses predicts for the same average loss.
+//
+// Given a file name, the first TRACE_FRAMES presses of the bursty run at the adaptive
+// number of copies are also written there as a Chrome trace (open it in chrome://tracing
+// or ui.perfetto.dev): each copy on the air, the bursts, and what the receiver made of
+// each copy, on a timeline in simulated time.
+
+#include <cstdio>
+#include <random>
+#include "NightDriverReceiver.h"
+#include "Redundancy.h"
+#include "TraceRecorder.h"
+
+namespace
+{
+    struct CountingTarget
+    {
+        uint32_t applied = 0;
+
+        void nextEffect()                               { applied++; }
+        void prevEffect()                               { applied++; }
+        void setEffect(uint32_t)                        { applied++; }
+        void setBrightness(uint8_t)                     { applied++; }
+        void allOff()                                   { applied++; }
+        uint32_t getEffect() const                      { return 0; }
+        uint8_t getBrightness() const                   { return 0; }
+        ReceiverTelemetry getTelemetry() const          { return {}; }
+        void setChannel(uint8_t)                        { }
+        void sendReply(const uint8_t*, const Message&)  { }
+        void sendReply(const uint8_t*, const uint8_t*, size_t) { }
+        void sendReplyAfter(const uint8_t*, const Message&, uint32_t) { }
+    };
+
+    struct Channel
+    {
+        const char* name;
+        float goodLoss;             // Loss while the channel is good
+        float badLoss;              // Loss during a burst
+        float enterBurst;           // Per millisecond chance of a burst starting
+        float leaveBurst;           // Per millisecond chance of it ending
+
+        float averageLoss() const
+        {
+            float burstShare = enterBurst / (enterBurst + leaveBurst);
+            return goodLoss * (1 - burstShare) + badLoss * burstShare;
+        }
+    };
+
+    constexpr Channel CHANNELS[] =
+    {
+        { "independent 10% loss",        0.10f, 0.10f, 0.0f,   1.0f  },
+        { "2% loss, 20 ms bursts of 90%", 0.02f, 0.90f, 0.004f, 0.05f },
+        { "5% loss, 80 ms bursts of 95%", 0.05f, 0.95f, 0.002f, 0.0125f },
+    };
+
+    constexpr uint32_t FRAMES       = 20000;
+    constexpr uint32_t FRAME_GAP_MS = 500;      // Between presses
+    constexpr uint32_t TRACE_FRAMES = 40;
+    constexpr size_t   TRACE_CHANNEL = 1;
+
+    constexpr TraceThread REMOTE_THREAD   = TraceThread::FirstSimulated;
+    constexpr TraceThread CHANNEL_THREAD  = TraceThread(uint8_t(TraceThread::FirstSimulated) + 1);
+    constexpr TraceThread RECEIVER_THREAD = TraceThread(uint8_t(TraceThread::FirstSimulated) + 2);
+
+    struct Result
+    {
+        float delivered;
+        float duplicates;           // Per delivered frame, dropped by the receiver
+    };
+
+    // 'trace', if given, records the first TRACE_FRAMES presses
+
+    Result simulate(const Channel& channel, uint32_t copies, std::mt19937& random, HostTraceRecorder* trace = nullptr)
+    {
+        std::uniform_real_distribution<float> chance(0, 1);
+        const uint8_t mac[6] = { 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC };
+
+        CountingTarget target;
+        NightDriverReceiver<CountingTarget, 16> receiver(target);
+        RepeatScheduler repeats;
+        bool     burst = false;
+        uint32_t burstStart = 0;
+        uint32_t now   = 0;
+        uint16_t sequence = 0;
+        bool     tracing = trace != nullptr;
+
+        auto transmit = [&](const uint8_t* data, size_t length, const char* name)
+        {
+            bool heard = chance(random) >= (burst ? channel.badLoss : channel.goodLoss);
+            if (tracing)
+            {
+                uint32_t airtime = frameAirtimeMicros(length);
+                trace->record(name, now * 1000, airtime, REMOTE_THREAD);
+                trace->record(heard ? "heard" : "lost", now * 1000, airtime, RECEIVER_THREAD);
+            }
+            if (heard)
+                receiver.onReceive(mac, data, int(length));
+        };
+
+        for (uint32_t frame = 0; frame < FRAMES; frame++)
+        {
+            if (++sequence == 0)
+                sequence++;
+            Message msg{ESPNowCommand::SetBrightness, frame & 0xFF, sequence};
+            repeats.schedule(msg, copies, now, random());
+            auto bytes = encodeMessage(msg);
+            transmit(bytes.data(), bytes.size(), "press");
+
+            for (uint32_t elapsed = 0; elapsed < FRAME_GAP_MS; elapsed++, now++)
+            {
+                bool wasBurst = burst;
+                burst = chance(random) < (burst ? 1 - channel.leaveBurst : channel.enterBurst);
+                if (burst && !wasBurst)
+                    burstStart = now;
+                else if (!burst && wasBurst && tracing)
+                    trace->record("burst", burstStart * 1000, (now - burstStart) * 1000, CHANNEL_THREAD);
+
+                RepeatScheduler::Frame repeat;
+                while (repeats.due(now, random(), repeat))
+                    transmit(repeat.bytes.data(), repeat.length, "repeat");
+            }
+
+            uint32_t applied = target.applied;
+            receiver.applyPending();
+            if (tracing)
+            {
+                trace->record(target.applied != applied ? "applied" : "missed", now * 1000, 1000, RECEIVER_THREAD);
+                tracing = frame + 1 < TRACE_FRAMES;
+            }
+        }
+
+        return { float(target.applied) / FRAMES, float(receiver.duplicateCount()) / float(target.applied) };
+    }
+}
+
+// Runs the traced channel once more at the adaptive number of copies, with its own
+// generator so the table above doesn't change with tracing
+
+bool writeTrace(const char* path)
+{
+    HostTraceRecorder trace;
+    trace.nameThread(REMOTE_THREAD, "remote");
+    trace.nameThread(CHANNEL_THREAD, "channel");
+    trace.nameThread(RECEIVER_THREAD, "receiver");
+
+    const Channel& channel = CHANNELS[TRACE_CHANNEL];
+    std::mt19937 random(1);
+    simulate(channel, copiesFor(channel.averageLoss()), random, &trace);
+
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+    TraceFile out(file);
+    trace.writeJson(out);
+    fclose(file);
+    printf("Traced %u presses on \"%s\" to %s: %u events\n", unsigned(TRACE_FRAMES), channel.name, path,
+           unsigned(trace.bufferedCount()));
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::mt19937 random(1);
+
+    for (const Channel& channel : CHANNELS)
+    {
+        float loss = channel.averageLoss();
+        printf("%s (average loss %.1f%%)\n", channel.name, loss * 100);
+        printf("   K  delivered  predicted  air time  duplicates\n");
+
+        for (uint32_t copies = 1; copies <= MAX_COPIES; copies++)
+        {
+            Result result = simulate(channel, copies, random);
+            printf("  %2u  %8.3f%%  %8.3f%%  %5u us  %10.2f\n", unsigned(copies), result.delivered * 100,
+                   deliveryProbability(loss, copies) * 100, unsigned(copies * frameAirtimeMicros()),
+                   result.duplicates);
+        }
+        printf("  Adaptive mode would send %u copies\n\n", unsigned(copiesFor(loss)));
+    }
+    return argc > 1 && !writeTrace(argv[1]) ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+// SteadyStateAlloc.cpp - Fails if the host-buildable half of the loop allocates from the heap.
+//
+// Build and run from the repository root:
+//
+//     g++ -O2 -std=c++17 -Iinclude -Ilib/NightDriverReceiver/src
+//         -Wl,--wrap=malloc -Wl,--wrap=calloc -Wl,--wrap=realloc -o steady_state_alloc
+//         lib/NightDriverReceiver/examples/SteadyStateAlloc/SteadyStateAlloc.cpp
+//     ./steady_state_alloc [iterations]
+//
+// The heltec_wifi_kit_32_v2_heapwatch env halts the board if update() allocates, but only
+// on the board. update() itself needs the Arduino core; most of the work it hands off does
+// not. This program sets up the remote's repeat scheduler, ack session, reconciler,
+// telemetry store, probe session, transmit power control, energy model and trace recorder,
+// and a receiver, as setup() does. Then it arms the same link-time wrappers as HeapWatch.cpp
+// and drives them through the calls update() and the receive callbacks make, press after
+// press. Any allocation while armed fails the run. operator new is routed to malloc here,
+// as it is on the device, so C++ allocations are caught too.
+//
+// Left out, because they need the board: the OLED, NVS (StateStore, the peer roster),
+// SerialConsole, the sniffer and the FreeRTOS pieces (SendOrder, VehicleSignals).
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "AckSession.h"
+#include "EnergyModel.h"
+#include "NightDriverReceiver.h"
+#include "ProbeSession.h"
+#include "Redundancy.h"
+#include "StateReconciler.h"
+#include "TelemetryHistory.h"
+#include "TraceRecorder.h"
+#include "TxPowerControl.h"
+
+extern "C"
+{
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t count, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+}
+
+namespace
+{
+    // Written by the wrappers, which must not allocate or print
+    volatile bool armed       = false;
+    uint32_t      allocations = 0;
+    size_t        firstSize   = 0;
+    void*         firstCaller = nullptr;
+
+    void record(void* caller, size_t size)
+    {
+        if (!armed)
+            return;
+        if (allocations++ == 0)
+        {
+            firstSize   = size;
+            firstCaller = caller;
+        }
+    }
+}
+
+extern "C"
+{
+    void* __wrap_malloc(size_t size)
+    {
+        record(__builtin_return_address(0), size);
+        return __real_malloc(size);
+    }
+
+    void* __wrap_calloc(size_t count, size_t size)
+    {
+        record(__builtin_return_address(0), count * size);
+        return __real_calloc(count, size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size)
+    {
+        record(__builtin_return_address(0), size);
+        return __real_realloc(ptr, size);
+    }
+}
+
+void* operator new(size_t size)
+{
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)                   { return operator new(size); }
+void  operator delete(void* ptr) noexcept           { free(ptr); }
+void  operator delete[](void* ptr) noexcept         { free(ptr); }
+void  operator delete(void* ptr, size_t) noexcept   { free(ptr); }
+void  operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+
+namespace
+{
+    constexpr uint32_t ITERATIONS     = 100000;
+    constexpr uint32_t LOOP_MICROS    = 10 * 1000;
+    constexpr uint32_t PRESS_EVERY    = 25;     // Iterations between presses
+    constexpr size_t   FLEET          = 8;
+    constexpr uint32_t FRAME_MICROS   = 600;
+
+    struct QuietTarget
+    {
+        uint32_t effect     = 0;
+        uint8_t  brightness = 0;
+        uint32_t replies    = 0;
+
+        void nextEffect()                           { effect++; }
+        void prevEffect()                           { effect--; }
+        void setEffect(uint32_t index)              { effect = index; }
+        void setBrightness(uint8_t value)           { brightness = value; }
+        void allOff()                               { brightness = 0; }
+        uint32_t getEffect() const                  { return effect; }
+        uint8_t getBrightness() const               { return brightness; }
+        ReceiverTelemetry getTelemetry() const      { return {600, 100000, 400, 1000}; }
+        void setChannel(uint8_t)                    { }
+        void sendReply(const uint8_t*, const Message&) { replies++; }
+        void sendReply(const uint8_t*, const uint8_t*, size_t) { replies++; }
+        void sendReplyAfter(const uint8_t*, const Message&, uint32_t) { replies++; }
+    };
+
+    std::array<uint8_t, 6> macOf(size_t device)
+    {
+        return {{ 0x24, 0x6F, 0x28, 0x00, 0x00, uint8_t(device) }};
+    }
+
+    // Everything setup() would have created; static, as the firmware's members are
+    struct Remote
+    {
+        SequenceCounter  sequences;
+        LinkEstimator    link;
+        RepeatScheduler  repeats;
+        AckSession       acks;
+        StateReconciler  reconciler;
+        TelemetryStore   telemetry;
+        ProbeSession     probe;
+        TxPowerControl   txPower{FRAME_MICROS};
+        EnergyModel      energy{DEFAULT_POWER_PROFILE};
+        TraceRecorder    tracer;
+        uint32_t         sent = 0;
+    };
+
+    QuietTarget                                   target;
+    NightDriverReceiver<QuietTarget, 16>          receiver(target);
+    Remote                                        remote;
+
+    void deliver(const uint8_t* data, size_t length)
+    {
+        const auto mac = macOf(FLEET);
+        receiver.onReceive(mac.data(), data, int(length));
+        remote.sent++;
+    }
+
+    // One pass through what update() and the receive callbacks do around a press
+    void iterate(uint32_t i, uint32_t& random)
+    {
+        uint32_t now    = i * LOOP_MICROS;
+        uint32_t millis = now / 1000;
+        random = random * 1664525 + 1013904223;
+
+        TraceSpan span(remote.tracer, "update", TraceThread::Loop, true);
+
+        if (i % PRESS_EVERY == 0)
+        {
+            // setEffect()/setBrightness() through sendRedundant(), legacy and current layouts
+            Message effect{ESPNowCommand::SetEffect, i / PRESS_EVERY % 7, remote.sequences.take()};
+            Message brightness{ESPNowCommand::SetBrightness, i & 0xFF, remote.sequences.take()};
+            for (const Message& msg : { effect, brightness })
+            {
+                TraceSpan send(remote.tracer, "send");
+                remote.repeats.schedule(msg, copiesFor(remote.link.loss()), millis, random);
+                remote.acks.track(RepeatScheduler::Frame::from(msg), msg.getSequence(), now);
+                auto bytes = encodeMessage(msg);
+                deliver(bytes.data(), bytes.size());
+                auto legacy = encodeLegacyMessage(msg);
+                deliver(legacy.data(), legacy.size());
+                remote.txPower.levelFor(remote.txPower.broadcast(), millis);
+                remote.energy.addTransmit();
+            }
+
+            // A states frame, as the 'states' command sends
+            StatesFrame states{remote.sequences.take()};
+            for (uint8_t slot = 0; slot < MAX_STATE_SLOTS; slot++)
+                states.set({slot, uint8_t(slot + i), uint8_t(i)});
+            std::array<uint8_t, MAX_STATES_FRAME_SIZE> statesBytes;
+            deliver(statesBytes.data(), encodeStates(states, statesBytes));
+
+            // The state query that follows and the fleet's replies
+            remote.reconciler.beginQuery(remote.sequences.take(), uint8_t(effect.getArgument()),
+                                         uint8_t(brightness.getArgument()), true);
+            for (size_t device = 0; device < FLEET; device++)
+                remote.reconciler.onReply({macOf(device), uint8_t(effect.getArgument() + (device == 3)),
+                                           uint8_t(brightness.getArgument()), effect.getSequence()});
+            remote.reconciler.closeQuery();
+        }
+
+        // serviceRepeats()
+        RepeatScheduler::Frame frame;
+        while (remote.repeats.due(millis, random, frame))
+            deliver(frame.bytes.data(), frame.length);
+
+        // serviceAcks(), with every receiver confirming
+        AckSession::Action action = remote.acks.poll(now);
+        if (action != AckSession::Action::None)
+        {
+            AckRequestFrame request;
+            remote.acks.makeRequest(request, ALL_GROUPS, now);
+            std::array<uint8_t, MAX_ACK_REQUEST_SIZE> bytes;
+            deliver(bytes.data(), encodeAckRequest(request, bytes));
+            for (uint32_t id = 0; id < FLEET; id++)
+                for (const RepeatScheduler::Frame& pending : remote.acks.pendingFrames())
+                    remote.acks.onAck(id, uint16_t(pending.bytes[6] | pending.bytes[7] << 8), macOf(id).data(), now);
+        }
+
+        // Unicast results feeding the per-link power
+        LinkPower& peer = remote.txPower.peer(macOf(i % FLEET));
+        if (random % 16 == 0)
+            peer.onFailed();
+        else
+            peer.onDelivered();
+        remote.txPower.levelFor(peer, millis);
+
+        // checkTelemetry(), checkProbe() and checkLinkProbe() on a slower cadence
+        if (i % 100 == 0)
+        {
+            for (size_t device = 0; device < FLEET; device++)
+            {
+                ReceiverTelemetry readings{uint16_t(600 + device), uint32_t(100000 - i % 1000), int16_t(400 + i % 7),
+                                           uint16_t(1000 + random % 50)};
+                remote.telemetry.record(macOf(device), {millis / 1000, readings});
+            }
+            remote.telemetry.pollFinished();
+
+            remote.probe.begin(uint16_t(i), 64);
+            ProbeReport report{uint16_t(i), 64, 60, 1, 2, 0, {}};
+            for (size_t device = 0; device < FLEET; device++)
+                remote.probe.onReport(macOf(device), report);
+            remote.link.addProbe(uint32_t(FLEET - random % 2));
+
+            Message query{ESPNowCommand::GetTelemetry, 0, remote.sequences.take()};
+            auto bytes = encodeMessage(query);
+            deliver(bytes.data(), bytes.size());
+        }
+
+        receiver.applyPending();
+
+        // The power scheduler's transitions
+        if (i % 1000 == 0)
+            remote.energy.transition(i % 2000 ? PowerState::DisplayOff : PowerState::DisplayOn, now);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t iterations = argc > 1 ? uint32_t(strtoul(argv[1], nullptr, 10)) : ITERATIONS;
+
+    // setup(): ids and groups for the receiver, the fleet expected to ack, and stdout's
+    // buffer, which is allocated on first use
+    receiver.setSlot(0);
+    receiver.setAckId(0);
+    remote.acks.setFleet(FLEET);
+    printf("Driving %u iterations with the heap armed\n", unsigned(iterations));
+    fflush(stdout);
+
+    uint32_t random = 1;
+    armed = true;
+    for (uint32_t i = 0; i < iterations; i++)
+        iterate(i, random);
+    armed = false;
+
+    printf("%u frames through the receiver, %u applied, %u acks confirmed, %u trace events\n",
+           unsigned(remote.sent), unsigned(receiver.appliedCount()), unsigned(remote.acks.confirmedCount()),
+           unsigned(remote.tracer.recordedCount()));
+    if (allocations == 0)
+    {
+        printf("No heap allocations in the steady state\n");
+        return 0;
+    }
+
+    printf("FAIL: %u heap allocations in the steady state, the first of %u bytes from %p\n",
+           unsigned(allocations), unsigned(firstSize), firstCaller);
+    return 1;
+}
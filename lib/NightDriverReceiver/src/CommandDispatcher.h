@@ -0,0 +1,137 @@
+// CommandDispatcher.h - Jump table from ESPNowCommand to receiver handlers.
+//
+// The table has an entry for every possible command byte, built at compile time, so
+// dispatch is a single indexed call with no switch and no bounds check. Commands the
+// receiver does not act on, replies meant for the remote among them, land on ignore().
+// A SetStates entry is queued as a SetStates Message carrying this receiver's effect and
+// brightness in a packState() argument, so both are applied at the same frame boundary.
+// GetState is answered from the queue as well, so the reply reflects every change queued
+// ahead of it. So is GetTelemetry, from the render thread whose frame rate it reports.
+// ChannelSwitch reaches setChannel() only for a channel from 1 to 14.
+//
+// Target is the receiver application and must provide:
+//
+//     void nextEffect();
+//     void prevEffect();
+//     void setEffect(uint32_t index);
+//     void setBrightness(uint8_t brightness);
+//     void allOff();
+//     uint32_t getEffect() const;          // Wire index of the effect showing
+//     uint8_t getBrightness() const;
+//     ReceiverTelemetry getTelemetry() const;
+//     void setChannel(uint8_t channel);
+//     void sendReply(const uint8_t* mac, const Message& reply);
+//     void sendReply(const uint8_t* mac, const uint8_t* frame, size_t length);
+//     void sendReplyAfter(const uint8_t* mac, const Message& reply, uint32_t delayMicros);
+//
+// sendReplyAfter() is called from onReceive(), so it must not block; arm a timer instead.
+// The probe report goes out through sendReply() from onReceive() as well.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include "ESPNowProtocol.h"
+#include "EffectManifest.h"
+
+struct ReceivedFrame
+{
+    Message                 message;
+    std::array<uint8_t, 6>  sender;
+};
+
+template <typename Target>
+class CommandDispatcher
+{
+  public:
+    using Handler = void (*)(Target& target, const ReceivedFrame& frame);
+
+    static void dispatch(Target& target, const ReceivedFrame& frame)
+    {
+        TABLE[uint8_t(frame.message.getCommand())](target, frame);
+    }
+
+  private:
+    static void ignore(Target&, const ReceivedFrame&)
+    {
+    }
+
+    static void nextEffect(Target& target, const ReceivedFrame&)
+    {
+        target.nextEffect();
+    }
+
+    static void prevEffect(Target& target, const ReceivedFrame&)
+    {
+        target.prevEffect();
+    }
+
+    static void setEffect(Target& target, const ReceivedFrame& frame)
+    {
+        if (frame.message.getArgument() < uint32_t(PlateEffect::COUNT))
+            target.setEffect(frame.message.getArgument());
+    }
+
+    static void setBrightness(Target& target, const ReceivedFrame& frame)
+    {
+        target.setBrightness(uint8_t(frame.message.getArgument() > 255 ? 255 : frame.message.getArgument()));
+    }
+
+    static void setState(Target& target, const ReceivedFrame& frame)
+    {
+        uint32_t effect = stateEffect(frame.message.getArgument());
+        if (effect < uint32_t(PlateEffect::COUNT))
+            target.setEffect(effect);
+        target.setBrightness(stateBrightness(frame.message.getArgument()));
+    }
+
+    static void allOff(Target& target, const ReceivedFrame&)
+    {
+        target.allOff();
+    }
+
+    static void getManifestHash(Target& target, const ReceivedFrame& frame)
+    {
+        target.sendReply(frame.sender.data(), Message{ESPNowCommand::ManifestHash, MANIFEST_HASH});
+    }
+
+    static void getState(Target& target, const ReceivedFrame& frame)
+    {
+        target.sendReply(frame.sender.data(), Message{ESPNowCommand::State,
+                         packState(target.getEffect(), target.getBrightness()), frame.message.getSequence()});
+    }
+
+    static void getTelemetry(Target& target, const ReceivedFrame& frame)
+    {
+        auto bytes = encodeTelemetry(frame.message.getSequence(), target.getTelemetry());
+        target.sendReply(frame.sender.data(), bytes.data(), bytes.size());
+    }
+
+    static void setChannel(Target& target, const ReceivedFrame& frame)
+    {
+        uint32_t channel = frame.message.getArgument();
+        if (channel >= 1 && channel <= 14)
+            target.setChannel(uint8_t(channel));
+    }
+
+    static constexpr std::array<Handler, 256> makeTable()
+    {
+        std::array<Handler, 256> table = {};
+        for (auto& entry : table)
+            entry = ignore;
+
+        table[uint8_t(ESPNowCommand::NextEffect)]      = nextEffect;
+        table[uint8_t(ESPNowCommand::PrevEffect)]      = prevEffect;
+        table[uint8_t(ESPNowCommand::SetEffect)]       = setEffect;
+        table[uint8_t(ESPNowCommand::SetBrightness)]   = setBrightness;
+        table[uint8_t(ESPNowCommand::GetManifestHash)] = getManifestHash;
+        table[uint8_t(ESPNowCommand::GetState)]        = getState;
+        table[uint8_t(ESPNowCommand::GetTelemetry)]    = getTelemetry;
+        table[uint8_t(ESPNowCommand::AllOff)]          = allOff;
+        table[uint8_t(ESPNowCommand::SetStates)]       = setState;
+        table[uint8_t(ESPNowCommand::ChannelSwitch)]   = setChannel;
+        return table;
+    }
+
+    static constexpr std::array<Handler, 256> TABLE = makeTable();
+};
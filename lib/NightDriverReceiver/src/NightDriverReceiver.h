@@ -0,0 +1,274 @@
+// NightDriverReceiver.h - Receiver-side handling of NightDriverRemote commands.
+//
+// Call onReceive() from the ESP-NOW receive callback. It validates and decodes the frame
+// and queues it without blocking or allocating. Call applyPending() from the render
+// thread between frames; it dispatches everything queued since the last call, so effect
+// changes never land halfway through drawing a frame.
+//
+// Remotes send each state frame more than once; SequenceFilter drops the extra copies
+// before they are queued.
+//
+// Frames addressed to groups this receiver is not a member of (see setGroups()) are
+// dropped on arrival.
+//
+// A SetStates frame carries states for several receivers. Only the entry for the slot
+// given to setSlot() is queued; a receiver without a slot ignores SetStates.
+//
+// An AckRequest is answered straight from onReceive(), since its reply has to go out in
+// this receiver's turn: the Ack is handed to the Target's sendReplyAfter() with the delay
+// the request gives for the id set with setAckId(). Only a receiver that has heard every
+// frame the request lists replies, so silence tells the remote what to send again.
+//
+// Probe frames, the remote's loss test, are recorded by a ProbeRecorder as they arrive,
+// and a GetProbeReport for the stream is answered from onReceive() too, through the
+// Target's sendReply(), since the recorder belongs to the receive callback.
+//
+// AllOff skips the queue. Remotes send it as a burst of repeats, so only the first frame
+// of each burst id counts; it can't be dropped when the queue is full, and frames queued
+// before it are discarded instead of being applied after it, relighting the plates.
+//
+// The wire format and effect manifest come from ESPNowProtocol.h, EffectManifest.h and
+// Effects.def in the NightDriverRemote include/ directory; copy them alongside this
+// library when building it into NightDriverStrip. See CommandDispatcher.h for what the
+// Target class must provide.
+
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include "CommandDispatcher.h"
+#include "ProbeRecorder.h"
+#include "SequenceFilter.h"
+#include "SpscQueue.h"
+
+template <typename Target, size_t QueueDepth = 16>
+class NightDriverReceiver
+{
+  public:
+    explicit NightDriverReceiver(Target& receiverTarget) : target(receiverTarget)
+    {
+    }
+
+    // Producer side, called from the ESP-NOW receive callback
+
+    DecodeResult onReceive(const uint8_t* mac, const uint8_t* data, int length)
+    {
+        if (length >= 0 && isStatesFrame(data, size_t(length)))
+            return onStates(mac, data, size_t(length));
+
+        if (length >= 0 && isAckRequest(data, size_t(length)))
+            return onAckRequest(mac, data, size_t(length));
+
+        if (length >= 0 && isProbeFrame(data, size_t(length)))
+            return onProbe(data, size_t(length));
+
+        ReceivedFrame frame;
+        DecodeResult result = length < 0 ? DecodeResult::TooShort
+                                         : decodeMessage(data, size_t(length), frame.message);
+        if (result != DecodeResult::Ok)
+        {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        if (!isAddressedTo(frame.message.getGroups(), groups))
+        {
+            ignored.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        if (sequences.isDuplicate(mac, frame.message.getSequence()))
+        {
+            duplicates.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        if (frame.message.getCommand() == ESPNowCommand::GetProbeReport)
+        {
+            sendProbeReport(mac, uint16_t(frame.message.getArgument()));
+            return result;
+        }
+
+        if (frame.message.getCommand() == ESPNowCommand::AllOff)
+        {
+            if (frame.message.getArgument() != lastAllOffBurst)
+            {
+                lastAllOffBurst = frame.message.getArgument();
+                allOffAfter.store(pushed, std::memory_order_relaxed);
+                allOffPending.store(true, std::memory_order_release);
+            }
+            return result;
+        }
+
+        enqueue(mac, frame);
+        return result;
+    }
+
+    // Assigns this receiver's slot in SetStates frames; NO_SLOT opts out of them. Set it
+    // before the receive callback is registered.
+    void setSlot(uint8_t receiverSlot)  { slot = receiverSlot; }
+    uint8_t getSlot() const             { return slot; }
+
+    static constexpr uint8_t NO_SLOT = UNASSIGNED_SLOT;
+
+    // Assigns this receiver's id in AckRequest frames, below MAX_ACK_IDS and unique in the
+    // fleet; NO_ACK_ID, the default, never replies
+    void setAckId(uint8_t id)           { ackId = id; }
+    uint8_t getAckId() const            { return ackId; }
+
+    static constexpr uint8_t NO_ACK_ID = 0xFF;
+
+    // Sets the groups this receiver belongs to, one bit each; it belongs to all of them
+    // until this is called
+    void setGroups(uint8_t groupMask)   { groups = groupMask; }
+    uint8_t getGroups() const           { return groups; }
+
+    // Consumer side, called from the render thread at a frame boundary; returns the
+    // number of commands applied
+
+    size_t applyPending()
+    {
+        ReceivedFrame frame;
+        size_t count = 0;
+
+        if (allOffPending.exchange(false, std::memory_order_acquire))
+        {
+            // Throw away everything that arrived before the AllOff
+            uint32_t cutoff = allOffAfter.load(std::memory_order_relaxed);
+            while (int32_t(cutoff - popped) > 0 && queue.pop(frame))
+                popped++;
+
+            target.allOff();
+            count++;
+        }
+
+        while (queue.pop(frame))
+        {
+            popped++;
+            CommandDispatcher<Target>::dispatch(target, frame);
+            count++;
+        }
+        applied += count;
+        return count;
+    }
+
+    uint32_t appliedCount() const   { return applied; }
+    uint32_t rejectedCount() const  { return rejected.load(std::memory_order_relaxed); }
+    uint32_t droppedCount() const   { return dropped.load(std::memory_order_relaxed); }
+    uint32_t duplicateCount() const { return duplicates.load(std::memory_order_relaxed); }
+    uint32_t ignoredCount() const   { return ignored.load(std::memory_order_relaxed); }
+    uint32_t ackCount() const       { return acks.load(std::memory_order_relaxed); }
+
+  private:
+    DecodeResult onStates(const uint8_t* mac, const uint8_t* data, size_t length)
+    {
+        StatesFrame states;
+        DecodeResult result = decodeStates(data, length, states);
+        if (result != DecodeResult::Ok)
+        {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        if (!isAddressedTo(states.getGroups(), groups))
+        {
+            ignored.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        if (sequences.isDuplicate(mac, states.getSequence()))
+        {
+            duplicates.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        const TargetState* state = slot == NO_SLOT ? nullptr : states.find(slot);
+        if (state)
+        {
+            ReceivedFrame frame;
+            frame.message = Message{ESPNowCommand::SetStates, packState(state->effect, state->brightness),
+                                    states.getSequence()};
+            enqueue(mac, frame);
+        }
+        return result;
+    }
+
+    DecodeResult onAckRequest(const uint8_t* mac, const uint8_t* data, size_t length)
+    {
+        AckRequestFrame request;
+        DecodeResult result = decodeAckRequest(data, length, request);
+        if (result != DecodeResult::Ok)
+        {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        if (!isAddressedTo(request.getGroups(), groups) || !request.requests(ackId))
+        {
+            ignored.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        for (size_t i = 0; i < request.size(); i++)
+            if (!sequences.contains(mac, request[i]))
+                return result;
+
+        target.sendReplyAfter(mac, Message{ESPNowCommand::Ack, ackId, request[0]}, request.replyDelayMicros(ackId));
+        acks.fetch_add(1, std::memory_order_relaxed);
+        return result;
+    }
+
+    DecodeResult onProbe(const uint8_t* data, size_t length)
+    {
+        ProbeFrame probe;
+        DecodeResult result = decodeProbe(data, length, probe);
+        if (result != DecodeResult::Ok)
+        {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        probes.onProbe(probe);
+        return result;
+    }
+
+    void sendProbeReport(const uint8_t* mac, uint16_t stream)
+    {
+        ProbeReport report;
+        if (!probes.reportFor(stream, report))
+            return;
+
+        std::array<uint8_t, MAX_PROBE_REPORT_SIZE> bytes;
+        size_t length = encodeProbeReport(report, bytes);
+        target.sendReply(mac, bytes.data(), length);
+    }
+
+    void enqueue(const uint8_t* mac, ReceivedFrame& frame)
+    {
+        memcpy(frame.sender.data(), mac, frame.sender.size());
+        if (queue.push(frame))
+            pushed++;
+        else
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Target& target;
+    uint8_t slot   = NO_SLOT;
+    uint8_t groups = ALL_GROUPS;
+    uint8_t ackId  = NO_ACK_ID;
+    SpscQueue<ReceivedFrame, QueueDepth> queue;
+    SequenceFilter<> sequences;                 // Producer only
+    ProbeRecorder    probes;                    // Producer only
+    uint32_t applied = 0;
+
+    uint32_t pushed          = 0;     // Producer only
+    uint32_t popped          = 0;     // Consumer only
+    uint32_t lastAllOffBurst = 0;     // Producer only
+    std::atomic<uint32_t> allOffAfter{0};
+    std::atomic<bool>     allOffPending{false};
+    std::atomic<uint32_t> rejected{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> duplicates{0};
+    std::atomic<uint32_t> ignored{0};
+    std::atomic<uint32_t> acks{0};
+};
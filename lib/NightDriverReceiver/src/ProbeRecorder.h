@@ -0,0 +1,56 @@
+// ProbeRecorder.h - What this receiver heard of the remote's probe streams.
+//
+// The remote measures loss with a numbered stream of Probe frames. Each index heard is
+// marked in a bitmap; a frame arriving after one with a higher index counts as late,
+// and one heard twice as a duplicate. The first frame of another stream starts over, so
+// only the latest stream is kept. Only the receive callback touches it.
+
+#pragma once
+
+#include <cstdint>
+#include "ESPNowProtocol.h"
+
+class ProbeRecorder
+{
+  public:
+    void onProbe(const ProbeFrame& probe)
+    {
+        if (report.received == 0 || probe.stream != report.stream || probe.count != report.count)
+        {
+            report  = { probe.stream, probe.count, 0, 0, 0, 0, {} };
+            highest = probe.index;
+        }
+
+        if (report.heard(probe.index))
+        {
+            report.duplicates += report.duplicates != UINT16_MAX;
+            return;
+        }
+
+        report.bitmap[probe.index / 8] |= uint8_t(1 << probe.index % 8);
+        report.received++;
+        if (probe.index < highest)
+        {
+            uint16_t displacement = uint16_t(highest - probe.index);
+            report.late++;
+            report.maxDisplacement = displacement > report.maxDisplacement ? displacement : report.maxDisplacement;
+        }
+        else
+        {
+            highest = probe.index;
+        }
+    }
+
+    // What was heard of 'stream'; false if none of it was
+    bool reportFor(uint16_t stream, ProbeReport& out) const
+    {
+        if (report.received == 0 || report.stream != stream)
+            return false;
+        out = report;
+        return true;
+    }
+
+  private:
+    ProbeReport report  = {};
+    uint16_t    highest = 0;
+};
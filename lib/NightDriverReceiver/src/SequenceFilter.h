@@ -0,0 +1,75 @@
+// SequenceFilter.h - Drops the redundant copies of a frame by sequence number.
+//
+// Remotes send each state frame several times because broadcasts get no ACK, and all the
+// copies carry the same sequence number. The filter remembers the last few sequence
+// numbers heard from each of a handful of senders. It compares them for equality only,
+// never for order, so a remote that reboots and starts counting somewhere else is never
+// mistaken for replaying old frames. Copies of one frame arrive within tens of
+// milliseconds of each other, well inside the remembered window.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+template <size_t Senders = 4, size_t Depth = 8>
+class SequenceFilter
+{
+  public:
+    // Returns true if this sender's 'sequence' has been seen recently; otherwise remembers
+    // it. Zero is unsequenced and never a duplicate.
+    bool isDuplicate(const uint8_t* mac, uint16_t sequence)
+    {
+        if (sequence == 0)
+            return false;
+
+        History& history = find(mac);
+        if (std::find(history.recent.begin(), history.recent.end(), sequence) != history.recent.end())
+            return true;
+
+        history.recent[history.next] = sequence;
+        history.next = (history.next + 1) % Depth;
+        return false;
+    }
+
+    // True if this sender's 'sequence' has been seen recently; remembers nothing
+    bool contains(const uint8_t* mac, uint16_t sequence) const
+    {
+        for (const History& history : senders)
+            if (history.used && memcmp(history.mac.data(), mac, history.mac.size()) == 0)
+                return sequence != 0 &&
+                       std::find(history.recent.begin(), history.recent.end(), sequence) != history.recent.end();
+        return false;
+    }
+
+  private:
+    struct History
+    {
+        std::array<uint8_t, 6>      mac    = {};
+        std::array<uint16_t, Depth> recent = {};   // Zero marks an empty slot
+        size_t                      next   = 0;
+        bool                        used   = false;
+    };
+
+    // The sender's history, taking over the least recently claimed slot for a new sender
+    History& find(const uint8_t* mac)
+    {
+        for (History& history : senders)
+            if (history.used && memcmp(history.mac.data(), mac, history.mac.size()) == 0)
+                return history;
+
+        History& history = senders[nextSlot];
+        nextSlot = (nextSlot + 1) % Senders;
+
+        history = History{};
+        memcpy(history.mac.data(), mac, history.mac.size());
+        history.used = true;
+        return history;
+    }
+
+    std::array<History, Senders> senders = {};
+    size_t nextSlot = 0;
+};
@@ -0,0 +1,57 @@
+// SpscQueue.h - Lock-free single-producer, single-consumer ring.
+//
+// The producer is the ESP-NOW receive callback on the WiFi task and the consumer is the
+// render thread, so neither side may block the other. Head and tail are free-running
+// counters; N must be a power of two so that they can wrap without a special case.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+  public:
+    // Producer side; returns false if the queue is full
+    bool push(const T& value)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N)
+            return false;
+
+        items[h & (N - 1)] = value;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side; returns false if the queue is empty
+    bool pop(T& value)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+
+        value = items[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+
+    static constexpr size_t capacity() { return N; }
+
+  private:
+    std::array<T, N> items = {};
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+};
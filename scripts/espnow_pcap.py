@@ -0,0 +1,217 @@
+# espnow_pcap.py - Turns the remote's sniffer stream into a .pcap file and a readable log.
+#
+# The 'sniff' console command streams captured ESP-NOW frames over serial (see
+# include/Sniffer.h). This script reads that stream from the serial port, or from a file
+# it was saved to, writes the frames to a pcap file Wireshark opens directly, and prints
+# one line per frame with the NightDriver fields decoded:
+#
+#     python scripts/espnow_pcap.py /dev/ttyUSB0 --start -o capture.pcap
+#     python scripts/espnow_pcap.py saved_stream.bin -o capture.pcap
+#
+# With --start it sends 'sniff start' at the console rate, follows the port to the
+# capture rate and sends 'sniff stop' on Ctrl-C. Console text between records is passed
+# through to stderr. Reading from a port needs pyserial.
+
+import argparse
+import struct
+import sys
+import time
+
+SYNC          = b"NDSR"
+PCAP_MAGIC    = 0xA1B2C3D4
+CONSOLE_BAUD  = 115200
+SNIFFER_BAUD  = 921600
+RADIOTAP_SIZE = 13
+
+# ESPNowCommand in include/ESPNowProtocol.h, in order from 1
+COMMANDS = [
+    "NextEffect", "PrevEffect", "SetEffect", "SetBrightness", "GetManifestHash", "ManifestHash", "AllOff",
+    "SetStates", "AckRequest", "Ack", "GetState", "State", "GetTelemetry", "Telemetry", "Probe",
+    "GetProbeReport", "ProbeReport", "ChannelSwitch",
+]
+
+MESSAGE_SIZE        = 9
+LEGACY_MESSAGE_SIZE = 6
+
+# The body of an ESP-NOW frame starts after the 24 byte header, category, OUI, random
+# bytes and the vendor element's id, length, OUI, type and version
+ELEMENT_OFFSET = 32
+BODY_OFFSET    = ELEMENT_OFFSET + 7
+
+
+def command_name(value):
+    if value == 255:
+        return "INVALID"
+    if 1 <= value <= len(COMMANDS):
+        return COMMANDS[value - 1]
+    return "unknown(%d)" % value
+
+
+def u16(data, offset):
+    return struct.unpack_from("<H", data, offset)[0]
+
+
+def decode_body(body):
+    """Describes a NightDriver frame in one line."""
+
+    if len(body) < 2:
+        return "%d byte body" % len(body)
+
+    name = command_name(body[1])
+    if body[0] == len(body) and len(body) in (MESSAGE_SIZE, LEGACY_MESSAGE_SIZE) and name in COMMANDS:
+        argument = struct.unpack_from("<I", body, 2)[0]
+        if len(body) == LEGACY_MESSAGE_SIZE:
+            return "%s arg=%d (legacy)" % (name, argument)
+        sequence, groups = u16(body, 6), body[8]
+        return "%s arg=%d seq=%d groups=%02x" % (name, argument, sequence, groups)
+
+    if name == "SetStates" and len(body) >= 6:
+        entries = ["%d:%d@%d" % tuple(body[6 + i * 3:9 + i * 3]) for i in range(min(body[5], (len(body) - 6) // 3))]
+        return "SetStates seq=%d groups=%02x %s" % (u16(body, 2), body[4], " ".join(entries))
+    if name == "AckRequest" and len(body) >= 5:
+        count    = body[4]
+        sequence = [u16(body, 5 + i * 2) for i in range(count) if 7 + i * 2 <= len(body)]
+        return "AckRequest groups=%02x slot=%dus seqs=%s" % (body[2], body[3] * 100, sequence)
+    if name == "Telemetry" and len(body) >= 14:
+        fps, heap, temp, power = struct.unpack_from("<HIhH", body, 4)
+        return "Telemetry seq=%d fps=%.1f heap=%d temp=%.1fC power=%dmW" % (u16(body, 2), fps / 10, heap, temp / 10, power)
+    if name == "Probe" and len(body) >= 8:
+        return "Probe stream=%04x index=%d of %d (%d bytes)" % (u16(body, 2), u16(body, 4), u16(body, 6), len(body))
+    if name == "ProbeReport" and len(body) >= 14:
+        stream, count, received, late, back, duplicates = struct.unpack_from("<6H", body, 2)
+        return "ProbeReport stream=%04x %d/%d received, %d late (max %d), %d duplicates" % (
+            stream, received, count, late, back, duplicates)
+    return "%s, %d bytes" % (name, len(body))
+
+
+def describe(seconds, micros, data):
+    frame = data[RADIOTAP_SIZE:]
+    channel_mhz = u16(data, 8)
+    rssi        = struct.unpack_from("<b", data, 12)[0]
+    mac         = lambda raw: ":".join("%02x" % b for b in raw)
+    if len(frame) < BODY_OFFSET:
+        return "%d.%06d short frame" % (seconds, micros)
+
+    body = frame[BODY_OFFSET:ELEMENT_OFFSET + 2 + frame[ELEMENT_OFFSET + 1]]
+    return "%d.%06d %d MHz %4d dBm %s -> %s  %s" % (seconds, micros, channel_mhz, rssi, mac(frame[10:16]),
+                                                    mac(frame[4:10]), decode_body(body))
+
+
+class StreamParser:
+    """Picks the file header and records out of the serial byte stream."""
+
+    def __init__(self, pcap, text):
+        self.buffer  = bytearray()
+        self.pcap    = pcap
+        self.text    = text
+        self.snaplen = None
+        self.frames  = 0
+
+    def feed(self, data):
+        self.buffer += data
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                # Keep a tail that might be the start of a sync word
+                keep = len(SYNC) - 1
+                self.passthrough(self.buffer[:-keep] if len(self.buffer) > keep else b"")
+                del self.buffer[:max(0, len(self.buffer) - keep)]
+                return
+            self.passthrough(self.buffer[:start])
+            del self.buffer[:start]
+            if not self.take():
+                return
+
+    def take(self):
+        """Consumes one header or record at the front; False if more bytes are needed."""
+
+        at = len(SYNC)
+        if len(self.buffer) < at + 16:
+            return False
+
+        if struct.unpack_from("<I", self.buffer, at)[0] == PCAP_MAGIC:
+            if len(self.buffer) < at + 24:
+                return False
+            header = bytes(self.buffer[at:at + 24])
+            self.snaplen = struct.unpack_from("<I", header, 16)[0]
+            if self.pcap and self.pcap.tell() == 0:
+                self.pcap.write(header)
+            del self.buffer[:at + 24]
+            return True
+
+        seconds, micros, included, original = struct.unpack_from("<4I", self.buffer, at)
+        if (self.snaplen is None or included < RADIOTAP_SIZE or included > self.snaplen or original < included or
+                micros >= 1000000):
+            # Not a record after all; skip the sync word's first byte and look again
+            self.passthrough(self.buffer[:1])
+            del self.buffer[:1]
+            return True
+
+        if len(self.buffer) < at + 16 + included:
+            return False
+
+        record = bytes(self.buffer[at:at + 16 + included])
+        del self.buffer[:at + 16 + included]
+        if self.pcap:
+            self.pcap.write(record)
+            self.pcap.flush()
+        print(describe(seconds, micros, record[16:]))
+        self.frames += 1
+        return True
+
+    def passthrough(self, data):
+        if data and self.text:
+            self.text.write(data.decode("utf-8", "replace"))
+            self.text.flush()
+
+
+def read_port(args, parser):
+    import serial
+
+    port = serial.Serial(args.input, CONSOLE_BAUD if args.start else args.baud, timeout=0.1)
+    if args.start:
+        port.write(b"\nsniff start\n")
+        port.flush()
+        time.sleep(0.2)
+        parser.feed(port.read(port.in_waiting or 1))
+        port.baudrate = SNIFFER_BAUD
+    try:
+        while True:
+            parser.feed(port.read(4096))
+    except KeyboardInterrupt:
+        if args.start:
+            port.write(b"\nsniff stop\n")
+            port.flush()
+            deadline = time.time() + 1
+            while time.time() < deadline:
+                parser.feed(port.read(4096))
+            port.baudrate = CONSOLE_BAUD
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument("input", help="serial port, or a file the stream was saved to ('-' for stdin)")
+    ap.add_argument("-o", "--output", help="pcap file to write")
+    ap.add_argument("--start", action="store_true", help="send 'sniff start' first and 'sniff stop' on Ctrl-C")
+    ap.add_argument("--baud", type=int, default=SNIFFER_BAUD, help="port rate without --start")
+    args = ap.parse_args()
+
+    pcap   = open(args.output, "wb") if args.output else None
+    parser = StreamParser(pcap, sys.stderr)
+
+    if args.input == "-":
+        parser.feed(sys.stdin.buffer.read())
+    elif args.input.startswith("/dev/") or args.input.upper().startswith("COM"):
+        read_port(args, parser)
+    else:
+        with open(args.input, "rb") as stream:
+            parser.feed(stream.read())
+
+    if pcap:
+        pcap.close()
+    print("%d frames" % parser.frames, file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
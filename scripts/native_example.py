@@ -0,0 +1,26 @@
+# native_example.py - Builds one of the receiver library's host examples in a native env.
+#
+# As a PlatformIO extra script in a 'platform = native' env:
+#
+#     pio run -e native -t exec
+#
+# custom_native_example names the example under lib/NightDriverReceiver/examples to build;
+# the firmware in src/ is left out with build_src_filter. -fsanitize flags in build_flags
+# are passed to the linker as well, and custom_native_compiler = clang switches to clang,
+# which -fsanitize=fuzzer needs.
+
+import os
+
+Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+
+example = env.GetProjectOption("custom_native_example")
+env.Append(CPPPATH=[os.path.join("$PROJECT_DIR", "include"),
+                    os.path.join("$PROJECT_DIR", "lib", "NightDriverReceiver", "src")])
+env.BuildSources(os.path.join("$BUILD_DIR", "example"),
+                 os.path.join("$PROJECT_DIR", "lib", "NightDriverReceiver", "examples", example))
+
+sanitizers = [flag for flag in env.get("CCFLAGS", []) if isinstance(flag, str) and flag.startswith("-fsanitize")]
+env.Append(LINKFLAGS=sanitizers)
+
+if env.GetProjectOption("custom_native_compiler", "") == "clang":
+    env.Replace(CC="clang", CXX="clang++", LINK="clang++")
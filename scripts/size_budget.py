@@ -0,0 +1,232 @@
+# size_budget.py - Flash/IRAM/DRAM attribution and budget check from the linker map.
+#
+# As a PlatformIO extra script this adds a "sizebudget" target:
+#
+#     pio run -e heltec_wifi_kit_32_v2 -t sizebudget
+#
+# It links the firmware with a map file, attributes every input section to the project
+# (per source file), Bounce2, Heltec, the Arduino core, ESP-IDF or the toolchain, writes
+# the result to size_report.json in the build directory and fails if any budget set with
+# custom_budget_* in platformio.ini is exceeded. The JSON is sorted and stable, so reports
+# from two commits can be diffed directly.
+#
+# It can also be run by hand on an existing map: python scripts/size_budget.py firmware.map
+
+import json
+import os
+import re
+import sys
+from collections import defaultdict
+
+# Output sections by the memory they occupy. Flash counts what is stored in the image,
+# which includes the initial copies of IRAM code and DRAM data.
+
+REGIONS = {
+    ".iram0.vectors":   ("iram", "flash"),
+    ".iram0.text":      ("iram", "flash"),
+    ".dram0.data":      ("dram", "flash"),
+    ".dram0.bss":       ("dram",),
+    ".noinit":          ("dram",),
+    ".flash.text":      ("flash",),
+    ".flash.rodata":    ("flash",),
+    ".flash.appdesc":   ("flash",),
+    ".rtc.text":        ("rtc", "flash"),
+    ".rtc.data":        ("rtc", "flash"),
+    ".rtc.bss":         ("rtc",),
+    ".rtc_noinit":      ("rtc",),
+}
+
+REGION_NAMES = ("flash", "iram", "dram", "rtc")
+
+BUDGET_KEYS = [(scope, region) for scope in ("total", "project") for region in REGION_NAMES]
+
+OUTPUT_SECTION = re.compile(r"^(\.\S+)(?:\s+0x[0-9a-fA-F]+\s+0x[0-9a-fA-F]+.*)?$")
+INPUT_SECTION  = re.compile(r"^ (\.\S+|\*fill\*|COMMON)?\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s*(.*)$")
+NAME_ONLY      = re.compile(r"^ (\.\S+|COMMON)\s*$")
+
+
+def component_of(path, project_libs):
+    """Returns (component, project module or None) for an input file from the map."""
+
+    p = path.replace("\\", "/")
+    if not p:
+        return "padding", None
+
+    # Objects built by PlatformIO live under .pio/build/<env>/, and the env name itself
+    # mentions the board, so match on what follows it
+
+    built = re.match(r"^.*?\.pio/build/[^/]+/(.*)$", p)
+    if built:
+        p = built.group(1)
+        if p.startswith("src/"):
+            return "project", re.sub(r"\.o$", "", p)
+
+    for lib in project_libs:
+        if "/" + lib + "/" in p or "lib" + lib + ".a" in p:
+            return "project", "lib/" + lib
+
+    if "Bounce2" in p:
+        return "Bounce2", None
+    if "Heltec" in p:
+        return "Heltec", None
+    if "FrameworkArduino" in p or "/cores/esp32/" in p or "/libraries/" in p:
+        return "arduino", None
+    if "/sdk/" in p or "esp-idf" in p or "/ld/" in p:
+        return "esp-idf", None
+    if "toolchain" in p or re.search(r"lib(gcc|stdc\+\+|c|m|g)\.a", p):
+        return "toolchain", None
+    return "other", None
+
+
+def parse_map(map_path, project_libs=()):
+    """Sums input section sizes from a GNU ld map by region, component and module."""
+
+    usage = {region: defaultdict(int) for region in REGION_NAMES}
+    modules = defaultdict(lambda: defaultdict(int))
+
+    with open(map_path, errors="replace") as f:
+        lines = iter(f.read().splitlines())
+
+    for line in lines:
+        if line.startswith("Linker script and memory map"):
+            break
+
+    regions = ()
+    pending = None
+    for line in lines:
+        if line.startswith("OUTPUT("):
+            break
+
+        match = OUTPUT_SECTION.match(line)
+        if match and not line.startswith(" "):
+            regions = REGIONS.get(match.group(1), ())
+            pending = None
+            continue
+
+        if not regions:
+            continue
+
+        match = NAME_ONLY.match(line)
+        if match:
+            pending = match.group(1)
+            continue
+
+        match = INPUT_SECTION.match(line)
+        if not match:
+            continue
+
+        name = match.group(1) or pending
+        pending = None
+        if name is None:
+            continue
+
+        size = int(match.group(2), 16)
+        if size == 0:
+            continue
+
+        component, module = component_of(match.group(3).strip(), project_libs)
+        for region in regions:
+            usage[region][component] += size
+            if module:
+                modules[module][region] += size
+
+    return usage, modules
+
+
+def build_report(usage, modules, budgets, env_name):
+    totals = {region: sum(usage[region].values()) for region in REGION_NAMES}
+    project = {region: usage[region].get("project", 0) for region in REGION_NAMES}
+
+    over = []
+    for (scope, region), limit in sorted(budgets.items()):
+        used = (totals if scope == "total" else project)[region]
+        if used > limit:
+            over.append({"budget": scope + "_" + region, "limit": limit, "used": used})
+
+    return {
+        "env": env_name,
+        "regions": {
+            region: {"total": totals[region], "by_component": dict(sorted(usage[region].items()))}
+            for region in REGION_NAMES
+        },
+        "project_modules": {
+            module: {region: sizes.get(region, 0) for region in REGION_NAMES}
+            for module, sizes in sorted(modules.items())
+        },
+        "budgets": {scope + "_" + region: limit for (scope, region), limit in sorted(budgets.items())},
+        "over_budget": over,
+    }
+
+
+def print_report(report):
+    print("Size budget for %s" % report["env"])
+    for region in REGION_NAMES:
+        data = report["regions"][region]
+        print("  %-5s %8d bytes" % (region, data["total"]))
+        for component, size in sorted(data["by_component"].items(), key=lambda item: -item[1]):
+            print("        %-10s %8d" % (component, size))
+
+    print("  Project modules (flash / iram / dram):")
+    for module, sizes in report["project_modules"].items():
+        print("        %-28s %7d %7d %7d" % (module, sizes["flash"], sizes["iram"], sizes["dram"]))
+
+    for entry in report["over_budget"]:
+        print("  OVER BUDGET: %s uses %d bytes, budget is %d" % (entry["budget"], entry["used"], entry["limit"]))
+
+
+def write_report(report, path):
+    with open(path, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+
+def project_libraries(project_dir):
+    lib_dir = os.path.join(project_dir, "lib")
+    if not os.path.isdir(lib_dir):
+        return ()
+    return tuple(name for name in os.listdir(lib_dir) if os.path.isdir(os.path.join(lib_dir, name)))
+
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO/SCons
+except NameError:
+    env = None
+
+if env is not None:
+    map_path = os.path.join(env.subst("$BUILD_DIR"), "firmware.map")
+    env.Append(LINKFLAGS=["-Wl,-Map," + map_path])
+
+    def size_budget(target, source, env):
+        budgets = {}
+        for scope, region in BUDGET_KEYS:
+            value = env.GetProjectOption("custom_budget_%s_%s" % (scope, region), "")
+            if value:
+                budgets[(scope, region)] = int(value, 0)
+
+        usage, modules = parse_map(map_path, project_libraries(env.subst("$PROJECT_DIR")))
+        report = build_report(usage, modules, budgets, env.subst("$PIOENV"))
+        report_path = os.path.join(env.subst("$BUILD_DIR"), "size_report.json")
+        write_report(report, report_path)
+        print_report(report)
+        print("Report written to " + report_path)
+
+        if report["over_budget"]:
+            env.Exit(1)
+
+    env.AddCustomTarget(
+        name="sizebudget",
+        dependencies="$BUILD_DIR/${PROGNAME}.elf",
+        actions=size_budget,
+        title="Size Budget",
+        description="Attribute flash/IRAM/DRAM use by module and check budgets",
+    )
+
+elif __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit("usage: size_budget.py <firmware.map> [report.json]")
+
+    usage, modules = parse_map(sys.argv[1], project_libraries(os.getcwd()))
+    report = build_report(usage, modules, {}, os.path.basename(os.path.dirname(os.path.abspath(sys.argv[1]))))
+    print_report(report)
+    if len(sys.argv) > 2:
+        write_report(report, sys.argv[2])
@@ -0,0 +1,138 @@
+// ChannelSurvey.cpp - The sweep, airtime accounting and ranking for ChannelSurvey.h
+
+#include "ChannelSurvey.h"
+#include "PrintFormat.h"
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+ChannelSurvey* ChannelSurvey::active = nullptr;
+
+bool ChannelSurvey::run()
+{
+    uint8_t            home      = 1;
+    wifi_second_chan_t secondary = WIFI_SECOND_CHAN_NONE;
+    wifi_country_t     country   = {};
+    esp_wifi_get_channel(&home, &secondary);
+    if (esp_wifi_get_country(&country) != ESP_OK || country.nchan == 0)
+    {
+        country.schan = 1;
+        country.nchan = 13;
+    }
+
+    active = this;
+    wifi_promiscuous_filter_t filter = {};
+    filter.filter_mask = WIFI_PROMIS_FILTER_MASK_ALL;
+    if (esp_wifi_set_promiscuous_filter(&filter) != ESP_OK || esp_wifi_set_promiscuous_rx_cb(onPacket) != ESP_OK ||
+        esp_wifi_set_promiscuous(true) != ESP_OK)
+    {
+        active = nullptr;
+        return false;
+    }
+
+    // Kept in ranking order as it fills, by insertion; the table is too small to bother
+    // sorting afterwards
+    table.clear();
+    for (uint8_t number = country.schan; number < country.schan + country.nchan && number <= MAX_WIFI_CHANNEL; number++)
+    {
+        Channel channel = listen(number);
+        table.push_back(channel);
+        for (size_t i = table.size() - 1; i > 0; i--)
+        {
+            const Channel& before = table[i - 1];
+            if (before.busyPermille < channel.busyPermille ||
+                (before.busyPermille == channel.busyPermille && before.frames <= channel.frames))
+                break;
+            std::swap(table[i - 1], table[i]);
+        }
+    }
+
+    esp_wifi_set_promiscuous(false);
+    esp_wifi_set_promiscuous_rx_cb(nullptr);
+    active = nullptr;
+    esp_wifi_set_channel(home, secondary);
+    return true;
+}
+
+ChannelSurvey::Channel ChannelSurvey::listen(uint8_t number)
+{
+    esp_task_wdt_reset();
+    esp_wifi_set_channel(number, WIFI_SECOND_CHAN_NONE);
+
+    frames.store(0, std::memory_order_relaxed);
+    airtime.store(0, std::memory_order_relaxed);
+    noiseSum.store(0, std::memory_order_relaxed);
+    strongest.store(INT8_MIN, std::memory_order_relaxed);
+
+    int64_t start = esp_timer_get_time();
+    delay(SURVEY_DWELL_MS);
+    uint32_t elapsed = uint32_t(esp_timer_get_time() - start);
+
+    Channel channel = {};
+    channel.number        = number;
+    channel.frames        = frames.load(std::memory_order_relaxed);
+    channel.airtimeMicros = airtime.load(std::memory_order_relaxed);
+    channel.busyPermille  = uint16_t(std::min<uint64_t>(uint64_t(channel.airtimeMicros) * 1000 / elapsed, 1000));
+    if (channel.frames != 0)
+    {
+        channel.strongestRssi = int8_t(strongest.load(std::memory_order_relaxed));
+        channel.noiseFloor    = int8_t(noiseSum.load(std::memory_order_relaxed) / int32_t(channel.frames));
+    }
+    return channel;
+}
+
+void HOT_PATH ChannelSurvey::onPacket(void* buffer, wifi_promiscuous_pkt_type_t)
+{
+    if (active)
+        active->count(static_cast<const wifi_promiscuous_pkt_t*>(buffer)->rx_ctrl);
+}
+
+void HOT_PATH ChannelSurvey::count(const wifi_pkt_rx_ctrl_t& rx)
+{
+    frames.fetch_add(1, std::memory_order_relaxed);
+    airtime.fetch_add(frameAirtimeMicros(rx.sig_mode, rx.rate, rx.mcs, rx.cwb, rx.sgi, rx.sig_len),
+                      std::memory_order_relaxed);
+    noiseSum.fetch_add(rx.noise_floor, std::memory_order_relaxed);
+
+    int32_t rssi = rx.rssi;
+    int32_t seen = strongest.load(std::memory_order_relaxed);
+    while (rssi > seen && !strongest.compare_exchange_weak(seen, rssi, std::memory_order_relaxed))
+    {
+    }
+}
+
+const ChannelSurvey::Channel* ChannelSurvey::find(uint8_t number) const
+{
+    for (const Channel& channel : table)
+        if (channel.number == number)
+            return &channel;
+    return nullptr;
+}
+
+uint8_t ChannelSurvey::recommend(uint8_t current, uint16_t marginPermille) const
+{
+    const Channel* here = find(current);
+    if (table.empty() || !here || table[0].number == current)
+        return current;
+
+    return here->busyPermille >= table[0].busyPermille + marginPermille ? table[0].number : current;
+}
+
+void ChannelSurvey::report(Print& out, uint8_t current) const
+{
+    if (table.empty())
+    {
+        out.println(F("No survey yet; 'channel survey' runs one"));
+        return;
+    }
+
+    printFormat(out, "Channels by airtime, %u ms each:\n", unsigned(SURVEY_DWELL_MS));
+    for (const Channel& channel : table)
+    {
+        printFormat(out, "  %2u%s %5.1f%% busy, %4u frames", unsigned(channel.number), channel.number == current ? "*" : " ",
+                    channel.busyPermille / 10.0f, unsigned(channel.frames));
+        if (channel.frames != 0)
+            printFormat(out, ", strongest %d dBm, noise %d dBm", channel.strongestRssi, channel.noiseFloor);
+        out.println();
+    }
+}
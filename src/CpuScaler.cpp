@@ -0,0 +1,151 @@
+// CpuScaler.cpp - Power management setup, boosting and reporting for CpuScaler.h
+
+#include "CpuScaler.h"
+#include "PrintFormat.h"
+#include <esp_timer.h>
+
+bool CpuScaler::begin()
+{
+    esp_pm_config_esp32_t config = {};
+    config.max_freq_mhz       = CPU_MAX_MHZ;
+    config.min_freq_mhz       = CPU_IDLE_MHZ;
+    config.light_sleep_enable = false;      // PowerScheduler decides when to sleep
+    usePmLock = esp_pm_configure(&config) == ESP_OK &&
+                esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "boost", &lock) == ESP_OK;
+
+    if (!usePmLock && !setCpuFrequencyMhz(CPU_IDLE_MHZ))
+        return false;
+
+    lastPollMicros = esp_timer_get_time();
+    return true;
+}
+
+void CpuScaler::setEnabled(bool on)
+{
+    enabled = on;
+    if (!on)
+        raise();
+}
+
+void HOT_PATH CpuScaler::boostFromIsr()
+{
+    // With a lock the clock is raised here and now; without one, by the loop's next poll()
+    if (usePmLock)
+    {
+        bool wasBoosted = boosted.exchange(true, std::memory_order_relaxed);
+        pressFoundLow.store(!wasBoosted, std::memory_order_relaxed);
+        if (!wasBoosted)
+        {
+            esp_pm_lock_acquire(lock);
+            boosts.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    else
+    {
+        pressFoundLow.store(!boosted.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    boostPending.store(true, std::memory_order_release);
+}
+
+void CpuScaler::boost()
+{
+    boostedAtMillis = millis();
+    raise();
+}
+
+void CpuScaler::raise()
+{
+    if (usePmLock)
+    {
+        if (!boosted.exchange(true))
+        {
+            esp_pm_lock_acquire(lock);
+            boosts++;
+        }
+        return;
+    }
+
+    if (!boosted.load() && setCpuFrequencyMhz(CPU_MAX_MHZ))
+    {
+        boosted.store(true);
+        boosts++;
+    }
+}
+
+void CpuScaler::lower()
+{
+    if (usePmLock)
+    {
+        if (boosted.exchange(false))
+            esp_pm_lock_release(lock);
+        return;
+    }
+
+    if (boosted.load() && setCpuFrequencyMhz(CPU_IDLE_MHZ))
+        boosted.store(false);
+}
+
+void CpuScaler::poll(bool busy, uint64_t lightSleptMicros)
+{
+    // An ISR's press starts the hold from when the loop first sees it
+    if (boostPending.exchange(false, std::memory_order_acquire))
+        boost();
+
+    int64_t  now     = esp_timer_get_time();
+    uint64_t elapsed = uint64_t(now - lastPollMicros);
+    uint64_t slept   = lightSleptMicros - lastLightSleptMicros;
+    lastPollMicros       = now;
+    lastLightSleptMicros = lightSleptMicros;
+    if (boosted.load())
+        highClockMicros += elapsed;
+    else
+        lowClockAwakeMicros += elapsed > slept ? elapsed - slept : 0;
+
+    if (!boosted.load())
+        return;
+
+    if (busy)
+        boostedAtMillis = millis();
+    else if (enabled && millis() - boostedAtMillis >= CPU_BOOST_HOLD_MS)
+        lower();
+}
+
+void CpuScaler::onPressSent(uint32_t latencyMicros)
+{
+    Latency& latency = pressFoundLow.load(std::memory_order_relaxed) ? lowStart : highStart;
+    latency.presses++;
+    latency.totalMicros += latencyMicros;
+    latency.worstMicros  = latencyMicros > latency.worstMicros ? latencyMicros : latency.worstMicros;
+}
+
+void CpuScaler::printLatency(Print& out, const char* name, const Latency& latency)
+{
+    if (latency.presses == 0)
+    {
+        printFormat(out, "  %s: no presses\n", name);
+        return;
+    }
+    printFormat(out, "  %s: %u presses, mean %u us, worst %u us\n", name, unsigned(latency.presses),
+                unsigned(latency.totalMicros / latency.presses), unsigned(latency.worstMicros));
+}
+
+void CpuScaler::report(Print& out) const
+{
+    printFormat(out, "CPU %u MHz; scaling %s via %s, %u/%u MHz, held %u ms after input; %u boosts\n",
+                unsigned(getCpuFrequencyMhz()), enabled ? "on" : "off",
+                usePmLock ? "a PM lock" : "setCpuFrequencyMhz()", unsigned(CPU_IDLE_MHZ), unsigned(CPU_MAX_MHZ),
+                unsigned(CPU_BOOST_HOLD_MS), unsigned(boosts.load()));
+
+    out.println(F("Press to first frame:"));
+    printLatency(out, "found at low clock", lowStart);
+    printLatency(out, "found at full clock", highStart);
+    if (lowStart.presses != 0 && highStart.presses != 0)
+        printFormat(out, "  added by scaling: %d us on average\n",
+                    int(int64_t(lowStart.totalMicros / lowStart.presses) - int64_t(highStart.totalMicros / highStart.presses)));
+
+    float awakeSeconds = (lowClockAwakeMicros + highClockMicros) / 1e6f;
+    float savedMah     = CPU_IDLE_SAVING_MILLIAMPS * (lowClockAwakeMicros / 3.6e9f);
+    printFormat(out, "Awake %.0f s, %.0f%% of it at low clock; saved %.2f mAh, %.1f mA on average while awake\n",
+                awakeSeconds, awakeSeconds > 0 ? lowClockAwakeMicros / 1e4f / awakeSeconds : 0.0f, savedMah,
+                awakeSeconds > 0 ? savedMah * 3600 / awakeSeconds : 0.0f);
+}
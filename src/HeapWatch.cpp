@@ -0,0 +1,153 @@
+// HeapWatch.cpp - Link-time malloc wrappers backing HeapWatch.h
+//
+// The linker redirects every call to malloc() to __wrap_malloc() (and likewise for
+// calloc and realloc) when the -Wl,--wrap flags from platformio.ini are present. The
+// wrappers must not allocate themselves, so the log is a fixed ring guarded by a
+// spinlock, since the WiFi task on the other core allocates too.
+
+#ifdef HEAP_WATCH
+
+#include "HeapWatch.h"
+#include "PrintFormat.h"
+#include "StaticPool.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+extern "C"
+{
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t count, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+}
+
+namespace
+{
+    constexpr size_t MAX_RECORDS = 32;
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    StaticRing<AllocationRecord, MAX_RECORDS> records;
+
+    volatile bool armed    = false;
+    volatile bool inUpdate = false;
+    TaskHandle_t  loopTask = nullptr;
+
+    uint32_t allocations       = 0;
+    uint32_t updateAllocs      = 0;
+    uint32_t reportedAllocs    = 0;
+
+    void record(void* caller, size_t size)
+    {
+        if (!armed)
+            return;
+
+        AllocationRecord entry;
+        entry.caller    = reinterpret_cast<uintptr_t>(caller);
+        entry.size      = size;
+        entry.timestamp = millis();
+        entry.inUpdate  = inUpdate && xTaskGetCurrentTaskHandle() == loopTask;
+
+        portENTER_CRITICAL_SAFE(&lock);
+        records.pushOverwrite(entry);
+        allocations++;
+        if (entry.inUpdate)
+            updateAllocs++;
+        portEXIT_CRITICAL_SAFE(&lock);
+    }
+}
+
+extern "C"
+{
+    void* __wrap_malloc(size_t size)
+    {
+        record(__builtin_return_address(0), size);
+        return __real_malloc(size);
+    }
+
+    void* __wrap_calloc(size_t count, size_t size)
+    {
+        record(__builtin_return_address(0), count * size);
+        return __real_calloc(count, size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size)
+    {
+        record(__builtin_return_address(0), size);
+        return __real_realloc(ptr, size);
+    }
+}
+
+namespace HeapWatch
+{
+    void arm()
+    {
+        loopTask = xTaskGetCurrentTaskHandle();
+        armed = true;
+    }
+
+    void enterUpdate()
+    {
+        inUpdate = true;
+    }
+
+    void leaveUpdate()
+    {
+        inUpdate = false;
+
+#ifdef HEAP_WATCH_STRICT
+        if (updateAllocs != 0)
+        {
+            Serial.println(F("HEAP_WATCH_STRICT: update() allocated from the heap"));
+            report(Serial);
+            Serial.flush();
+            abort();
+        }
+#endif
+    }
+
+    uint32_t totalAllocations()
+    {
+        return allocations;
+    }
+
+    uint32_t updateAllocations()
+    {
+        return updateAllocs;
+    }
+
+    bool hasNewRecords()
+    {
+        return allocations != reportedAllocs;
+    }
+
+    void report(Print& out)
+    {
+        // Snapshot under the lock, print outside it
+
+        std::array<AllocationRecord, MAX_RECORDS> snapshot;
+        size_t count;
+        uint32_t total, inUpdateTotal;
+
+        portENTER_CRITICAL_SAFE(&lock);
+        count = records.size();
+        for (size_t i = 0; i < count; i++)
+            snapshot[i] = records[i];
+        total = allocations;
+        inUpdateTotal = updateAllocs;
+        portEXIT_CRITICAL_SAFE(&lock);
+
+        printFormat(out, "HeapWatch: %u allocations since setup(), %u from update(), last %u:\n",
+                    unsigned(total), unsigned(inUpdateTotal), unsigned(count));
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto& entry = snapshot[i];
+            printFormat(out, "  %8u ms  %6u bytes  caller 0x%08x%s\n",
+                        unsigned(entry.timestamp), unsigned(entry.size), unsigned(entry.caller),
+                        entry.inUpdate ? "  [update]" : "");
+        }
+
+        reportedAllocs = total;
+    }
+}
+
+#endif // HEAP_WATCH
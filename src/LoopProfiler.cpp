@@ -0,0 +1,129 @@
+// LoopProfiler.cpp - Histogram bookkeeping and reporting for LoopProfiler.h
+
+#include "LoopProfiler.h"
+#include "PrintFormat.h"
+#include <esp_system.h>
+
+namespace
+{
+    constexpr std::array<const char*, size_t(LoopStage::COUNT)> STAGE_NAMES =
+    {{
+        "idle", "input", "transmit", "display", "console", "persist"
+    }};
+
+    // Survives a watchdog or panic reset, but not a power cycle
+
+    constexpr uint32_t STAGE_MARKER_MAGIC = 0x5354474Du;    // 'STGM'
+
+    RTC_NOINIT_ATTR uint32_t stageMarkerMagic;
+    RTC_NOINIT_ATTR uint8_t  stageMarker;
+
+    size_t bucketFor(uint32_t micros)
+    {
+        if (micros < (1u << (LoopProfiler::BUCKET_SHIFT + 1)))
+            return 0;
+
+        size_t bucket = 31 - __builtin_clz(micros) - LoopProfiler::BUCKET_SHIFT;
+        return std::min(bucket, LoopProfiler::BUCKET_COUNT - 1);
+    }
+}
+
+const char* loopStageName(LoopStage stage)
+{
+    return stage < LoopStage::COUNT ? STAGE_NAMES[size_t(stage)] : "?";
+}
+
+void LoopProfiler::switchTo(LoopStage stage)
+{
+    uint32_t now = micros();
+    stageTime[size_t(currentStage)] += now - stageStart;
+    stageStart   = now;
+    currentStage = stage;
+
+    stageMarkerMagic = STAGE_MARKER_MAGIC;
+    stageMarker      = uint8_t(stage);
+}
+
+void LoopProfiler::beginIteration()
+{
+    stageTime.fill(0);
+    iterationStart = stageStart = micros();
+    currentStage   = LoopStage::Idle;
+}
+
+bool LoopProfiler::endIteration(LoopStage& culprit)
+{
+    switchTo(LoopStage::Idle);
+
+    uint32_t duration = stageStart - iterationStart;
+
+    // Idle only accrues between stages, so it only wins if nothing else ran
+
+    size_t worst = size_t(LoopStage::Idle);
+    for (size_t i = 0; i < stageTime.size(); i++)
+        if (stageTime[i] > stageTime[worst])
+            worst = i;
+    culprit = LoopStage(worst);
+
+    iterations++;
+    histogram[bucketFor(duration)]++;
+
+    if (duration > longest)
+    {
+        longest      = duration;
+        longestStage = culprit;
+    }
+
+    if (duration > deadline)
+    {
+        deadlineMisses++;
+        missesInARow++;
+        return true;
+    }
+
+    missesInARow = 0;
+    return false;
+}
+
+void LoopProfiler::reset()
+{
+    histogram.fill(0);
+    iterations     = 0;
+    longest        = 0;
+    longestStage   = LoopStage::Idle;
+    deadlineMisses = 0;
+    missesInARow   = 0;
+}
+
+void LoopProfiler::report(Print& out) const
+{
+    printFormat(out, "Loop: %u iterations, deadline %u us, %u misses\n",
+                unsigned(iterations), unsigned(deadline), unsigned(deadlineMisses));
+    printFormat(out, "Longest: %u us in stage %s\n", unsigned(longest), loopStageName(longestStage));
+
+    for (size_t i = 0; i < histogram.size(); i++)
+    {
+        if (histogram[i] == 0)
+            continue;
+
+        uint32_t low  = i == 0 ? 0 : 1u << (i + BUCKET_SHIFT);
+        uint32_t high = 1u << (i + BUCKET_SHIFT + 1);
+        if (i == histogram.size() - 1)
+            printFormat(out, "  >= %7u us: %u\n", unsigned(low), unsigned(histogram[i]));
+        else
+            printFormat(out, "  %7u-%-7u us: %u\n", unsigned(low), unsigned(high), unsigned(histogram[i]));
+    }
+}
+
+void LoopProfiler::reportLastReset(Print& out)
+{
+    auto reason = esp_reset_reason();
+    bool unexpected = reason == ESP_RST_TASK_WDT || reason == ESP_RST_INT_WDT ||
+                      reason == ESP_RST_WDT || reason == ESP_RST_PANIC;
+
+    if (unexpected && stageMarkerMagic == STAGE_MARKER_MAGIC)
+        printFormat(out, "Previous run reset (reason %d) while in stage %s\n",
+                    int(reason), loopStageName(LoopStage(stageMarker)));
+
+    stageMarkerMagic = 0;
+}
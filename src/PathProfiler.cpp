@@ -0,0 +1,106 @@
+// PathProfiler.cpp - Sample bookkeeping for PathProfiler.h
+//
+// record() is called from the button ISR and the WiFi task as well as the loop, so it
+// lives in IRAM and takes a spinlock.
+
+#ifdef PATH_PROFILE
+
+#include "PathProfiler.h"
+#include "PrintFormat.h"
+#include <array>
+
+namespace
+{
+    struct Stats
+    {
+        uint32_t count;
+        uint64_t total;
+        uint32_t min;
+        uint32_t max;
+    };
+
+    struct PathStats
+    {
+        Stats cold;
+        Stats warm;
+        bool  nextIsCold;
+    };
+
+    constexpr std::array<const char*, size_t(ProfiledPath::COUNT)> PATH_NAMES =
+    {{
+        "input isr", "transmit", "send callback", "press to send"
+    }};
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    DRAM_ATTR std::array<PathStats, size_t(ProfiledPath::COUNT)> paths = {};
+
+    void printStats(Print& out, const char* label, const Stats& stats, bool inCycles, uint32_t mhz)
+    {
+        if (stats.count == 0)
+        {
+            printFormat(out, "    %-5s no samples\n", label);
+            return;
+        }
+
+        uint32_t average = uint32_t(stats.total / stats.count);
+        printFormat(out, "    %-5s n=%-6u min %-8u avg %-8u max %-8u %s", label, unsigned(stats.count),
+                    unsigned(stats.min), unsigned(average), unsigned(stats.max), inCycles ? "cycles" : "us");
+        if (inCycles)
+            printFormat(out, " (avg %.2f us)", float(average) / mhz);
+        out.println();
+    }
+}
+
+namespace PathProfiler
+{
+    void markCold()
+    {
+        portENTER_CRITICAL_SAFE(&lock);
+        for (auto& path : paths)
+            path.nextIsCold = true;
+        portEXIT_CRITICAL_SAFE(&lock);
+    }
+
+    void HOT_PATH record(ProfiledPath path, uint32_t value)
+    {
+        portENTER_CRITICAL_SAFE(&lock);
+
+        auto& entry = paths[size_t(path)];
+        auto& stats = entry.nextIsCold ? entry.cold : entry.warm;
+        entry.nextIsCold = false;
+
+        if (stats.count == 0 || value < stats.min)
+            stats.min = value;
+        if (value > stats.max)
+            stats.max = value;
+        stats.total += value;
+        stats.count++;
+
+        portEXIT_CRITICAL_SAFE(&lock);
+    }
+
+    void report(Print& out)
+    {
+        portENTER_CRITICAL(&lock);
+        auto snapshot = paths;
+        portEXIT_CRITICAL(&lock);
+
+        uint32_t mhz = getCpuFrequencyMhz();
+
+#ifdef HOT_PATH_IN_FLASH
+        printFormat(out, "Hot paths in flash, CPU at %u MHz\n", unsigned(mhz));
+#else
+        printFormat(out, "Hot paths in IRAM, CPU at %u MHz\n", unsigned(mhz));
+#endif
+
+        for (size_t i = 0; i < snapshot.size(); i++)
+        {
+            bool inCycles = ProfiledPath(i) != ProfiledPath::PressToSend;
+            printFormat(out, "  %s\n", PATH_NAMES[i]);
+            printStats(out, "cold", snapshot[i].cold, inCycles, mhz);
+            printStats(out, "warm", snapshot[i].warm, inCycles, mhz);
+        }
+    }
+}
+
+#endif // PATH_PROFILE
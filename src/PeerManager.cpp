@@ -0,0 +1,288 @@
+// PeerManager.cpp - Roster persistence and peer table swapping for PeerManager.h
+
+#include "PeerManager.h"
+#include "PrintFormat.h"
+#include "SendOrder.h"
+#include <esp_now.h>
+#include <esp_timer.h>
+
+namespace
+{
+    constexpr const char* NAMESPACE = "peers";
+    constexpr const char* KEY       = "roster";
+}
+
+bool PeerManager::begin()
+{
+    if (!prefs.begin(NAMESPACE, false))
+        return false;
+
+    std::array<MacAddress, ROSTER_CAPACITY> saved;
+    size_t length = prefs.getBytesLength(KEY);
+    if (length == 0 || length % sizeof(MacAddress) != 0 || length > sizeof(saved))
+        return true;
+
+    prefs.getBytes(KEY, saved.data(), length);
+    for (size_t i = 0; i < length / sizeof(MacAddress); i++)
+        roster.push_back({saved[i], 0, false});
+    return true;
+}
+
+bool PeerManager::add(const MacAddress& mac)
+{
+    if (find(mac) >= 0)
+        return true;
+    if (!roster.push_back({mac, 0, false}))
+        return false;
+    stageSave();
+    return true;
+}
+
+bool PeerManager::remove(const MacAddress& mac)
+{
+    int index = find(mac);
+    if (index < 0)
+        return false;
+
+    if (roster[index].resident)
+    {
+        esp_now_del_peer(roster[index].mac.data());
+        residents--;
+        removes++;
+    }
+    roster.erase(size_t(index));
+    stageSave();
+    return true;
+}
+
+void PeerManager::poll()
+{
+    if (dirty && millis() - changedAt >= settleTime)
+        flush();
+}
+
+bool PeerManager::flush()
+{
+    if (!dirty)
+        return true;
+
+    dirty = false;
+    if (!save())
+    {
+        Serial.println(F("Failed to persist the peer roster"));
+        return false;
+    }
+    saves++;
+    return true;
+}
+
+size_t PeerManager::fanOut(const uint8_t* data, size_t length)
+{
+    // Decide the order up front: a receiver sent to early may be evicted again later on
+    StaticVector<uint8_t, ROSTER_CAPACITY> order;
+    for (size_t i = 0; i < roster.size(); i++)
+        if (roster[i].resident)
+            order.push_back(uint8_t(i));
+    for (size_t i = 0; i < roster.size(); i++)
+        if (!roster[i].resident)
+            order.push_back(uint8_t(i));
+
+    size_t sent = 0;
+    for (uint8_t index : order)
+        sent += send(roster[index], data, length);
+    return sent;
+}
+
+bool PeerManager::sendTo(const MacAddress& mac, const uint8_t* data, size_t length)
+{
+    int index = find(mac);
+    if (index < 0)
+    {
+        if (!add(mac))
+            return false;
+        index = int(roster.size() - 1);
+    }
+    return send(roster[index], data, length);
+}
+
+void PeerManager::sendPending()
+{
+    while (!queued.empty())
+    {
+        const Pending& next = queued.front();
+        int index = find(next.mac);
+        if (index >= 0)
+        {
+            // Still waiting on a send callback; the head holds everything behind it
+            if (!canMakeResident(roster[index]))
+                return;
+            transmit(roster[index], next.bytes.data(), next.length);
+        }
+        queued.pop();       // A receiver removed since its frame was queued is skipped
+    }
+}
+
+void PeerManager::tableCleared()
+{
+    // Frames still in the driver went with it, so no callbacks are owed
+    for (Entry& entry : roster)
+    {
+        entry.resident = false;
+        entry.ticket   = 0;
+    }
+    residents = 0;
+}
+
+bool PeerManager::send(Entry& entry, const uint8_t* data, size_t length)
+{
+    entry.lastUsed = ++clock;
+    if (!queued.empty() || !canMakeResident(entry))
+        return enqueue(entry.mac, data, length);
+    return transmit(entry, data, length);
+}
+
+bool PeerManager::transmit(Entry& entry, const uint8_t* data, size_t length)
+{
+    if (!makeResident(entry))
+    {
+        failures++;
+        return false;
+    }
+    if (beforeSend)
+        beforeSend(sendContext, entry.mac);
+    uint32_t ticket = SendOrder::send(entry.mac.data(), data, length);
+    if (ticket == 0)
+    {
+        failures++;
+        return false;
+    }
+    sends++;
+    entry.ticket = ticket;
+    return true;
+}
+
+bool PeerManager::enqueue(const MacAddress& mac, const uint8_t* data, size_t length)
+{
+    if (length > PEER_FRAME_CAPACITY || queued.full())
+    {
+        failures++;
+        return false;
+    }
+
+    Pending pending;
+    pending.mac    = mac;
+    pending.length = uint8_t(length);
+    std::copy(data, data + length, pending.bytes.begin());
+    queued.push(pending);
+    deferred++;
+    return true;
+}
+
+bool PeerManager::canMakeResident(const Entry& entry)
+{
+    return entry.resident || residents < slots || leastRecentEvictable() != nullptr;
+}
+
+bool PeerManager::makeResident(Entry& entry)
+{
+    if (entry.resident)
+        return true;
+
+    int64_t start = esp_timer_get_time();
+    if (residents >= slots)
+    {
+        Entry* victim = leastRecentEvictable();
+        if (!victim || esp_now_del_peer(victim->mac.data()) != ESP_OK)
+            return false;
+
+        victim->resident = false;
+        victim->ticket   = 0;
+        residents--;
+        removes++;
+    }
+
+    esp_now_peer_info_t peerInfo = {};
+    std::copy(entry.mac.begin(), entry.mac.end(), peerInfo.peer_addr);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+    peerInfo.ifidx   = WIFI_IF_STA;
+    if (esp_now_add_peer(&peerInfo) != ESP_OK)
+        return false;
+
+    entry.resident = true;
+    residents++;
+    adds++;
+
+    uint32_t elapsed = uint32_t(esp_timer_get_time() - start);
+    swapMicros += elapsed;
+    worstSwapMicros = std::max(worstSwapMicros, elapsed);
+    return true;
+}
+
+// The least recently used resident whose last frame's callback has come back
+
+PeerManager::Entry* PeerManager::leastRecentEvictable()
+{
+    Entry* victim = nullptr;
+    for (Entry& entry : roster)
+    {
+        bool idle = entry.ticket == 0 || SendOrder::hasLeft(entry.ticket);
+        if (entry.resident && idle && (!victim || int32_t(entry.lastUsed - victim->lastUsed) < 0))
+            victim = &entry;
+    }
+    return victim;
+}
+
+int PeerManager::find(const MacAddress& mac) const
+{
+    for (size_t i = 0; i < roster.size(); i++)
+        if (roster[i].mac == mac)
+            return int(i);
+    return -1;
+}
+
+void PeerManager::stageSave()
+{
+    dirty     = true;
+    changedAt = millis();
+}
+
+bool PeerManager::save()
+{
+    std::array<MacAddress, ROSTER_CAPACITY> saved;
+    for (size_t i = 0; i < roster.size(); i++)
+        saved[i] = roster[i].mac;
+
+    size_t length = roster.size() * sizeof(MacAddress);
+    if (length == 0)
+        return prefs.remove(KEY) || !prefs.isKey(KEY);
+    return prefs.putBytes(KEY, saved.data(), length) == length;
+}
+
+void PeerManager::report(Print& out) const
+{
+    printFormat(out, "Roster: %u receivers, %u of %u table slots in use\n", unsigned(roster.size()),
+                unsigned(residents), unsigned(slots));
+    for (const Entry& entry : roster)
+        printFormat(out, "  %02x:%02x:%02x:%02x:%02x:%02x%s\n", entry.mac[0], entry.mac[1], entry.mac[2], entry.mac[3],
+                    entry.mac[4], entry.mac[5], entry.resident ? "  (in table)" : "");
+
+    printFormat(out, "%u sends, %u failed; %u adds, %u removes, %u us swapping (worst %u us)\n", unsigned(sends),
+                unsigned(failures), unsigned(adds), unsigned(removes), unsigned(swapMicros),
+                unsigned(worstSwapMicros));
+    printFormat(out, "%u sends waited for a slot, %u queued now\n", unsigned(deferred), unsigned(queued.size()));
+    printFormat(out, "Roster %s; %u saves since boot\n", dirty ? "change pending" : "saved", unsigned(saves));
+}
+
+bool PeerManager::parseMac(const char* text, MacAddress& mac)
+{
+    unsigned bytes[6];
+    char     trailing;
+    if (sscanf(text, "%2x:%2x:%2x:%2x:%2x:%2x%c", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4],
+               &bytes[5], &trailing) != 6)
+        return false;
+
+    for (size_t i = 0; i < mac.size(); i++)
+        mac[i] = uint8_t(bytes[i]);
+    return true;
+}
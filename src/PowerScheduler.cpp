@@ -0,0 +1,119 @@
+// PowerScheduler.cpp - Sleep entry and deep sleep persistence for PowerScheduler.h
+
+#include "PowerScheduler.h"
+#include "PathProfiler.h"
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/uart.h>
+#include <sys/time.h>
+
+namespace
+{
+    // RTC slow memory survives deep sleep; the RTC clock behind gettimeofday() keeps
+    // running through it, which is how the time asleep is measured
+
+    constexpr uint32_t SAVED_MAGIC = 0x504F5752u;   // 'POWR'
+
+    RTC_DATA_ATTR uint32_t            savedMagic;
+    RTC_DATA_ATTR EnergyModel::Totals savedTotals;
+    RTC_DATA_ATTR int64_t             sleptAtMicros;
+
+    int64_t wallMicros()
+    {
+        timeval now;
+        gettimeofday(&now, nullptr);
+        return int64_t(now.tv_sec) * 1000000 + now.tv_usec;
+    }
+
+    uint64_t nowMicros()
+    {
+        return esp_timer_get_time();
+    }
+}
+
+void PowerScheduler::begin()
+{
+    if (savedMagic == SAVED_MAGIC && esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED)
+    {
+        model.restore(savedTotals);
+        model.credit(PowerState::DeepSleep, wallMicros() - sleptAtMicros);
+    }
+
+    savedMagic = 0;
+    lastActivity = millis();
+    model.transition(PowerState::DisplayOn, nowMicros());
+}
+
+bool PowerScheduler::noteActivity()
+{
+    lastActivity = millis();
+    if (model.currentState() == PowerState::DisplayOn)
+        return false;
+
+    model.transition(PowerState::DisplayOn, nowMicros());
+    return true;
+}
+
+PowerScheduler::Action PowerScheduler::update()
+{
+    uint32_t idle = idleMillis();
+
+    if (timeouts.deepSleepMillis != 0 && idle >= timeouts.deepSleepMillis)
+        return Action::DeepSleep;
+
+    if (model.currentState() == PowerState::DisplayOn && idle >= timeouts.displayMillis)
+    {
+        model.transition(PowerState::DisplayOff, nowMicros());
+        return Action::DisplayOff;
+    }
+
+    return Action::None;
+}
+
+void PowerScheduler::idle(uint32_t awakeMillis, uint32_t asleepMillis, bool stayAwake)
+{
+    if (model.currentState() != PowerState::DisplayOff || stayAwake)
+    {
+        delay(awakeMillis);
+        return;
+    }
+
+    // Wake on the poll timer, the button or console input, whichever comes first. The
+    // characters that wake the UART are lost, so console users press enter a few times.
+
+    esp_sleep_enable_timer_wakeup(uint64_t(asleepMillis) * 1000);
+    gpio_wakeup_enable(wakePin, GPIO_INTR_LOW_LEVEL);
+    if (auxWakePin != GPIO_NUM_NC)
+        gpio_wakeup_enable(auxWakePin, GPIO_INTR_LOW_LEVEL);
+    for (gpio_num_t pin : lightSleepWakePins)
+        gpio_wakeup_enable(pin, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    uart_set_wakeup_threshold(UART_NUM_0, 3);
+    esp_sleep_enable_uart_wakeup(UART_NUM_0);
+
+    model.transition(PowerState::LightSleep, nowMicros());
+    esp_light_sleep_start();
+    model.transition(PowerState::DisplayOff, nowMicros());
+
+    // Whatever runs first after the wake may miss in the flash cache
+    PathProfiler::markCold();
+}
+
+void PowerScheduler::deepSleep()
+{
+    model.transition(PowerState::DeepSleep, nowMicros());
+
+    savedTotals   = model.totals();
+    sleptAtMicros = wallMicros();
+    savedMagic    = SAVED_MAGIC;
+
+    esp_sleep_enable_ext0_wakeup(wakePin, 0);
+    if (auxWakePin != GPIO_NUM_NC)
+        esp_sleep_enable_ext1_wakeup(1ULL << auxWakePin, ESP_EXT1_WAKEUP_ALL_LOW);
+    esp_deep_sleep_start();
+}
+
+bool PowerScheduler::wokeByAuxPin() const
+{
+    return auxWakePin != GPIO_NUM_NC && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT1;
+}
@@ -0,0 +1,19 @@
+// PrintFormat.cpp - Stack-buffered printf for PrintFormat.h
+
+#include "PrintFormat.h"
+#include <cstdarg>
+#include <cstdio>
+
+size_t printFormat(Print& out, const char* format, ...)
+{
+    char buffer[PRINT_FORMAT_MAX];
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (length <= 0)
+        return 0;
+    return out.write(reinterpret_cast<const uint8_t*>(buffer), size_t(length) < sizeof(buffer) ? size_t(length) : sizeof(buffer) - 1);
+}
@@ -0,0 +1,56 @@
+// SendOrder.cpp - Send numbering and callback counting for SendOrder.h
+
+#include "SendOrder.h"
+#include <esp_now.h>
+#include <freertos/semphr.h>
+#include <atomic>
+
+namespace
+{
+    SemaphoreHandle_t     mutex = nullptr;
+    std::atomic<uint32_t> queued{0};
+    std::atomic<uint32_t> completed{0};
+}
+
+bool SendOrder::begin()
+{
+    if (!mutex)
+        mutex = xSemaphoreCreateMutex();
+    return mutex != nullptr;
+}
+
+uint32_t SendOrder::send(const uint8_t* peer, const uint8_t* data, size_t length)
+{
+    if (mutex)
+        xSemaphoreTake(mutex, portMAX_DELAY);
+
+    uint32_t ticket = 0;
+    if (esp_now_send(peer, data, length) == ESP_OK)
+    {
+        // 0 means refused, so it is skipped when the count wraps
+        ticket = queued.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (ticket == 0)
+            ticket = queued.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    if (mutex)
+        xSemaphoreGive(mutex);
+    return ticket;
+}
+
+void HOT_PATH SendOrder::onCallback()
+{
+    uint32_t count = completed.fetch_add(1, std::memory_order_release) + 1;
+    if (count == 0)
+        completed.fetch_add(1, std::memory_order_release);
+}
+
+bool HOT_PATH SendOrder::hasLeft(uint32_t ticket)
+{
+    return ticket != 0 && int32_t(completed.load(std::memory_order_acquire) - ticket) >= 0;
+}
+
+void SendOrder::resync()
+{
+    completed.store(queued.load(std::memory_order_relaxed), std::memory_order_release);
+}
@@ -0,0 +1,245 @@
+// Sniffer.cpp - Frame filtering, the capture ring and pcap output for Sniffer.h
+
+#include "Sniffer.h"
+#include "PrintFormat.h"
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // On the core the WiFi task runs on, below it, so the loop on the other core never
+    // waits on the serial port for a capture
+    constexpr UBaseType_t SNIFFER_TASK_PRIORITY = 2;
+    constexpr uint32_t    SNIFFER_TASK_STACK    = 3072;
+    constexpr BaseType_t  SNIFFER_TASK_CORE     = 0;
+
+    // An ESP-NOW frame: the 24 byte 802.11 header of an action frame, category 127 and the
+    // Espressif OUI, four random bytes, then a vendor element (id 221, length, OUI again,
+    // type 4, version) and the body
+    constexpr uint8_t ACTION_FRAME      = 0xD0;
+    constexpr size_t  CATEGORY_OFFSET   = 24;
+    constexpr uint8_t VENDOR_CATEGORY   = 127;
+    constexpr size_t  ELEMENT_OFFSET    = 32;
+    constexpr uint8_t VENDOR_ELEMENT    = 221;
+    constexpr uint8_t ESPNOW_TYPE       = 4;
+    constexpr size_t  ESPNOW_MIN_LENGTH = ELEMENT_OFFSET + 7;
+    constexpr size_t  FCS_LENGTH        = 4;
+
+    constexpr uint8_t ESPRESSIF_OUI[3] = { 0x18, 0xFE, 0x34 };
+
+    // pcap with a radiotap header: present flags for the channel (bit 3) and antenna
+    // signal in dBm (bit 5), which is 8 + 4 + 1 bytes
+    constexpr uint32_t LINKTYPE_RADIOTAP = 127;
+    constexpr uint16_t RADIOTAP_LENGTH   = 13;
+    constexpr uint16_t CHANNEL_2GHZ      = 0x0080;
+
+    void putLittleEndian(uint8_t* out, uint32_t value, size_t bytes)
+    {
+        for (size_t i = 0; i < bytes; i++)
+            out[i] = uint8_t(value >> (i * 8));
+    }
+}
+
+Sniffer* Sniffer::active = nullptr;
+
+bool Sniffer::begin(Print& out)
+{
+    output = &out;
+    if (xTaskCreatePinnedToCore(taskEntry, "sniffer", SNIFFER_TASK_STACK, this, SNIFFER_TASK_PRIORITY, &task,
+                                SNIFFER_TASK_CORE) != pdPASS)
+    {
+        Serial.println(F("Error starting the sniffer task"));
+        return false;
+    }
+    return true;
+}
+
+// The drain task is idle between captures, so the ring and counters can be reset here
+
+bool Sniffer::start()
+{
+    if (running || !task)
+        return running;
+
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    captured.store(0, std::memory_order_relaxed);
+    dropped.store(0, std::memory_order_relaxed);
+    ignored.store(0, std::memory_order_relaxed);
+    sent.store(0, std::memory_order_relaxed);
+    sentBytes.store(0, std::memory_order_relaxed);
+    active = this;
+
+    wifi_promiscuous_filter_t filter = {};
+    filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+    if (esp_wifi_set_promiscuous_filter(&filter) != ESP_OK || esp_wifi_set_promiscuous_rx_cb(onPacket) != ESP_OK ||
+        esp_wifi_set_promiscuous(true) != ESP_OK)
+        return false;
+
+    draining.store(true, std::memory_order_relaxed);
+    running.store(true, std::memory_order_release);
+    xTaskNotifyGive(task);
+    return true;
+}
+
+void Sniffer::stop()
+{
+    if (!running)
+        return;
+
+    esp_wifi_set_promiscuous(false);
+    esp_wifi_set_promiscuous_rx_cb(nullptr);
+    running.store(false, std::memory_order_release);
+
+    // The summary that follows has to come after the last record
+    while (draining.load(std::memory_order_acquire))
+        vTaskDelay(1);
+}
+
+void Sniffer::taskEntry(void* context)
+{
+    static_cast<Sniffer*>(context)->run();
+}
+
+// Waits for a capture, writes it out as it arrives, then empties the ring once it stops
+
+void Sniffer::run()
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        writeFileHeader();
+
+        while (running.load(std::memory_order_acquire))
+            if (!drain())
+                vTaskDelay(pdMS_TO_TICKS(SNIFFER_DRAIN_MS));
+
+        while (drain())
+        {
+        }
+        draining.store(false, std::memory_order_release);
+    }
+}
+
+void HOT_PATH Sniffer::onPacket(void* buffer, wifi_promiscuous_pkt_type_t type)
+{
+    if (type == WIFI_PKT_MGMT && active)
+        active->capture(*static_cast<const wifi_promiscuous_pkt_t*>(buffer));
+}
+
+void HOT_PATH Sniffer::capture(const wifi_promiscuous_pkt_t& packet)
+{
+    const uint8_t* frame  = packet.payload;
+    size_t         length = packet.rx_ctrl.sig_len > FCS_LENGTH ? packet.rx_ctrl.sig_len - FCS_LENGTH : 0;
+
+    if (length < ESPNOW_MIN_LENGTH || frame[0] != ACTION_FRAME || frame[CATEGORY_OFFSET] != VENDOR_CATEGORY ||
+        memcmp(frame + CATEGORY_OFFSET + 1, ESPRESSIF_OUI, 3) != 0 || frame[ELEMENT_OFFSET] != VENDOR_ELEMENT ||
+        memcmp(frame + ELEMENT_OFFSET + 2, ESPRESSIF_OUI, 3) != 0 || frame[ELEMENT_OFFSET + 5] != ESPNOW_TYPE)
+    {
+        ignored.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Record record;
+    record.micros         = esp_timer_get_time();
+    record.length         = uint16_t(length < SNIFFER_SNAPLEN ? length : SNIFFER_SNAPLEN);
+    record.originalLength = uint16_t(length);
+    record.rssi           = int8_t(packet.rx_ctrl.rssi);
+    record.channel        = uint8_t(packet.rx_ctrl.channel);
+
+    uint32_t position = head.load(std::memory_order_relaxed);
+    uint32_t needed   = sizeof(Record) + record.length;
+    if (SNIFFER_RING_BYTES - (position - tail.load(std::memory_order_acquire)) < needed)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    put(position, &record, sizeof(Record));
+    put(position + sizeof(Record), frame, record.length);
+    head.store(position + needed, std::memory_order_release);
+    captured.fetch_add(1, std::memory_order_relaxed);
+}
+
+// The ring is addressed with free-running positions; these copy across the wrap
+
+void HOT_PATH Sniffer::put(uint32_t position, const void* data, size_t length)
+{
+    size_t offset = position % SNIFFER_RING_BYTES;
+    size_t first  = length < SNIFFER_RING_BYTES - offset ? length : SNIFFER_RING_BYTES - offset;
+    memcpy(ring.data() + offset, data, first);
+    memcpy(ring.data(), static_cast<const uint8_t*>(data) + first, length - first);
+}
+
+void Sniffer::get(uint32_t position, void* data, size_t length) const
+{
+    size_t offset = position % SNIFFER_RING_BYTES;
+    size_t first  = length < SNIFFER_RING_BYTES - offset ? length : SNIFFER_RING_BYTES - offset;
+    memcpy(data, ring.data() + offset, first);
+    memcpy(static_cast<uint8_t*>(data) + first, ring.data(), length - first);
+}
+
+void Sniffer::writeFileHeader()
+{
+    uint8_t bytes[SNIFFER_SYNC.size() + 24];
+    uint8_t* header = bytes + SNIFFER_SYNC.size();
+    std::copy(SNIFFER_SYNC.begin(), SNIFFER_SYNC.end(), bytes);
+    putLittleEndian(header, 0xA1B2C3D4, 4);          // Microsecond timestamps
+    putLittleEndian(header + 4, 2, 2);
+    putLittleEndian(header + 6, 4, 2);
+    putLittleEndian(header + 8, 0, 4);
+    putLittleEndian(header + 12, 0, 4);
+    putLittleEndian(header + 16, RADIOTAP_LENGTH + SNIFFER_SNAPLEN, 4);
+    putLittleEndian(header + 20, LINKTYPE_RADIOTAP, 4);
+    output->write(bytes, sizeof(bytes));
+}
+
+bool Sniffer::drain()
+{
+    constexpr size_t RECORD_OFFSET = SNIFFER_SYNC.size();
+
+    size_t written = 0;
+    while (written < SNIFFER_DRAIN_BYTES)
+    {
+        uint32_t position = tail.load(std::memory_order_relaxed);
+        if (position == head.load(std::memory_order_acquire))
+            return false;
+
+        Record record;
+        std::array<uint8_t, RECORD_OFFSET + 16 + RADIOTAP_LENGTH + SNIFFER_SNAPLEN> bytes;
+        get(position, &record, sizeof(Record));
+        get(position + sizeof(Record), bytes.data() + RECORD_OFFSET + 16 + RADIOTAP_LENGTH, record.length);
+        tail.store(position + sizeof(Record) + record.length, std::memory_order_release);
+
+        uint32_t frequency = record.channel == 14 ? 2484 : 2407 + 5 * record.channel;
+        uint8_t* header    = bytes.data() + RECORD_OFFSET;
+        uint8_t* radiotap  = header + 16;
+        std::copy(SNIFFER_SYNC.begin(), SNIFFER_SYNC.end(), bytes.begin());
+        putLittleEndian(header, uint32_t(record.micros / 1000000), 4);
+        putLittleEndian(header + 4, uint32_t(record.micros % 1000000), 4);
+        putLittleEndian(header + 8, RADIOTAP_LENGTH + record.length, 4);
+        putLittleEndian(header + 12, RADIOTAP_LENGTH + record.originalLength, 4);
+        putLittleEndian(radiotap, 0, 2);
+        putLittleEndian(radiotap + 2, RADIOTAP_LENGTH, 2);
+        putLittleEndian(radiotap + 4, 1 << 3 | 1 << 5, 4);
+        putLittleEndian(radiotap + 8, frequency, 2);
+        putLittleEndian(radiotap + 10, CHANNEL_2GHZ, 2);
+        radiotap[12] = uint8_t(record.rssi);
+
+        size_t length = RECORD_OFFSET + 16 + RADIOTAP_LENGTH + record.length;
+        output->write(bytes.data(), length);
+        written += length;
+        sentBytes.fetch_add(length, std::memory_order_relaxed);
+        sent.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void Sniffer::report(Print& out) const
+{
+    printFormat(out, "Sniffer %s: %u ESP-NOW frames captured, %u sent (%u bytes), %u dropped with the ring full, "
+                "%u other management frames ignored\n",
+                isRunning() ? "capturing" : "stopped", unsigned(captured.load()), unsigned(sent.load()),
+                unsigned(sentBytes.load()), unsigned(dropped.load()), unsigned(ignored.load()));
+}
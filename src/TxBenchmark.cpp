@@ -0,0 +1,159 @@
+// TxBenchmark.cpp - The sweep and JSON report for TxBenchmark.h
+
+#include "TxBenchmark.h"
+#include <esp_now.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include "ESPNowProtocol.h"
+#include "PrintFormat.h"
+#include "SendOrder.h"
+#include "StaticPool.h"
+
+uint32_t TxBenchmark::run(PeerManager& roster, Print& out)
+{
+    peers = &roster;
+
+    // Broadcast, then unicast to one receiver, to as many as the peer table holds and to
+    // the whole roster, skipping counts that repeat
+    StaticVector<size_t, 4> peerCounts;
+    peerCounts.push_back(0);
+    for (size_t count : { size_t(1), std::min(slots, roster.size()), roster.size() })
+        if (count != 0 && count != peerCounts[peerCounts.size() - 1])
+            peerCounts.push_back(count);
+
+    printFormat(out, "{\"build\":\"%s %s\",\"sdk\":\"%s\",\"frames\":%u,\"roster\":%u,\"points\":[\n", __DATE__, __TIME__,
+                ESP.getSdkVersion(), unsigned(BENCH_FRAMES), unsigned(roster.size()));
+
+    running.store(true, std::memory_order_release);
+    uint32_t total     = 0;
+    size_t   remaining = peerCounts.size() * BENCH_PAYLOADS.size() * BENCH_DEPTHS.size();
+    for (size_t peerCount : peerCounts)
+    {
+        for (size_t payload : BENCH_PAYLOADS)
+        {
+            for (uint32_t depth : BENCH_DEPTHS)
+            {
+                Point point = measure(payload, depth, peerCount);
+                total += point.sent;
+                print(out, point, --remaining == 0);
+            }
+        }
+    }
+    running.store(false, std::memory_order_release);
+
+    out.println(F("]}"));
+    peers = nullptr;
+    return total;
+}
+
+void TxBenchmark::onSent(bool success)
+{
+    int64_t  now   = esp_timer_get_time();
+    uint32_t index = callbacks.load(std::memory_order_relaxed);
+    if (index < BENCH_FRAMES)
+        latencies[index] = uint32_t(now - sendMicros[index]);
+    if (!success)
+        failures.fetch_add(1, std::memory_order_relaxed);
+    lastCallbackMicros.store(now, std::memory_order_relaxed);
+    callbacks.store(index + 1, std::memory_order_release);
+}
+
+TxBenchmark::Point TxBenchmark::measure(size_t payload, uint32_t depth, size_t peerCount)
+{
+    // The length byte matches, but the command is one no receiver acts on
+    std::array<uint8_t, ESP_NOW_MAX_DATA_LEN> frame = {};
+    frame[0] = uint8_t(payload);
+    frame[1] = uint8_t(ESPNowCommand::INVALID);
+
+    accepted.store(0, std::memory_order_relaxed);
+    failures.store(0, std::memory_order_relaxed);
+    callbacks.store(0, std::memory_order_release);
+
+    Point point = {};
+    point.payload   = payload;
+    point.depth     = depth;
+    point.peerCount = peerCount;
+
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < BENCH_FRAMES; i++)
+    {
+        esp_task_wdt_reset();
+        if (!waitForCallbacks(depth - 1))
+            break;
+
+        uint32_t slot = accepted.load(std::memory_order_relaxed);
+        sendMicros[slot] = esp_timer_get_time();
+        if (send(frame.data(), payload, peerCount, i))
+            accepted.store(slot + 1, std::memory_order_release);
+        else
+            point.rejected++;
+    }
+    waitForCallbacks(0);
+
+    uint32_t done       = std::min(callbacks.load(std::memory_order_acquire), uint32_t(BENCH_FRAMES));
+    point.sent          = accepted.load(std::memory_order_relaxed);
+    point.failed        = failures.load(std::memory_order_relaxed);
+    point.lost          = point.sent > done ? point.sent - done : 0;
+    point.elapsedMicros = done ? uint32_t(lastCallbackMicros.load(std::memory_order_relaxed) - start) : 0;
+
+    if (done != 0)
+    {
+        std::sort(latencies.begin(), latencies.begin() + done);
+        point.p50   = latencies[(done - 1) * 50 / 100];
+        point.p90   = latencies[(done - 1) * 90 / 100];
+        point.p99   = latencies[(done - 1) * 99 / 100];
+        point.worst = latencies[done - 1];
+    }
+    return point;
+}
+
+bool TxBenchmark::send(const uint8_t* data, size_t length, size_t peerCount, uint32_t frame)
+{
+    if (peerCount == 0)
+        return SendOrder::send(broadcast, data, length) != 0;
+    return peers->sendTo(peers->at(frame % peerCount), data, length);
+}
+
+// Waits until no more than 'outstanding' frames await their callback; false if none came
+// for BENCH_TIMEOUT_US
+
+bool TxBenchmark::waitForCallbacks(uint32_t outstanding)
+{
+    uint32_t seen     = callbacks.load(std::memory_order_acquire);
+    int64_t  progress = esp_timer_get_time();
+    while (accepted.load(std::memory_order_relaxed) - seen > outstanding)
+    {
+        // Roster sends queued behind an eviction go out as their slots free up; the
+        // loop that would otherwise send them is blocked for the run
+        if (peers)
+            peers->sendPending();
+
+        uint32_t now = callbacks.load(std::memory_order_acquire);
+        if (now != seen)
+        {
+            seen     = now;
+            progress = esp_timer_get_time();
+        }
+        else if (esp_timer_get_time() - progress > BENCH_TIMEOUT_US)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TxBenchmark::print(Print& out, const Point& point, bool last)
+{
+    uint32_t attempted = point.sent + point.rejected;
+    float    fps       = point.elapsedMicros ? (point.sent - point.lost) * 1e6f / point.elapsedMicros : 0;
+    float    failRate  = attempted ? float(point.rejected + point.failed + point.lost) / attempted : 0;
+
+    printFormat(out, "  {\"dest\":\"%s\",\"peers\":%u,\"payload\":%u,\"depth\":%u,\"sent\":%u,\"rejected\":%u,"
+                "\"failed\":%u,\"lost\":%u,\"fps\":%.1f,\"latency_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,"
+                "\"max\":%u},\"failure_rate\":%.4f}%s\n",
+                point.peerCount ? "unicast" : "broadcast", unsigned(point.peerCount), unsigned(point.payload),
+                unsigned(point.depth), unsigned(point.sent), unsigned(point.rejected), unsigned(point.failed),
+                unsigned(point.lost), fps, unsigned(point.p50), unsigned(point.p90), unsigned(point.p99),
+                unsigned(point.worst), failRate, last ? "" : ",");
+}
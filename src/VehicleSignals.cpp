@@ -0,0 +1,287 @@
+// VehicleSignals.cpp - Edge capture, filtering and override task for VehicleSignals.h
+
+#include "VehicleSignals.h"
+#include "PrintFormat.h"
+#include "SendOrder.h"
+#include <esp_timer.h>
+#include <soc/gpio_struct.h>
+
+namespace
+{
+    // Above the loop task on the same core, so a signal change preempts whatever the
+    // loop is doing, but below the WiFi task that puts the frame on air
+    constexpr UBaseType_t SIGNAL_TASK_PRIORITY = 5;
+    constexpr uint32_t    SIGNAL_TASK_STACK    = 3072;
+    constexpr BaseType_t  SIGNAL_TASK_CORE     = 1;
+
+    TickType_t ticks(uint32_t millis)
+    {
+        TickType_t count = pdMS_TO_TICKS(millis);
+        return count != 0 ? count : 1;
+    }
+
+    uint32_t sendMessage(const uint8_t* peer, const Message& msg, bool legacy)
+    {
+        if (!legacy)
+            return SendOrder::send(peer, msg.data(), msg.byte_size());
+
+        auto bytes = encodeLegacyMessage(msg);
+        return SendOrder::send(peer, bytes.data(), bytes.size());
+    }
+}
+
+bool VehicleSignals::begin(const Inputs& signalInputs, SequenceCounter& sequences, const uint8_t* peer)
+{
+    inputs          = signalInputs;
+    sequenceCounter = &sequences;
+    peerAddress     = peer;
+
+    if (!anySignalWired(inputs))
+        return true;
+
+    // Pulled up before the task can sample them, and with the task in place before an
+    // edge can try to wake it
+    for (const SignalInput& input : inputs)
+        if (input.pin != GPIO_NUM_NC)
+            pinMode(input.pin, INPUT_PULLUP);
+
+    if (xTaskCreatePinnedToCore(taskEntry, "signals", SIGNAL_TASK_STACK, this, SIGNAL_TASK_PRIORITY, &task,
+                                SIGNAL_TASK_CORE) != pdPASS)
+    {
+        Serial.println(F("Error starting the vehicle signal task"));
+        return false;
+    }
+
+    for (const SignalInput& input : inputs)
+        if (input.pin != GPIO_NUM_NC)
+            attachInterruptArg(digitalPinToInterrupt(input.pin), onEdge, this, CHANGE);
+    return true;
+}
+
+void VehicleSignals::setBase(uint32_t effect, uint8_t brightness)
+{
+    baseEffect.store(effect, std::memory_order_relaxed);
+    baseBrightness.store(brightness, std::memory_order_release);
+
+    // The first base lets the task act
+    if (!baseSet.exchange(true) && task)
+        xTaskNotifyGive(task);
+}
+
+bool VehicleSignals::takeSent(Message& sent)
+{
+    portENTER_CRITICAL(&sentLock);
+    bool taken = sentFrames.pop(sent);
+    portEXIT_CRITICAL(&sentLock);
+    return taken;
+}
+
+void VehicleSignals::onFrameSent()
+{
+    // Only the callback for the override's own frame ends the measurement; the task may
+    // also get here itself if that callback beat it to setting the ticket
+    int64_t since = awaitingSince.load(std::memory_order_acquire);
+    if (since == 0 || !SendOrder::hasLeft(awaitingTicket.load(std::memory_order_relaxed)) ||
+        !awaitingSince.compare_exchange_strong(since, 0))
+        return;
+
+    uint32_t elapsed = uint32_t(esp_timer_get_time() - since);
+    lastLatency = elapsed;
+    if (elapsed > worstLatency.load())
+        worstLatency = elapsed;
+    if (elapsed > SIGNAL_BUDGET_US)
+        overBudget++;
+}
+
+// Timestamps the first edge of a change and wakes the task; the filtering happens there
+
+void VehicleSignals::onEdge(void* context)
+{
+    auto& self = *static_cast<VehicleSignals*>(context);
+
+    int64_t none = 0;
+    self.firstEdgeMicros.compare_exchange_strong(none, esp_timer_get_time());
+    self.restoreEdgeTriggers();
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(self.task, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// Arming the inputs for light sleep wakeup leaves them level-triggered, which would
+// re-enter the ISR for as long as a signal is on; put them back on both edges
+
+void VehicleSignals::restoreEdgeTriggers()
+{
+    for (const SignalInput& input : inputs)
+    {
+        if (input.pin == GPIO_NUM_NC)
+            continue;
+        GPIO.pin[input.pin].int_type      = GPIO_INTR_ANYEDGE;
+        GPIO.pin[input.pin].wakeup_enable = 0;
+    }
+}
+
+void VehicleSignals::taskEntry(void* context)
+{
+    static_cast<VehicleSignals*>(context)->run();
+}
+
+void VehicleSignals::run()
+{
+    // Nothing to go back to until the loop has restored the user's effect; edges before
+    // then only wake the task to wait again
+    while (!baseSet.load(std::memory_order_acquire))
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    evaluate();     // A signal may already be on at boot
+
+    for (;;)
+    {
+        if (ulTaskNotifyTake(pdTRUE, nextHoldExpiry()) != 0)
+        {
+            // Wait for the inputs to go quiet so that bounce and spikes are ignored, but
+            // not for longer than the latency budget allows
+            TickType_t start = xTaskGetTickCount();
+            while (ulTaskNotifyTake(pdTRUE, ticks(SIGNAL_GLITCH_MS)) != 0 &&
+                   xTaskGetTickCount() - start < ticks(SIGNAL_SETTLE_LIMIT_MS))
+            {
+            }
+        }
+        evaluate();
+    }
+}
+
+void VehicleSignals::evaluate()
+{
+    uint32_t now  = millis();
+    uint32_t held = activeMask.load(std::memory_order_relaxed);
+    uint32_t mask = 0;
+
+    liveMask = 0;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        uint32_t bit = 1u << i;
+        if (inputs[i].pin == GPIO_NUM_NC)
+            continue;
+
+        if (digitalRead(inputs[i].pin) == LOW)
+        {
+            lastSeenMillis[i] = now;
+            liveMask |= bit;
+            mask     |= bit;
+        }
+        else if ((held & bit) && now - lastSeenMillis[i] < inputs[i].holdMillis)
+        {
+            mask |= bit;
+        }
+    }
+    activeMask.store(mask, std::memory_order_relaxed);
+
+    int32_t best = -1;
+    for (size_t i = 0; i < SIGNAL_OVERRIDES.size(); i++)
+    {
+        if (mask & (1u << size_t(SIGNAL_OVERRIDES[i].signal)))
+        {
+            best = int32_t(i);
+            break;
+        }
+    }
+
+    // A glitch, or a turn signal blinking within its hold time
+    if (best == winner.load(std::memory_order_relaxed))
+    {
+        firstEdgeMicros = 0;
+        return;
+    }
+
+    winner.store(best, std::memory_order_relaxed);
+    if (best >= 0)
+        send(uint32_t(SIGNAL_OVERRIDES[best].effect), SIGNAL_OVERRIDES[best].brightness);
+    else
+        send(baseEffect.load(std::memory_order_relaxed), baseBrightness.load(std::memory_order_relaxed));
+}
+
+// Ticks until the earliest hold on an input that has gone off runs out
+
+TickType_t VehicleSignals::nextHoldExpiry() const
+{
+    uint32_t   now  = millis();
+    uint32_t   held = activeMask.load(std::memory_order_relaxed) & ~liveMask;
+    TickType_t wait = portMAX_DELAY;
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (!(held & (1u << i)))
+            continue;
+
+        uint32_t elapsed   = now - lastSeenMillis[i];
+        uint32_t remaining = inputs[i].holdMillis > elapsed ? inputs[i].holdMillis - elapsed : 0;
+        wait = std::min(wait, ticks(remaining));
+    }
+    return wait;
+}
+
+// Sends the effect first, since that is what the driver behind sees change
+
+void VehicleSignals::send(uint32_t effect, uint8_t brightness)
+{
+    uint8_t groupMask = groups.load(std::memory_order_relaxed);
+    std::array<Message, 2> frames =
+    {{
+        { ESPNowCommand::SetEffect,     effect,     sequenceCounter->take(), groupMask },
+        { ESPNowCommand::SetBrightness, brightness, sequenceCounter->take(), groupMask },
+    }};
+
+    // A measurement still waiting on an earlier change's frame is abandoned for this one.
+    // A hold running out has no edge behind it, and isn't timed.
+    awaitingSince = 0;
+    int64_t edge  = firstEdgeMicros.exchange(0);
+
+    bool     legacy = legacyWire.load(std::memory_order_relaxed);
+    uint32_t ticket = sendMessage(peerAddress, frames[0], legacy);
+    sendMessage(peerAddress, frames[1], legacy);
+
+    if (edge != 0 && ticket != 0)
+    {
+        awaitingTicket.store(ticket, std::memory_order_relaxed);
+        awaitingSince.store(edge, std::memory_order_release);
+        onFrameSent();
+    }
+
+    portENTER_CRITICAL(&sentLock);
+    for (const Message& frame : frames)
+    {
+        if (sentFrames.full())
+            sentDropped++;
+        sentFrames.pushOverwrite(frame);
+    }
+    portEXIT_CRITICAL(&sentLock);
+    changes++;
+}
+
+void VehicleSignals::report(Print& out) const
+{
+    if (!anySignalWired(inputs))
+    {
+        out.println(F("No vehicle signals wired; set SIGNAL_INPUTS"));
+        return;
+    }
+
+    uint32_t mask = activeMask.load();
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        if (inputs[i].pin != GPIO_NUM_NC)
+            printFormat(out, "  %-8s GPIO%-2d %s\n", VEHICLE_SIGNAL_NAMES[i], int(inputs[i].pin),
+                        (mask & (1u << i)) ? "active" : "off");
+    }
+
+    int32_t current = winner.load();
+    printFormat(out, "Override: %s\n", current >= 0 ? VEHICLE_SIGNAL_NAMES[size_t(SIGNAL_OVERRIDES[current].signal)] : "none");
+    printFormat(out, "%u changes, edge to air last %u us, worst %u us, %u over the %u us budget\n",
+                unsigned(changes.load()), unsigned(lastLatency.load()), unsigned(worstLatency.load()),
+                unsigned(overBudget.load()), unsigned(SIGNAL_BUDGET_US));
+    if (sentDropped.load() != 0)
+        printFormat(out, "%u sent frames dropped before the loop could schedule their repeats\n",
+                    unsigned(sentDropped.load()));
+}
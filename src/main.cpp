@@ -1,40 +1,66 @@
 // NightDriverRemote - Demo of ESPNOW commands being sent to a NightDriverStrip
 // using an ESP32-based remote control with an OLED display and a button.
-// Steps through the 7 available effects on the target device.
+// Steps through the presets listed in include/Effects.def on the target device.
 
 #include <Arduino.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
 #include <WiFi.h>
+#include <esp_sleep.h>
+#include <esp_idf_version.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <soc/gpio_struct.h>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
 #include "Bounce2.h"
 #include "heltec.h"  // Heltec library for OLED support
+#include "AckSession.h"
+#include "BatteryMonitor.h"
+#include "ChannelSurvey.h"
+#include "CpuScaler.h"
+#include "EffectManifest.h"
+#include "EnergyModel.h"
+#include "ESPNowProtocol.h"
+#include "HeapWatch.h"
+#include "HotPath.h"
+#include "LoopProfiler.h"
+#include "PathProfiler.h"
+#include "PeerManager.h"
+#include "PowerScheduler.h"
+#include "PrintFormat.h"
+#include "ProbeSession.h"
+#include "Redundancy.h"
+#include "SendOrder.h"
+#include "SerialConsole.h"
+#include "Sniffer.h"
+#include "StateReconciler.h"
+#include "StateStore.h"
+#include "TelemetryHistory.h"
+#include "TraceRecorder.h"
+#include "TxPowerControl.h"
+#include "TxBenchmark.h"
+#include "VehicleSignals.h"
 
-namespace 
-{
-    // Effect names that correspond to patterns available on the target NightDriverStrip.
-    // These must be kept in sync with the target device's effect list, as indices are used
-    // to trigger specific effects.
+// An update() that takes longer than this is counted as a stall. Override from build_flags.
+#ifndef LOOP_DEADLINE_MS
+#define LOOP_DEADLINE_MS 100
+#endif
 
-    struct LightEffect 
-    {
-        const char* name;
-        uint32_t    index;
-        uint8_t brightness;
-    };
+// Set to 1 to send state frames in the 6-byte layout that receivers built before sequence
+// numbers and groups require, until they are upgraded; the 'wire' command switches it at
+// run time. Those receivers reject the 9-byte frames sent otherwise.
+#ifndef LEGACY_WIRE_FORMAT
+#define LEGACY_WIRE_FORMAT 0
+#endif
 
-    constexpr std::array<LightEffect, 9> EFFECTS = 
-    {{
-        {"Bright White",   0, 255},    // Full brightness for white
-        {"Dim White",      0,  16},    // Full brightness for white
-        {"Bright Red",     1, 255},      // Slightly dimmer for red to prevent eye strain
-        {"Dim Red",        1,  32},      // Slightly dimmer for red to prevent eye strain
-        {"Solid Amber",    2, 255},    // Medium-high brightness for amber
-        {"Fire Effect",    3, 255},    // Medium brightness for dynamic fire effect
-        {"Rainbow Fill",   4, 255},   // Medium-high brightness for rainbow
-        {"Color Meteors",  5, 255},  // Bright enough to see meteor trails
-        {"Off",            6, 0}              // No brightness when off
-    }};
+namespace 
+{
+    // The effect cycle and the receiver's effect list both come from include/Effects.def,
+    // which the PLATECOVER build shares; see EffectManifest.h for the checks applied to it.
 
     // Broadcast MAC allows control of all NightDriverStrip instances in range.
     // This allows front and back license plate NightDriverStrips to be controlled
@@ -44,46 +70,158 @@ namespace
 
     constexpr std::array<uint8_t, 6> RECEIVER_MAC = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
-    // Command set for ESPNOW protocol. Values must match the receiver's expectations.
-    // Starting at 1 allows detection of uninitialized/corrupted commands.
-    // INVALID provides error detection in network protocol.
+    // Receivers can also be addressed one by one, from a roster managed with the 'peers'
+    // console command. The broadcast peer keeps one entry of the ESP-NOW peer table; the
+    // roster swaps its receivers through the rest.
+
+    constexpr size_t PEER_TABLE_SLOTS = ESP_NOW_MAX_TOTAL_PEER_NUM - 1;
 
-    enum class ESPNowCommand : uint8_t 
+    // Receiver groups the operator can address instead, picked with the 'group' console
+    // command and shown on the OLED. Each receiver's setGroups() mask says which of these
+    // bits it answers to. The all-off burst and manifest probes always go to every group.
+
+    struct TargetGroup
     {
-        NextEffect = 1,
-        PrevEffect,
-        SetEffect,
-        SetBrightness,
-        INVALID = 255
+        const char* name;
+        uint8_t     mask;
     };
 
-    // Network message format for ESPNOW communication.
-    // Packed to ensure consistent wire format between different compilers/platforms.
-    // Includes size field for protocol versioning and validation.
+    constexpr std::array<TargetGroup, 3> TARGET_GROUPS =
+    {{
+        { "All",   ALL_GROUPS },
+        { "Front", 0x01 },
+        { "Rear",  0x02 },
+    }};
 
-    class Message 
-    {
-    public:
-        constexpr Message(ESPNowCommand cmd, uint32_t argument) : size(sizeof(Message)), command(cmd), arg1(argument) 
-        {
-        }
+    // Loop health. After STALL_RECOVERY_THRESHOLD consecutive deadline overruns the subsystem
+    // that caused them is reinitialized; more than MAX_RECOVERIES within RECOVERY_WINDOW_MS
+    // reboots the board. The task watchdog is the backstop for a loop that never returns.
+    // The console's `deadline` command may move the deadline within the MIN/MAX bounds.
 
-        // Provides raw byte access for network transmission while maintaining type safety
-        const uint8_t* data() const 
-        {
-            return reinterpret_cast<const uint8_t*>(this);
-        }
+    constexpr uint32_t STALL_RECOVERY_THRESHOLD = 3;
+    constexpr uint32_t MAX_RECOVERIES           = 5;
+    constexpr uint32_t RECOVERY_WINDOW_MS       = 60 * 1000;
+    constexpr uint32_t TASK_WDT_TIMEOUT_S       = 5;
+    constexpr uint32_t MIN_LOOP_DEADLINE_MS     = 10;
+    constexpr uint32_t MAX_LOOP_DEADLINE_MS     = 2000;
 
-        constexpr size_t byte_size() const 
-        {
-            return sizeof(Message);
-        }
+    // The selected effect is written to flash only after it has been left alone this long,
+    // so stepping through several effects costs one flash write rather than one per press.
+    // Changes to the unicast roster are saved on the same terms.
+
+    constexpr uint32_t STATE_SETTLE_MS = 5000;
+
+    // Vehicle signal inputs, in VehicleSignal order, each behind an optocoupler that pulls
+    // the pin low while the lamp is lit; see VehicleSignals.h for the overrides they map
+    // to. The turn signal is held through the off half of its blink.
+
+    constexpr VehicleSignals::Inputs SIGNAL_INPUTS =
+    {{
+        { GPIO_NUM_NC,   0 },       // Brake, e.g. GPIO_NUM_25
+        { GPIO_NUM_NC, 700 },       // Turn, e.g. GPIO_NUM_26
+        { GPIO_NUM_NC,   0 },       // Reverse, e.g. GPIO_NUM_27
+    }};
+
+    // Power management. The OLED goes dark POWER_TIMEOUTS.displayMillis after the last input
+    // and the loop light-sleeps between polls from then on; after deepSleepMillis the board
+    // deep-sleeps until the button wakes it. Set deepSleepMillis to 0 to never deep sleep.
+    // Deep sleep would miss the vehicle signals, so a remote with them wired never does.
+
+    constexpr PowerTimeouts POWER_TIMEOUTS = { 30 * 1000, anySignalWired(SIGNAL_INPUTS) ? 0 : 10 * 60 * 1000, 400 };
+    constexpr uint32_t      AWAKE_POLL_MS  = 10;
+    constexpr uint32_t      ASLEEP_POLL_MS = 100;
+    constexpr gpio_num_t    BUTTON_PIN     = GPIO_NUM_0;    // The PRG button
+
+    // Battery sense on the WiFi Kit 32 V2: GPIO37 behind the 220k/100k divider. Calibrate
+    // BATTERY_DIVIDER against a meter if the reading is off.
+
+    constexpr uint8_t  BATTERY_ADC_PIN   = 37;
+    constexpr float    BATTERY_DIVIDER   = 3.2f;
+    constexpr uint32_t BATTERY_SAMPLE_MS = 5000;
+
+    // All-off fast path. Holding the button for ALL_OFF_HOLD_MS, or pulling ALL_OFF_PIN low
+    // if a dedicated switch is wired to one, blanks every plate. The first AllOff frame goes
+    // out ahead of everything else and ALL_OFF_REPEATS more follow ALL_OFF_SPACING_MS apart
+    // in case it was lost. ALL_OFF_PIN must be an RTC GPIO (e.g. GPIO_NUM_13) so it can
+    // also wake the remote from deep sleep.
+
+    constexpr uint32_t   ALL_OFF_HOLD_MS    = 1000;
+    constexpr gpio_num_t ALL_OFF_PIN        = GPIO_NUM_NC;
+    constexpr uint32_t   ALL_OFF_REPEATS    = 5;
+    constexpr uint32_t   ALL_OFF_SPACING_MS = 20;
 
-    private:
-        uint8_t       size;       // Protocol versioning and message validation
-        ESPNowCommand command;    // Operation to perform
-        uint32_t      arg1;       // Command-specific parameter (e.g., effect index)
-    } __attribute__((packed));    // Packed on both ends (send and receive) so they agree on the size
+    // Redundant broadcast. Effect and brightness frames go out several times under one
+    // sequence number (see Redundancy.h). While the display is on, the manifest query is
+    // repeated every LINK_PROBE_MS to measure loss, counting replies that arrive within
+    // PROBE_REPLY_MS; Adaptive mode picks the number of copies from that.
+
+    constexpr RedundancyMode REDUNDANCY_MODE = RedundancyMode::Adaptive;
+    constexpr uint32_t       FIXED_COPIES    = 2;
+    constexpr uint32_t       LINK_PROBE_MS   = 60 * 1000;
+    constexpr uint32_t       PROBE_REPLY_MS  = 300;
+
+    // Acknowledged delivery, switched with the 'acks' console command. Instead of blind
+    // repeats, each press is followed by an AckRequest, and receivers that stay silent get
+    // the frames again (see AckSession.h). Receivers need ack ids 0 to ACK_FLEET_SIZE - 1,
+    // and every one is expected to answer, so address the All group while it is on.
+
+    constexpr bool   ACK_CONFIRM    = false;
+    constexpr size_t ACK_FLEET_SIZE = 2;
+
+    // State reconciliation. STATE_QUERY_DELAY_MS after a change, once its repeats have gone
+    // out, receivers are asked with GetState what they are showing, and the replies that
+    // arrive within STATE_REPLY_MS are checked one receiver at a time (see StateReconciler.h).
+    // Receivers showing something else are flagged on the OLED and sent the state again by
+    // unicast, up to MAX_STATE_RESENDS times per change.
+
+    constexpr uint32_t STATE_QUERY_DELAY_MS = MAX_COPIES * MAX_GAP_MS;
+    constexpr uint32_t STATE_REPLY_MS       = 300;
+    constexpr uint32_t MAX_STATE_RESENDS    = 3;
+
+    // Receiver telemetry. Every receiver is asked for its frame rate, free heap, temperature
+    // and power draw, at an interval between TELEMETRY_MIN_MS and TELEMETRY_MAX_MS that
+    // lengthens while the readings hold steady (see TelemetryHistory.h). Replies arriving
+    // within TELEMETRY_REPLY_MS count.
+
+    constexpr uint32_t TELEMETRY_REPLY_MS = 300;
+
+    // Transmit benchmark (see TxBenchmark.h), run by the 'bench' console command or by
+    // pressing the button right after a reset and holding it for BENCH_HOLD_MS. Holding it
+    // through the reset itself would start the bootloader instead.
+
+    constexpr uint32_t BENCH_HOLD_MS = 2000;
+
+    // Loss test, started with the 'probe' console command (see ProbeSession.h). A timer
+    // sends the numbered stream at the requested rate, so the loop's poll interval doesn't
+    // bunch it up. PROBE_SETTLE_MS after the last frame, receivers are asked for their
+    // reports PROBE_REPORT_REQUESTS times, PROBE_REPORT_SPACING_MS apart, in case a
+    // request or a reply is lost; replies count until PROBE_REPORT_WAIT_MS after the last one.
+
+    constexpr uint32_t PROBE_DEFAULT_FRAMES    = 500;
+    constexpr uint32_t PROBE_DEFAULT_RATE      = 100;
+    constexpr uint32_t PROBE_MAX_RATE          = 1000;
+    constexpr uint32_t PROBE_SETTLE_MS         = 100;
+    constexpr uint32_t PROBE_REPORT_REQUESTS   = 3;
+    constexpr uint32_t PROBE_REPORT_SPACING_MS = 100;
+    constexpr uint32_t PROBE_REPORT_WAIT_MS    = 300;
+
+    // The console's rate, as Heltec.begin() opens the port; a capture with the 'sniff'
+    // command switches it to SNIFFER_BAUD until the capture stops
+
+    constexpr uint32_t CONSOLE_BAUD = 115200;
+
+    // Channel migration, with the 'channel' console command. A move is announced with
+    // CHANNEL_SWITCH_REPEATS ChannelSwitch frames CHANNEL_SWITCH_SPACING_MS apart on the old
+    // channel, one sequence number for all, and the remote follows a spacing after the last.
+    // 'channel auto' moves only if the current channel is busier than the quietest by
+    // CHANNEL_MARGIN_PERMILLE of airtime, so a survey's noise doesn't bounce it around.
+
+    constexpr uint32_t CHANNEL_SWITCH_REPEATS    = 5;
+    constexpr uint32_t CHANNEL_SWITCH_SPACING_MS = 20;
+    constexpr uint16_t CHANNEL_MARGIN_PERMILLE   = 50;
+
+    constexpr size_t OFF_PRESET = findPreset(PlateEffect::Off);
+    static_assert(OFF_PRESET < EFFECTS.size(), "Effects.def needs a REMOTE_PRESET for PlateEffect::Off");
 
     // Main controller class implementing the remote functionality.
 
@@ -103,21 +241,197 @@ namespace
         // Returns false if any stage fails, preventing partial initialization.
         bool initialize() 
         {
-            return initializeDisplay() && initializeButton() && initializeWiFi() && initializeESPNow() && addPeer();
+            return initializePower() && initializeDisplay() && initializeButton() && initializeWiFi()
+                && initializeESPNow() && addPeer() && initializeProbeTimer() && initializePeers() && initializeSignals() && sniffer.begin(Serial) && initializeStateStore() && initializeConsole()
+                && initializeCpuScaling() && initializeWatchdog();
+        }
+
+        // Runs the transmit benchmark if the button was pressed as the remote came up from a
+        // reset, rather than to wake it from deep sleep, and is held for BENCH_HOLD_MS
+
+        void benchmarkIfHeld()
+        {
+            if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED)
+                return;
+
+            uint32_t start = millis();
+            while (digitalRead(BUTTON_PIN) == LOW)
+            {
+                if (millis() - start >= BENCH_HOLD_MS)
+                {
+                    runBenchmark(Serial);
+                    return;
+                }
+                delay(10);
+            }
+        }
+
+        // Waits out the rest of the loop iteration, sleeping if the remote is idle. Light
+        // sleep would miss the replies to a query still open and the frames a capture is
+        // after, and would stretch the spacing of a channel switch's repeats.
+
+        void idle()
+        {
+            bool listening = acks.busy() || reconciler.isOpen() || telemetryOpen || probeStreaming || probeCollecting ||
+                             sniffer.isRunning() || channelSwitchTo != 0;
+            power.idle(AWAKE_POLL_MS, ASLEEP_POLL_MS, signals.isActive() || listening);
+        }
+
+        // Full clock while any frame is still to go out
+        void serviceCpuClock()
+        {
+            bool busy = !repeats.empty() || acks.busy() || allOffRemaining != 0 || channelSwitchTo != 0;
+            cpu.poll(busy, energy.timeIn(PowerState::LightSleep));
+        }
+
+        // Restores the effect and brightness persisted before the last power cycle and sends
+        // both, so receivers come back exactly as they were left
+
+        void restoreState()
+        {
+            RemoteState state;
+            if (!stateStore.load(state) || state.effect >= EFFECTS.size())
+                state = {0, EFFECTS[0].brightness, 0, 0};
+
+            // Back on the channel the receivers were moved to, even for an all-off wake,
+            // which has to reach them there and persists the channel and group again
+            if (state.channel >= 1 && state.channel <= MAX_WIFI_CHANNEL)
+                esp_wifi_set_channel(state.channel, WIFI_SECOND_CHAN_NONE);
+            savedChannel = state.channel;
+
+            selectGroup(state.group < TARGET_GROUPS.size() ? state.group : 0);
+
+            // Woken from deep sleep by the all-off switch: don't relight anything first
+            if (power.wokeByAuxPin())
+            {
+                allOff(esp_timer_get_time());
+                return;
+            }
+
+            currentEffect = state.effect;
+            signals.setBase(EFFECTS[currentEffect].index, state.brightness);
+            if (!signals.isOverriding())
+            {
+                setEffect(currentEffect);
+                setBrightness(state.brightness);
+            }
+            updateDisplay();
+            scheduleStateQuery();
         }
 
         // Main update loop - polls button and sends commands when pressed.
         // Cycles through effects in reverse order due to physical button placement.
         void update() 
         {
-            button.update();
-            if (button.pressed()) 
+            HeapWatchScope heapScope;  // No heap allocations allowed past this point
+            TraceSpan      span(tracer, "update", TraceThread::Loop, true);
+
+            profiler.beginIteration();
+            esp_task_wdt_reset();
+
+            serviceAllOff();  // Ahead of everything else
+            serviceCpuClock();
+            serviceChannelSwitch();
+            collectSignalFrames();  // First, so stale repeats of an override are cancelled
+            serviceRepeats();
+            serviceAcks();
+            checkTxPower();
+            servicePeers();
+
+            // A short press acts on release and a hold on reaching ALL_OFF_HOLD_MS, so holding
+            // for all-off never sends the next effect first
+            bool shortPress = false;
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Input);
+                button.update();
+
+                if (button.pressed())
+                {
+                    pressSeen        = true;
+                    buttonEdgeMicros = 0;   // Any earlier release was a bounce Bounce2 filtered
+                    if (power.noteActivity())
+                        Heltec.display->displayOn();
+                }
+
+                if (button.isPressed() && !holdHandled && button.currentDuration() >= ALL_OFF_HOLD_MS)
+                {
+                    holdHandled = true;
+                    allOff(esp_timer_get_time());
+                }
+                else if (button.released())
+                {
+                    // The press that woke the remote from deep sleep came before Bounce2
+                    // was watching, and only wakes it
+                    shortPress = pressSeen && !holdHandled;
+                    if (!shortPress)
+                        buttonEdgeMicros = 0;   // Nothing is sent for this release
+                    holdHandled = false;
+                    pressSeen   = false;
+                }
+
+                if (battery.poll() && energy.currentState() == PowerState::DisplayOn)
+                    updateDisplay();
+            }
+
+            if (shortPress)
             {
+                // While a vehicle signal overrides the plates the new effect is only
+                // remembered, and goes out when the signal clears
+                showTelemetry = false;
                 currentEffect = (currentEffect + 1) % EFFECTS.size();
-                setEffect(currentEffect);
-                setBrightness(EFFECTS[currentEffect].brightness);
+                signals.setBase(EFFECTS[currentEffect].index, EFFECTS[currentEffect].brightness);
+                if (!signals.isOverriding())
+                {
+                    setEffect(currentEffect);
+                    setBrightness(EFFECTS[currentEffect].brightness);
+                }
                 updateDisplay();  // Update display when effect changes
+                stageState();
+            }
+
+            checkManifestReplies();
+            checkReceiverStates();
+            checkTelemetry();
+            checkProbe();
+            checkLinkProbe();
+            reportSendStatus();
+
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Persist);
+                stateStore.poll();
+                peers.poll();
+            }
+
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Console);
+                if (Serial.available() > 0)
+                    cpu.boost();
+                if (Serial.available() > 0 && power.noteActivity())
+                {
+                    Heltec.display->displayOn();
+                    updateDisplay();
+                }
+                console.poll(Serial, Serial);
+            }
+
+            switch (power.update())
+            {
+                case PowerScheduler::Action::DisplayOff:
+                    Heltec.display->displayOff();
+                    break;
+
+                case PowerScheduler::Action::DeepSleep:
+                    if (!sniffer.isRunning())   // A capture left running is still wanted
+                        enterDeepSleep();
+                    break;
+
+                default:
+                    break;
             }
+
+            LoopStage culprit;
+            if (profiler.endIteration(culprit) && profiler.consecutiveMisses() >= STALL_RECOVERY_THRESHOLD)
+                recoverFromStall(culprit);
         }
 
         // setBrightness
@@ -126,12 +440,11 @@ namespace
 
         bool setBrightness(uint8_t brightness)
         {
-            Message msg{ESPNowCommand::SetBrightness, brightness};
-            auto result = esp_now_send(RECEIVER_MAC.data(), 
-                                    msg.data(), 
-                                    msg.byte_size());
+            TraceSpan span(tracer, "setBrightness");
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
 
-            if (result == ESP_OK) {
+            if (sendRedundant(ESPNowCommand::SetBrightness, brightness))
+            {
                 Serial.print(F("Set brightness to: "));
                 Serial.println(brightness);
                 return true;
@@ -151,12 +464,10 @@ namespace
                 return false;
             }
 
-            Message msg{ESPNowCommand::SetEffect, EFFECTS[effect].index};
-            auto result = esp_now_send(RECEIVER_MAC.data(), 
-                                    msg.data(), 
-                                    msg.byte_size());
+            TraceSpan span(tracer, "setEffect");
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
 
-            if (result == ESP_OK) 
+            if (sendRedundant(ESPNowCommand::SetEffect, EFFECTS[effect].index))
             {
                 Serial.print(F("Set effect to: "));
                 Serial.println(EFFECTS[effect].name);
@@ -167,105 +478,1973 @@ namespace
             return false;
         }
 
-     private:
-        // Initialize the OLED display
-        bool initializeDisplay() 
+        // Blanks every plate. 'startMicros' is when the request was made, from which the
+        // time to dark is measured. Display and persistence are dealt with only once the
+        // first frame is out.
+
+        void allOff(int64_t startMicros)
         {
-            Heltec.begin(true /*DisplayEnable Enable*/, false /*LoRa Disable*/, true /*Serial Enable*/);
-            Heltec.display->setFont(ArialMT_Plain_16);  // Set a readable font size
-            updateDisplay();  // Show initial display
-            return true;
+            {
+                TraceSpan span(tracer, "allOff");
+                LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+
+                if (++allOffBurst == 0)
+                    allOffBurst++;
+                repeats.clear();  // A late copy of an effect change would relight the plates
+                allOffAwaitingSince = startMicros;
+                sendMessage({ESPNowCommand::AllOff, allOffBurst}, true);
+            }
+
+            allOffRemaining  = ALL_OFF_REPEATS;
+            allOffNextMillis = millis() + ALL_OFF_SPACING_MS;
+            allOffCount++;
+
+            Serial.println(F("All off"));
+            if (power.noteActivity())
+                Heltec.display->displayOn();
+            currentEffect = OFF_PRESET;
+            signals.setBase(EFFECTS[currentEffect].index, EFFECTS[currentEffect].brightness);
+            updateDisplay();
+            stageState();
         }
 
-        // Update the OLED display with current effect information
+        // Makes 'group' (an index into TARGET_GROUPS) the one that effect changes go to
 
-        void updateDisplay() 
+        void selectGroup(size_t group)
         {
-            // This code assumes the default screen size of 128x64 pixels
+            activeGroup = group;
+            signals.setGroups(TARGET_GROUPS[group].mask);
+        }
 
-            assert(Heltec.display->width() == 128 && Heltec.display->height() == 64);
+        void stageState()
+        {
+            stateStore.stage({currentEffect, EFFECTS[currentEffect].brightness, uint8_t(activeGroup), savedChannel});
+            reconciling = true;
+            scheduleStateQuery();
+        }
 
-            Heltec.display->clear();
-            
-            // Display effect index
-            Heltec.display->setFont(ArialMT_Plain_10);
-            Heltec.display->setTextAlignment(TEXT_ALIGN_CENTER);
+        // Asks receivers for their state once the repeats of a change have gone out.
+        // 'changed' is false after a resend, so the resend counts carry on.
 
-            char indexStr[30];
-            snprintf(indexStr, sizeof(indexStr), "Effect: %d/%d", currentEffect + 1, EFFECTS.size());
-            Heltec.display->drawString(64, 0, indexStr);
-            
-            // Display effect name
-            Heltec.display->setFont(ArialMT_Plain_16);
-            Heltec.display->setTextAlignment(TEXT_ALIGN_CENTER);
-            Heltec.display->drawString(64, 20, EFFECTS[currentEffect].name);
-            
-            // Draw a progress bar
-            int progressWidth = (currentEffect * 128) / (EFFECTS.size() - 1);
-            Heltec.display->drawProgressBar(0, 50, 128, 10, (progressWidth * 100) / 128);
-            
-            Heltec.display->display();
+        void scheduleStateQuery(bool changed = true)
+        {
+            stateQueryDue       = true;
+            stateQueryChanged  |= changed;
+            stateQueryAtMillis  = millis() + STATE_QUERY_DELAY_MS;
         }
 
-        // Configures button with internal pull-up and debouncing
+        // Drains the replies the receive callback queued, closes a query whose replies have
+        // had time to arrive, and sends the next one when due
 
-        bool initializeButton() 
+        void checkReceiverStates()
         {
-            button.attach(0, INPUT_PULLUP);
-            button.interval(1);
-            button.setPressedState(LOW);
-            return true;
+            StateReport report;
+            for (;;)
+            {
+                portENTER_CRITICAL(&stateReplyLock);
+                bool received = stateReplies.pop(report);
+                portEXIT_CRITICAL(&stateReplyLock);
+                if (!received)
+                    break;
+                reconciler.onReply(report);
+            }
+
+            if (reconciler.isOpen() && millis() - stateQuerySentMillis >= STATE_REPLY_MS)
+            {
+                size_t mismatches = reconciler.closeQuery();
+                if (mismatches != 0)
+                    resendMismatched();
+
+                // A query to one group only hears from part of the fleet
+                if (TARGET_GROUPS[activeGroup].mask == ALL_GROUPS)
+                {
+                    uint32_t answered = 0;
+                    for (const StateReconciler::Receiver& receiver : reconciler.receivers())
+                        answered += receiver.answered;
+                    countBroadcastReplies(answered);
+                }
+
+                if (mismatches != flaggedReceivers)
+                {
+                    flaggedReceivers = mismatches;
+                    if (energy.currentState() == PowerState::DisplayOn)
+                        updateDisplay();
+                }
+            }
+
+            if (stateQueryDue && !reconciler.isOpen() && int32_t(millis() - stateQueryAtMillis) >= 0)
+                queryStates();
         }
 
-        // Sets up WiFi in station mode without connecting to any network
+        // Skipped while the plates show something other than the selected effect on purpose:
+        // a vehicle signal override, or per-receiver states from the 'states' command
 
-        bool initializeWiFi() 
+        void queryStates()
         {
-            WiFi.mode(WIFI_STA);
-            return true;
+            stateQueryDue = false;
+            if (!reconciling || signals.isOverriding())
+                return;
+
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+            Message query{ESPNowCommand::GetState, 0, sequences.take(), TARGET_GROUPS[activeGroup].mask};
+            reconciler.beginQuery(query.getSequence(), uint8_t(EFFECTS[currentEffect].index),
+                                  EFFECTS[currentEffect].brightness, stateQueryChanged);
+            stateQueryChanged    = false;
+            stateQuerySentMillis = millis();
+            sendMessage(query);
         }
 
-        // ESPNOW transmission status callback
-        // Used for debugging and could be extended for retry logic
-        static void onSendCallback(const uint8_t* macAddr, esp_now_send_status_t status) 
+        // Sends the selected state straight to each receiver that reported another, then
+        // checks again
+
+        void resendMismatched()
+        {
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+            uint8_t groups = TARGET_GROUPS[activeGroup].mask;
+            Message effect{ESPNowCommand::SetEffect, EFFECTS[currentEffect].index, sequences.take(), groups};
+            Message brightness{ESPNowCommand::SetBrightness, EFFECTS[currentEffect].brightness, sequences.take(), groups};
+
+            bool resent = false;
+            for (StateReconciler::Receiver& receiver : reconciler.receivers())
+            {
+                if (!receiver.answered || receiver.matches || receiver.resends >= MAX_STATE_RESENDS)
+                    continue;
+
+                receiver.resends++;
+                stateResends++;
+                energy.addTransmit(peers.sendTo(receiver.mac, effect.data(), effect.byte_size()) +
+                                   peers.sendTo(receiver.mac, brightness.data(), brightness.byte_size()));
+                resent = true;
+            }
+
+            if (resent)
+                scheduleStateQuery(false);
+        }
+
+        // Files the replies the receive callback queued, closes a poll whose replies have had
+        // time to arrive, and polls again when the adaptive interval is up
+
+        void checkTelemetry()
         {
-            Serial.print(F("Send status: "));
-            Serial.println(status == ESP_NOW_SEND_SUCCESS ? F("Success") : F("Fail"));
+            TelemetryReply reply;
+            for (;;)
+            {
+                portENTER_CRITICAL(&telemetryLock);
+                bool received = telemetryReplies.pop(reply);
+                portEXIT_CRITICAL(&telemetryLock);
+                if (!received)
+                    break;
+
+                if (telemetryOpen && reply.sequence == telemetrySequence &&
+                    !telemetry.record(reply.mac, {telemetryPolledMillis / 1000, reply.readings}))
+                    telemetryUnfiled++;
+            }
+
+            if (telemetryOpen && millis() - telemetryPolledMillis >= TELEMETRY_REPLY_MS)
+            {
+                telemetryOpen = false;
+                telemetry.pollFinished();
+                if (showTelemetry && energy.currentState() == PowerState::DisplayOn)
+                    updateDisplay();
+            }
+
+            if (!telemetryOpen && millis() - telemetryPolledMillis >= telemetry.pollInterval())
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+                telemetrySequence     = sequences.take();
+                telemetryPolledMillis = millis();
+                telemetryOpen         = true;
+                sendMessage({ESPNowCommand::GetTelemetry, 0, telemetrySequence});
+            }
         }
 
-        // Initializes ESPNOW protocol and registers callback
+        // Starts a probe stream of 'frames' frames, 'length' bytes each, at 'rate' per
+        // second; false if one is already under way or an argument is out of range
 
-        bool initializeESPNow() 
+        bool startProbe(uint32_t frames, uint32_t rate, size_t length)
         {
-            if (esp_now_init() != ESP_OK) {
-                Serial.println(F("Error initializing ESP-NOW"));
+            if (probeStreaming || probeCollecting || frames == 0 || frames > MAX_PROBE_FRAMES || rate == 0 ||
+                rate > PROBE_MAX_RATE || length < PROBE_HEADER_SIZE || length > MAX_PROBE_FRAME_SIZE)
                 return false;
-            }
 
-            esp_now_register_send_cb(onSendCallback);
+            probeStream.begin(sequences.take(), uint16_t(frames));
+            probeLength = length;
+            probeRate   = rate;
+            probeNext.store(0, std::memory_order_relaxed);
+            probeRejected.store(0, std::memory_order_relaxed);
+            probeSendFailures.store(0, std::memory_order_relaxed);
+            probeStartMicros = esp_timer_get_time();
+            probeStreaming   = true;
+            esp_timer_start_periodic(probeTimer, 1000000 / rate);
             return true;
         }
 
-        // Registers the target device(s) as ESPNOW peer(s)
-        
-        bool addPeer() 
+        // Runs on the esp_timer task, one frame per tick
+        static void onProbeTimer(void* context)
         {
-            esp_now_peer_info_t peerInfo = {};
-            std::copy(RECEIVER_MAC.begin(), RECEIVER_MAC.end(), peerInfo.peer_addr);
-            peerInfo.channel = 0;        // Auto channel selection
-            peerInfo.encrypt = false;    // No encryption for broadcast support
-            peerInfo.ifidx = WIFI_IF_STA;
+            auto& self = *static_cast<NightDriverRemote*>(context);
+            uint16_t index = self.probeNext.load(std::memory_order_relaxed);
+            if (index >= self.probeStream.frameCount())
+                return;
 
-            if (esp_now_add_peer(&peerInfo) != ESP_OK) 
+            ProbeFrame probe{self.probeStream.streamId(), index, self.probeStream.frameCount()};
+            std::array<uint8_t, MAX_PROBE_FRAME_SIZE> bytes;
+            size_t length = encodeProbe(probe, self.probeLength, bytes);
+            if (SendOrder::send(RECEIVER_MAC.data(), bytes.data(), length) == 0)
+                self.probeRejected.fetch_add(1, std::memory_order_relaxed);
+
+            if (index + 1 == self.probeStream.frameCount())
+                self.probeEndMicros.store(esp_timer_get_time(), std::memory_order_relaxed);
+            self.probeNext.store(uint16_t(index + 1), std::memory_order_release);
+        }
+
+        // Stops the timer once the stream is out, asks for the reports and files them
+
+        void checkProbe()
+        {
+            if (probeStreaming && probeNext.load(std::memory_order_acquire) >= probeStream.frameCount())
             {
-                Serial.println(F("Failed to add peer"));
-                return false;
+                esp_timer_stop(probeTimer);
+                energy.addTransmit(probeStream.frameCount());
+                probeStreaming         = false;
+                probeCollecting        = true;
+                probeRequestsLeft      = PROBE_REPORT_REQUESTS;
+                probeNextRequestMillis = millis() + PROBE_SETTLE_MS;
             }
-            return true;
+
+            ProbeReply reply;
+            for (;;)
+            {
+                portENTER_CRITICAL(&probeLock);
+                bool received = probeReplies.pop(reply);
+                portEXIT_CRITICAL(&probeLock);
+                if (!received)
+                    break;
+                probeStream.onReport(reply.mac, reply.report);
+            }
+
+            if (!probeCollecting || int32_t(millis() - probeNextRequestMillis) < 0)
+                return;
+
+            if (probeRequestsLeft == 0)
+            {
+                probeCollecting = false;
+                printFormat(Serial, "Probe stream done, %u receivers reported; 'probe' shows the results\n",
+                            unsigned(probeStream.receivers().size()));
+                return;
+            }
+
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+            sendMessage({ESPNowCommand::GetProbeReport, probeStream.streamId()});
+            probeNextRequestMillis += --probeRequestsLeft ? PROBE_REPORT_SPACING_MS : PROBE_REPORT_WAIT_MS;
         }
 
-        Bounce2::Button button;      // Hardware button with debouncing
-        uint32_t currentEffect = 0;  // Current effect index in EFFECT_NAMES array
+        void reportProbe(Print& out) const
+        {
+            if (probeStream.frameCount() == 0)
+            {
+                out.println(F("No probe stream sent yet"));
+                return;
+            }
+
+            uint32_t sent    = probeNext.load(std::memory_order_acquire);
+            int64_t  elapsed = probeEndMicros.load(std::memory_order_relaxed) - probeStartMicros;
+            printFormat(out, "Stream %04x%s: %u of %u frames of %u bytes at %u/s", unsigned(probeStream.streamId()),
+                        probeStreaming ? " (sending)" : probeCollecting ? " (collecting)" : "", unsigned(sent),
+                        unsigned(probeStream.frameCount()), unsigned(probeLength), unsigned(probeRate));
+            if (!probeStreaming && elapsed > 0)
+                printFormat(out, " (%.1f/s achieved)", sent > 1 ? (sent - 1) * 1e6f / float(elapsed) : 0.0f);
+            printFormat(out, ", %u refused by the driver, %u failed on air\n", unsigned(probeRejected.load()),
+                        unsigned(probeSendFailures.load()));
+
+            static constexpr const char* BURST_NAMES[PROBE_BURST_BUCKETS] =
+                { "1", "2", "3-4", "5-8", "9-16", "17-32", "33+" };
+            for (const ProbeSession::Receiver& receiver : probeStream.receivers())
+            {
+                printFormat(out, "%02x:%02x:%02x:%02x:%02x:%02x  %u received, %u lost (%.2f%%), %u late (up to %u back), "
+                            "%u duplicates\n",
+                            receiver.mac[0], receiver.mac[1], receiver.mac[2], receiver.mac[3], receiver.mac[4],
+                            receiver.mac[5], unsigned(receiver.received), unsigned(receiver.lost),
+                            100.0f * receiver.lost / probeStream.frameCount(), unsigned(receiver.late),
+                            unsigned(receiver.maxDisplacement), unsigned(receiver.duplicates));
+                out.print(F("  loss bursts"));
+                for (size_t bucket = 0; bucket < PROBE_BURST_BUCKETS; bucket++)
+                    printFormat(out, " %s:%u", BURST_NAMES[bucket], unsigned(receiver.bursts[bucket]));
+                printFormat(out, ", longest %u\n", unsigned(receiver.longestBurst));
+            }
+            if (probeStream.overflowCount() != 0)
+                printFormat(out, "%u more receivers reported than fit the table\n", unsigned(probeStream.overflowCount()));
+        }
+
+        // One line per receiver: the last two bytes of its MAC and its latest readings
+
+        void drawTelemetry()
+        {
+            Heltec.display->setFont(ArialMT_Plain_10);
+            Heltec.display->setTextAlignment(TEXT_ALIGN_LEFT);
+            Heltec.display->drawString(0, 0, "Plate   fps     C      W   heap");
+
+            int y = 12;
+            for (const TelemetryStore::Receiver& receiver : telemetry.all())
+            {
+                const ReceiverTelemetry& readings = receiver.history.latest().readings;
+                char line[40];
+                snprintf(line, sizeof(line), "%02x%02x %5.1f %5.1f %5.1f %4uk", receiver.mac[4], receiver.mac[5],
+                         readings.fpsTenths / 10.0f, readings.temperatureTenths / 10.0f,
+                         readings.powerMilliwatts / 1000.0f, unsigned(readings.freeHeap / 1024));
+                Heltec.display->drawString(0, y, line);
+                y += 12;
+            }
+
+            if (telemetry.all().empty())
+                Heltec.display->drawString(0, y, "No replies yet");
+        }
+
+        void reportTelemetry(Print& out) const
+        {
+            printFormat(out, "Polling every %u s; %u replies not filed, the table being full\n",
+                        unsigned(telemetry.pollInterval() / 1000), unsigned(telemetryUnfiled));
+
+            for (const TelemetryStore::Receiver& receiver : telemetry.all())
+            {
+                const TelemetryHistory&  history  = receiver.history;
+                const ReceiverTelemetry& readings = history.latest().readings;
+                printFormat(out, "%02x:%02x:%02x:%02x:%02x:%02x  %.1f fps, %u bytes free, %.1f C, %u mW\n",
+                            receiver.mac[0], receiver.mac[1], receiver.mac[2], receiver.mac[3], receiver.mac[4],
+                            receiver.mac[5], readings.fpsTenths / 10.0f, unsigned(readings.freeHeap),
+                            readings.temperatureTenths / 10.0f, unsigned(readings.powerMilliwatts));
+                printFormat(out, "  %u samples over %u s in %u bytes (%u uncompressed)\n", unsigned(history.size()),
+                            unsigned(history.latest().seconds - firstSampleSeconds(history)),
+                            unsigned(history.bytesUsed()), unsigned(history.rawBytes()));
+            }
+        }
+
+        static uint32_t firstSampleSeconds(const TelemetryHistory& history)
+        {
+            uint32_t first = history.latest().seconds;
+            bool     found = false;
+            history.forEach([&](const TelemetrySample& sample)
+            {
+                if (!found)
+                    first = sample.seconds;
+                found = true;
+            });
+            return first;
+        }
+
+        // Binary dump: "NDTM", a format version byte and the receiver count, then for each
+        // receiver its MAC, a 16-bit sample count and 14 bytes per sample, oldest first:
+        // seconds since boot (32 bits), fps in tenths (16), free heap (32), temperature in
+        // tenths of a degree (signed 16) and power in mW (16). Everything is little-endian.
+
+        void dumpTelemetry(Print& out) const
+        {
+            auto put = [&out](uint32_t value, size_t bytes)
+            {
+                for (size_t i = 0; i < bytes; i++)
+                    out.write(uint8_t(value >> (i * 8)));
+            };
+
+            out.write(reinterpret_cast<const uint8_t*>("NDTM"), 4);
+            put(1, 1);
+            put(uint32_t(telemetry.all().size()), 1);
+
+            for (const TelemetryStore::Receiver& receiver : telemetry.all())
+            {
+                out.write(receiver.mac.data(), receiver.mac.size());
+                put(uint32_t(receiver.history.size()), 2);
+                receiver.history.forEach([&put](const TelemetrySample& sample)
+                {
+                    put(sample.seconds, 4);
+                    put(sample.readings.fpsTenths, 2);
+                    put(sample.readings.freeHeap, 4);
+                    put(uint16_t(sample.readings.temperatureTenths), 2);
+                    put(sample.readings.powerMilliwatts, 2);
+                });
+            }
+        }
+
+        void reportReceiverStates(Print& out) const
+        {
+            printFormat(out, "Expecting %s at %u; %u queries, %u resends\n",
+                        PLATE_EFFECT_NAMES[reconciler.expectedEffect() % PLATE_EFFECT_NAMES.size()],
+                        unsigned(reconciler.expectedBrightness()), unsigned(reconciler.queryCount()),
+                        unsigned(stateResends));
+            if (!reconciling)
+                out.println(F("Not checking: receivers were given their own states"));
+
+            for (const StateReconciler::Receiver& receiver : reconciler.receivers())
+            {
+                const char* status = !receiver.answered ? "silent" : receiver.matches ? "ok" : "differs";
+                const char* effect = receiver.effect < PLATE_EFFECT_NAMES.size() ? PLATE_EFFECT_NAMES[receiver.effect] : "?";
+                printFormat(out, "  %02x:%02x:%02x:%02x:%02x:%02x  %-12s %3u  %-7s %u resends\n", receiver.mac[0],
+                            receiver.mac[1], receiver.mac[2], receiver.mac[3], receiver.mac[4], receiver.mac[5], effect,
+                            unsigned(receiver.brightness), status, unsigned(receiver.resends));
+            }
+        }
+
+        // Sends each receiver slot listed in 'states' its own effect and brightness in one
+        // broadcast, repeated like any other state frame
+
+        bool setStates(const StatesFrame& states)
+        {
+            TraceSpan span(tracer, "setStates");
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+
+            std::array<uint8_t, MAX_STATES_FRAME_SIZE> bytes;
+            size_t length = encodeStates(states, bytes);
+            repeats.schedule(states, copiesPerFrame(), millis(), esp_random());
+            trackForAcks(RepeatScheduler::Frame::from(states), states.getSequence());
+            return sendFrame(bytes.data(), length);
+        }
+
+        // Asks every receiver in range for the hash of the manifest it was built with.
+        // Replies are tallied by onReceiveCallback and surfaced by checkManifestReplies().
+
+        bool requestManifestHash()
+        {
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+
+            probeSentMillis     = millis();
+            probeRepliesAtStart = manifestMatches.load() + manifestMismatches.load();
+            probeOpen           = true;
+            return sendMessage({ESPNowCommand::GetManifestHash, MANIFEST_HASH, sequences.take()});
+        }
+
+     private:
+        // Sends the first copy of a state frame now and leaves the rest to serviceRepeats()
+
+        bool sendRedundant(ESPNowCommand command, uint32_t argument)
+        {
+            Message msg{command, argument, sequences.take(), TARGET_GROUPS[activeGroup].mask};
+            txPower.noteCommand();
+            repeats.schedule(msg, copiesPerFrame(), millis(), esp_random());
+            trackForAcks(RepeatScheduler::Frame::from(msg), msg.getSequence());
+            return sendMessage(msg);
+        }
+
+        // With acks on, a frame just sent joins the transaction serviceAcks() confirms
+
+        void trackForAcks(const RepeatScheduler::Frame& frame, uint16_t sequence)
+        {
+            if (ackConfirm && !legacyWire)
+                acks.track(frame, sequence, uint32_t(esp_timer_get_time()));
+        }
+
+        // Sends the AckRequest for the frames tracked this iteration, and when a round
+        // closes with receivers still silent, the frames again and a narrower request
+
+        void serviceAcks()
+        {
+            AckSession::Action action = acks.poll(uint32_t(esp_timer_get_time()));
+            if (action == AckSession::Action::None)
+                return;
+
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+            if (action == AckSession::Action::Resend)
+                resendUnconfirmed();
+
+            AckRequestFrame request;
+            acks.makeRequest(request, ALL_GROUPS, uint32_t(esp_timer_get_time()));
+
+            std::array<uint8_t, MAX_ACK_REQUEST_SIZE> bytes;
+            sendFrame(bytes.data(), encodeAckRequest(request, bytes));
+        }
+
+        // Unicasts to silent receivers that have replied before, since those sends are
+        // ACKed and retried by the MAC; one broadcast covers any that never have
+
+        void resendUnconfirmed()
+        {
+            uint64_t missing         = acks.missing();
+            bool     broadcastNeeded = false;
+            for (uint8_t id = 0; id < MAX_ACK_IDS; id++)
+            {
+                if ((missing >> id & 1) == 0)
+                    continue;
+
+                const uint8_t* mac = acks.macOf(id);
+                if (!mac)
+                {
+                    broadcastNeeded = true;
+                    continue;
+                }
+
+                MacAddress peer;
+                std::copy(mac, mac + peer.size(), peer.begin());
+                for (const RepeatScheduler::Frame& frame : acks.pendingFrames())
+                {
+                    bool sent = peers.sendTo(peer, frame.bytes.data(), frame.length);
+                    energy.addTransmit(sent);
+                    ackUnicasts += sent;
+                }
+            }
+
+            if (broadcastNeeded)
+            {
+                for (const RepeatScheduler::Frame& frame : acks.pendingFrames())
+                    sendFrame(frame.bytes.data(), frame.length);
+                ackBroadcasts++;
+            }
+        }
+
+        void reportAcks(Print& out) const
+        {
+            printFormat(out, "Acks %s, fleet of %u, %u us reply slots\n", ackConfirm ? "on" : "off",
+                        unsigned(acks.fleetSize()), unsigned(ACK_SLOT_US));
+            printFormat(out, "%u transactions: %u confirmed, %u gave up, %u replaced by newer frames\n",
+                        unsigned(acks.transactionCount()), unsigned(acks.confirmedCount()),
+                        unsigned(acks.gaveUpCount()), unsigned(acks.abandonedCount()));
+            printFormat(out, "Last confirmed in %u us over %u rounds, worst %u us\n", unsigned(acks.lastConfirmMicros()),
+                        unsigned(acks.lastRoundCount()), unsigned(acks.worstConfirmMicros()));
+            printFormat(out, "%u resend rounds: %u unicasts, %u broadcasts\n", unsigned(acks.resendCount()),
+                        unsigned(ackUnicasts), unsigned(ackBroadcasts));
+
+            uint64_t missing = acks.missing();
+            if (missing == 0)
+                return;
+            out.print(F("Not yet confirmed:"));
+            for (uint8_t id = 0; id < MAX_ACK_IDS; id++)
+                if (missing >> id & 1)
+                    printFormat(out, " %u", unsigned(id));
+            out.println();
+        }
+
+        void serviceRepeats()
+        {
+            RepeatScheduler::Frame frame;
+            while (repeats.due(millis(), esp_random(), frame))
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+                sendFrame(frame.bytes.data(), frame.length);
+            }
+        }
+
+        // Frames the signal task sent get their repeats and energy accounting here
+
+        void collectSignalFrames()
+        {
+            Message sent;
+            while (signals.takeSent(sent))
+            {
+                energy.addTransmit();
+                repeats.schedule(sent, copiesPerFrame(), millis(), esp_random());
+                trackForAcks(RepeatScheduler::Frame::from(sent), sent.getSequence());
+            }
+        }
+
+        uint32_t copiesPerFrame() const
+        {
+            if (legacyWire)
+                return 1;       // Legacy receivers can't tell copies apart, and would act on each
+
+            if (ackConfirm)
+                return 1;       // Silent receivers get resends instead
+
+            switch (redundancyMode)
+            {
+                case RedundancyMode::Off:       return 1;
+                case RedundancyMode::Fixed:     return fixedCopies;
+                case RedundancyMode::Adaptive:  return copiesFor(link.loss());
+            }
+            return 1;
+        }
+
+        // Closes a probe once its replies have had time to arrive, and sends the next one
+        // when due. Probes only go out while the display is on: the loop light-sleeps
+        // otherwise and would miss the replies.
+
+        void checkLinkProbe()
+        {
+            if (probeOpen && millis() - probeSentMillis >= PROBE_REPLY_MS)
+            {
+                uint32_t replies = manifestMatches.load() + manifestMismatches.load() - probeRepliesAtStart;
+                link.addProbe(replies);
+                countBroadcastReplies(replies);
+                probeOpen = false;
+            }
+
+            if (!probeOpen && millis() - probeSentMillis >= LINK_PROBE_MS &&
+                energy.currentState() == PowerState::DisplayOn)
+                requestManifestHash();
+        }
+
+        void reportRedundancy(Print& out) const
+        {
+            static constexpr std::array<const char*, 3> MODE_NAMES = {{ "off", "fixed", "adaptive" }};
+
+            float loss = link.loss();
+            printFormat(out, "Redundancy %s, %u copies per frame\n", MODE_NAMES[size_t(redundancyMode)],
+                        unsigned(copiesPerFrame()));
+            printFormat(out, "Loss %.1f%% (%s, %u probes, %u receivers heard)\n", loss * 100,
+                        link.hasMeasured() ? "measured" : "assumed", unsigned(link.probes()),
+                        unsigned(link.expectedReplies()));
+
+            for (uint32_t copies = 1; copies <= MAX_COPIES; copies++)
+                printFormat(out, "  K=%u: %7.3f%% delivered, %u us air time per frame\n", unsigned(copies),
+                            deliveryProbability(loss, copies) * 100, unsigned(copies * frameAirtimeMicros()));
+        }
+
+        // 'fullPower' is for the frames that must not be risked on an adapted level: all-off
+        // and channel switches
+
+        bool HOT_PATH sendMessage(const Message& msg, bool fullPower = false)
+        {
+            if (legacyWire)
+            {
+                auto bytes = encodeLegacyMessage(msg);
+                return sendFrame(bytes.data(), bytes.size(), fullPower);
+            }
+            return sendFrame(msg.data(), msg.byte_size(), fullPower);
+        }
+
+        void reportWire(Print& out) const
+        {
+            if (!legacyWire)
+            {
+                printFormat(out, "Current wire format, %u-byte frames\n", unsigned(sizeof(Message)));
+                return;
+            }
+            printFormat(out, "Legacy wire format, %u-byte frames\n", unsigned(LEGACY_MESSAGE_SIZE));
+            out.println(F("One copy per frame, to every group; acks and states need current receivers"));
+        }
+
+        bool HOT_PATH sendFrame(const uint8_t* data, size_t length, bool fullPower = false)
+        {
+            PathScope scope(ProfiledPath::Transmit);
+
+            // The first frame after a press carries the press to send latency
+            int64_t edge = buttonEdgeMicros.exchange(0);
+            if (edge != 0)
+            {
+                uint32_t latency = uint32_t(esp_timer_get_time() - edge);
+                PathProfiler::record(ProfiledPath::PressToSend, latency);
+                cpu.onPressSent(latency);
+            }
+
+            energy.addTransmit();
+            applyTxPower(fullPower ? txPower.fullPower(millis()) : txPower.levelFor(txPower.broadcast(), millis()));
+            return SendOrder::send(RECEIVER_MAC.data(), data, length) != 0;
+        }
+
+        // Initialize the OLED display
+        bool initializeDisplay() 
+        {
+            Heltec.begin(true /*DisplayEnable Enable*/, false /*LoRa Disable*/, true /*Serial Enable*/);
+            Heltec.display->setFont(ArialMT_Plain_16);  // Set a readable font size
+            updateDisplay();  // Show initial display
+            return true;
+        }
+
+        // Update the OLED display with current effect information
+
+        void updateDisplay() 
+        {
+            TraceSpan span(tracer, "updateDisplay");
+            LoopProfiler::StageScope stage(profiler, LoopStage::Display);
+
+            // This code assumes the default screen size of 128x64 pixels
+
+            assert(Heltec.display->width() == 128 && Heltec.display->height() == 64);
+
+            Heltec.display->clear();
+
+            if (showTelemetry)
+            {
+                drawTelemetry();
+                Heltec.display->display();
+                return;
+            }
+            
+            // Display effect index on the left and the battery on the right, unless there is
+            // a manifest mismatch to warn about
+            Heltec.display->setFont(ArialMT_Plain_10);
+
+            if (manifestMismatches.load() != 0)
+            {
+                Heltec.display->setTextAlignment(TEXT_ALIGN_CENTER);
+                Heltec.display->drawString(64, 0, "Manifest mismatch!");
+            }
+            else
+            {
+                // The group is shown in place of "Effect:" unless everyone is addressed
+                char indexStr[30];
+                if (activeGroup == 0)
+                    snprintf(indexStr, sizeof(indexStr), "Effect: %u/%u", unsigned(currentEffect + 1),
+                             unsigned(EFFECTS.size()));
+                else
+                    snprintf(indexStr, sizeof(indexStr), "%u/%u %s", unsigned(currentEffect + 1),
+                             unsigned(EFFECTS.size()), TARGET_GROUPS[activeGroup].name);
+                Heltec.display->setTextAlignment(TEXT_ALIGN_LEFT);
+                Heltec.display->drawString(0, 0, indexStr);
+
+                char batteryStr[16];
+                formatBattery(batteryStr, sizeof(batteryStr));
+                Heltec.display->setTextAlignment(TEXT_ALIGN_RIGHT);
+                Heltec.display->drawString(128, 0, batteryStr);
+            }
+            
+            // Display effect name
+            Heltec.display->setFont(ArialMT_Plain_16);
+            Heltec.display->setTextAlignment(TEXT_ALIGN_CENTER);
+            Heltec.display->drawString(64, 20, EFFECTS[currentEffect].name);
+
+            // Receivers that reported showing something else at the last check
+            if (flaggedReceivers != 0)
+            {
+                char flaggedStr[24];
+                snprintf(flaggedStr, sizeof(flaggedStr), "%u plate%s differ%s", unsigned(flaggedReceivers),
+                         flaggedReceivers == 1 ? "" : "s", flaggedReceivers == 1 ? "s" : "");
+                Heltec.display->setFont(ArialMT_Plain_10);
+                Heltec.display->drawString(64, 37, flaggedStr);
+            }
+            
+            // Draw a progress bar
+            int progressWidth = (currentEffect * 128) / (EFFECTS.size() - 1);
+            Heltec.display->drawProgressBar(0, 50, 128, 10, (progressWidth * 100) / 128);
+            
+            Heltec.display->display();
+        }
+
+        // Battery charge and estimated runtime, e.g. "82% 31h" or "82% 9d"
+
+        void formatBattery(char* buffer, size_t length) const
+        {
+            float    charge  = battery.stateOfCharge();
+            unsigned percent = unsigned(charge * 100 + 0.5f);
+            float    hours   = energy.remainingHours(charge);
+
+            if (hours >= 48)
+                snprintf(buffer, length, "%u%% %ud", percent, unsigned(hours / 24));
+            else
+                snprintf(buffer, length, "%u%% %uh", percent, unsigned(hours));
+        }
+
+        // Configures button with internal pull-up and debouncing
+
+        bool initializeButton() 
+        {
+            button.attach(BUTTON_PIN, INPUT_PULLUP);
+            button.interval(1);
+            button.setPressedState(LOW);
+            attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), onButtonEdge, CHANGE);
+
+            if (ALL_OFF_PIN != GPIO_NUM_NC)
+            {
+                pinMode(ALL_OFF_PIN, INPUT_PULLUP);
+                attachInterrupt(digitalPinToInterrupt(ALL_OFF_PIN), onAllOffEdge, FALLING);
+            }
+
+            // Burst ids and sequence numbers must not repeat across reboots, or receivers
+            // would ignore the first frames as copies
+            allOffBurst = esp_random();
+            sequences.seed(uint16_t(esp_random()));
+            return true;
+        }
+
+        // Sets up WiFi in station mode without connecting to any network
+
+        bool initializeWiFi() 
+        {
+            WiFi.mode(WIFI_STA);
+            return true;
+        }
+
+        // Starts an all-off requested from the ISR and sends the burst's repeats when due.
+        // Once the burst is done the Off state is written straight to flash, rather than
+        // waiting out the settle time, so it survives the power being cut right away.
+
+        void serviceAllOff()
+        {
+            int64_t requested = allOffEdgeMicros.exchange(0);
+            if (requested != 0)
+                allOff(requested);
+
+            if (allOffRemaining == 0 || int32_t(millis() - allOffNextMillis) < 0)
+                return;
+
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+                sendMessage({ESPNowCommand::AllOff, allOffBurst}, true);
+            }
+
+            allOffNextMillis += ALL_OFF_SPACING_MS;
+            if (--allOffRemaining == 0)
+                stateStore.flush();
+        }
+
+        // Blocks for the length of the sweep. The loop overruns its deadline once, which is
+        // not a stall worth recovering from.
+
+        void runBenchmark(Print& out)
+        {
+            Heltec.display->clear();
+            Heltec.display->setFont(ArialMT_Plain_16);
+            Heltec.display->setTextAlignment(TEXT_ALIGN_CENTER);
+            Heltec.display->drawString(64, 24, "Benchmarking");
+            Heltec.display->display();
+
+            // At full power and full clock throughout, so runs compare
+            cpu.boost();
+            bool adaptive = txPower.isEnabled();
+            txPower.setEnabled(false);
+            energy.addTransmit(bench.run(peers, out));
+            txPower.setEnabled(adaptive);
+            profiler.clearMisses();
+            updateDisplay();
+        }
+
+        uint8_t currentChannel() const
+        {
+            uint8_t            channel   = 0;
+            wifi_second_chan_t secondary = WIFI_SECOND_CHAN_NONE;
+            esp_wifi_get_channel(&channel, &secondary);
+            return channel;
+        }
+
+        // Surveys every channel, which blocks the loop for a couple of seconds like the
+        // benchmark does; false if the radio is busy with something that needs it to stay put
+
+        bool runSurvey(Print& out)
+        {
+            if (sniffer.isRunning() || probeStreaming || probeCollecting || channelSwitchTo != 0)
+            {
+                out.println(F("Busy; try again once the capture, probe or channel switch is done"));
+                return false;
+            }
+
+            out.println(F("Surveying channels..."));
+            bool surveyed = survey.run();
+            profiler.clearMisses();
+            if (!surveyed)
+                out.println(F("Can't enable promiscuous mode"));
+            return surveyed;
+        }
+
+        // Announces a move to 'channel' on the current one; serviceChannelSwitch() sends the
+        // repeats and then follows
+
+        void migrateChannel(uint8_t channel, Print& out)
+        {
+            if (channelSwitchTo != 0)
+            {
+                out.println(F("A channel switch is already under way"));
+                return;
+            }
+            if (channel == currentChannel())
+            {
+                printFormat(out, "Already on channel %u\n", unsigned(channel));
+                return;
+            }
+
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+            channelSwitchTo        = channel;
+            channelSwitchSequence  = sequences.take();
+            channelSwitchRemaining = CHANNEL_SWITCH_REPEATS;
+            channelSwitchNextMillis = millis();
+            printFormat(out, "Moving receivers from channel %u to %u\n", unsigned(currentChannel()), unsigned(channel));
+            serviceChannelSwitch();
+        }
+
+        // Once the last repeat has had a spacing to get out, the remote moves too, saves the
+        // channel right away and asks receivers for their state, so the ones that didn't
+        // follow show up as missing
+
+        void serviceChannelSwitch()
+        {
+            if (channelSwitchTo == 0 || int32_t(millis() - channelSwitchNextMillis) < 0)
+                return;
+
+            channelSwitchNextMillis += CHANNEL_SWITCH_SPACING_MS;
+            if (channelSwitchRemaining != 0)
+            {
+                LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+                sendMessage({ESPNowCommand::ChannelSwitch, channelSwitchTo, channelSwitchSequence, ALL_GROUPS}, true);
+                channelSwitchRemaining--;
+                return;
+            }
+
+            esp_wifi_set_channel(channelSwitchTo, WIFI_SECOND_CHAN_NONE);
+            printFormat(Serial, "Now on channel %u\n", unsigned(channelSwitchTo));
+            savedChannel    = channelSwitchTo;
+            channelSwitchTo = 0;
+            stageState();
+            stateStore.flush();
+        }
+
+        void reportChannel(Print& out) const
+        {
+            uint8_t channel = currentChannel();
+            printFormat(out, "Channel %u%s\n", unsigned(channel), savedChannel == 0 ? " (default)" : "");
+            survey.report(out, channel);
+
+            uint8_t quieter = survey.recommend(channel, CHANNEL_MARGIN_PERMILLE);
+            if (quieter != channel)
+                printFormat(out, "Channel %u is quieter; 'channel %u' or 'channel auto' moves there\n", unsigned(quieter),
+                            unsigned(quieter));
+        }
+
+        void reportAllOff(Print& out) const
+        {
+            printFormat(out, "All off: %u bursts, time to dark last %u us, worst %u us\n", unsigned(allOffCount),
+                        unsigned(lastTimeToDark.load()), unsigned(worstTimeToDark.load()));
+        }
+
+        // ESPNOW transmission status callback
+        // Runs on the WiFi task, so it only counts results; reportSendStatus() prints them.
+        // Could be extended for retry logic.
+        static void HOT_PATH onSendCallback(const uint8_t* macAddr, esp_now_send_status_t status) 
+        {
+            SendOrder::onCallback();    // Before anything returns early, or the count drifts
+
+            if (bench.isRunning())
+            {
+                bench.onSent(status == ESP_NOW_SEND_SUCCESS);
+                return;
+            }
+
+            // Probe frames are tallied apart, rather than printed one line each
+            if (probeStreaming)
+            {
+                if (status != ESP_NOW_SEND_SUCCESS)
+                    probeSendFailures++;
+                return;
+            }
+
+            PathScope scope(ProfiledPath::SendCallback);
+            TraceSpan span(tracer, "sendCallback", TraceThread::WiFi);
+
+            signals.onFrameSent();
+
+            // The first frame of an all-off burst has left the radio
+            int64_t since = allOffAwaitingSince.exchange(0);
+            if (since != 0)
+            {
+                uint32_t elapsed = uint32_t(esp_timer_get_time() - since);
+                lastTimeToDark = elapsed;
+                if (elapsed > worstTimeToDark.load())
+                    worstTimeToDark = elapsed;
+            }
+            if (status == ESP_NOW_SEND_SUCCESS)
+                sendSuccesses++;
+            else
+                sendFailures++;
+
+            // Unicasts are ACKed, so their fate steers the link's transmit power
+            if (!std::equal(RECEIVER_MAC.begin(), RECEIVER_MAC.end(), macAddr))
+            {
+                UnicastResult result;
+                std::copy(macAddr, macAddr + result.mac.size(), result.mac.begin());
+                result.delivered = status == ESP_NOW_SEND_SUCCESS;
+
+                portENTER_CRITICAL(&unicastLock);
+                unicastResults.push(result);
+                portEXIT_CRITICAL(&unicastLock);
+            }
+        }
+
+        // Sets the radio's transmit power, in 0.25 dBm steps, unless it is there already.
+        // It holds for every frame sent after, including the vehicle signal task's, which
+        // go out at whatever level the loop last set.
+
+        void applyTxPower(int8_t quarterDbm)
+        {
+            if (quarterDbm != appliedTxPower && esp_wifi_set_max_tx_power(quarterDbm) == ESP_OK)
+                appliedTxPower = quarterDbm;
+        }
+
+        // Called by the roster just before each unicast
+        static void onUnicast(void* context, const MacAddress& mac)
+        {
+            auto& self = *static_cast<NightDriverRemote*>(context);
+            self.applyTxPower(self.txPower.levelFor(self.txPower.peer(mac), millis()));
+        }
+
+        // Feeds the unicast results the send callback queued to their links
+
+        void checkTxPower()
+        {
+            UnicastResult result;
+            for (;;)
+            {
+                portENTER_CRITICAL(&unicastLock);
+                bool received = unicastResults.pop(result);
+                portEXIT_CRITICAL(&unicastLock);
+                if (!received)
+                    break;
+
+                LinkPower& link = txPower.peer(result.mac);
+                if (result.delivered)
+                    link.onDelivered();
+                else
+                    link.onFailed();
+            }
+        }
+
+        // Sends the unicasts the roster held back until a peer table slot came free
+
+        void servicePeers()
+        {
+            if (!peers.hasPending())
+                return;
+
+            LoopProfiler::StageScope stage(profiler, LoopStage::Transmit);
+            peers.sendPending();
+        }
+
+        // Receivers that have lately been answering but didn't this time count as failures
+        // of the broadcast link
+
+        void countBroadcastReplies(uint32_t replies)
+        {
+            uint32_t expected = link.expectedReplies();
+            txPower.broadcast().onDelivered(replies < expected ? replies : expected);
+            txPower.broadcast().onFailed(replies < expected ? expected - replies : 0);
+        }
+
+        void reportTxPower(Print& out) const
+        {
+            printFormat(out, "Transmit power %s; loss target %.0f%%, one level down per %u deliveries\n",
+                        txPower.isEnabled() ? "adaptive" : "full", TX_LOSS_TARGET * 100, unsigned(TX_STEP_DOWN_AFTER));
+            auto row = [&out](const char* name, const LinkPower& link)
+            {
+                printFormat(out, "  %-17s %4.1f dBm, %u delivered, %u failed, %u ramp-ups\n", name, link.dbm(),
+                            unsigned(link.deliveredCount()), unsigned(link.failedCount()), unsigned(link.rampUpCount()));
+            };
+            row("broadcast", txPower.broadcast());
+            for (const TxPowerControl::Peer& peer : txPower.peerLinks())
+            {
+                char mac[18];
+                snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x", peer.mac[0], peer.mac[1], peer.mac[2],
+                         peer.mac[3], peer.mac[4], peer.mac[5]);
+                row(mac, peer.link);
+            }
+            printFormat(out, "Saved %.1f mJ against full power over %u frames, %.1f uJ per command\n",
+                        txPower.savedMicroJoules() / 1000, unsigned(txPower.frameCount()), txPower.savedPerCommand());
+        }
+
+        void reportSendStatus()
+        {
+            for (uint32_t successes = sendSuccesses.load(); reportedSuccesses != successes; reportedSuccesses++)
+                Serial.println(F("Send status: Success"));
+            for (uint32_t failures = sendFailures.load(); reportedFailures != failures; reportedFailures++)
+                Serial.println(F("Send status: Fail"));
+        }
+
+        // Button ISR, on both edges. The debouncing is left to Bounce2; this raises the clock
+        // and timestamps the first edge of a release, which is when a press is acted on, so
+        // the press to send latency can be measured. The press edge wakes the remote from
+        // light sleep, so a wake is behind the release rather than part of the measurement.
+        static void HOT_PATH onButtonEdge()
+        {
+            PathScope scope(ProfiledPath::InputIsr);
+            if ((GPIO.in >> BUTTON_PIN) & 1)
+            {
+                int64_t none = 0;
+                buttonEdgeMicros.compare_exchange_strong(none, esp_timer_get_time());
+            }
+            cpu.boostFromIsr();
+            restoreEdgeTrigger(BUTTON_PIN, GPIO_INTR_ANYEDGE);
+        }
+
+        // All-off switch ISR; update() picks the request up first thing
+        static void HOT_PATH onAllOffEdge()
+        {
+            allOffEdgeMicros = esp_timer_get_time();
+            cpu.boostFromIsr();
+            restoreEdgeTrigger(ALL_OFF_PIN, GPIO_INTR_NEGEDGE);
+        }
+
+        // Arming a pin for light sleep wakeup leaves it level-triggered, which would re-enter
+        // its ISR for as long as the input is held low; put it back on its edge trigger
+        static void HOT_PATH restoreEdgeTrigger(gpio_num_t pin, gpio_int_type_t type)
+        {
+            GPIO.pin[pin].int_type      = type;
+            GPIO.pin[pin].wakeup_enable = 0;
+        }
+
+        // ESPNOW receive callback; runs on the WiFi task, so it only tallies replies
+
+        static void onReceiveCallback(const uint8_t* macAddr, const uint8_t* data, int length)
+        {
+            if (length > 0 && isProbeReport(data, size_t(length)))
+            {
+                ProbeReply reply;
+                if (decodeProbeReport(data, size_t(length), reply.report) != DecodeResult::Ok)
+                    return;
+                std::copy(macAddr, macAddr + reply.mac.size(), reply.mac.begin());
+
+                portENTER_CRITICAL(&probeLock);
+                probeReplies.push(reply);
+                portEXIT_CRITICAL(&probeLock);
+                return;
+            }
+
+            if (length > 0 && isTelemetryFrame(data, size_t(length)))
+            {
+                TelemetryReply reply;
+                if (decodeTelemetry(data, size_t(length), reply.sequence, reply.readings) != DecodeResult::Ok)
+                    return;
+                std::copy(macAddr, macAddr + reply.mac.size(), reply.mac.begin());
+
+                portENTER_CRITICAL(&telemetryLock);
+                telemetryReplies.push(reply);
+                portEXIT_CRITICAL(&telemetryLock);
+                return;
+            }
+
+            Message msg{ESPNowCommand::INVALID, 0};
+            if (length < 0 || decodeMessage(data, size_t(length), msg) != DecodeResult::Ok)
+                return;
+
+            if (msg.getCommand() == ESPNowCommand::ManifestHash)
+            {
+                if (msg.getArgument() == MANIFEST_HASH)
+                    manifestMatches++;
+                else
+                    manifestMismatches++;
+            }
+            else if (msg.getCommand() == ESPNowCommand::Ack)
+            {
+                acks.onAck(msg.getArgument(), msg.getSequence(), macAddr, uint32_t(esp_timer_get_time()));
+            }
+            else if (msg.getCommand() == ESPNowCommand::State)
+            {
+                StateReport report{{}, stateEffect(msg.getArgument()), stateBrightness(msg.getArgument()),
+                                   msg.getSequence()};
+                std::copy(macAddr, macAddr + report.mac.size(), report.mac.begin());
+
+                portENTER_CRITICAL(&stateReplyLock);
+                stateReplies.push(report);
+                portEXIT_CRITICAL(&stateReplyLock);
+            }
+        }
+
+        // Reports manifest replies that arrived since the last call
+
+        void checkManifestReplies()
+        {
+            uint32_t mismatches = manifestMismatches.load();
+            uint32_t matches    = manifestMatches.load();
+            if (mismatches == reportedMismatches && matches == reportedMatches)
+                return;
+
+            if (mismatches != reportedMismatches)
+            {
+                printFormat(Serial, "Receiver manifest does not match ours (%08x); rebuild it from Effects.def\n",
+                            unsigned(MANIFEST_HASH));
+                updateDisplay();
+            }
+
+            reportedMismatches = mismatches;
+            reportedMatches    = matches;
+        }
+
+        // Starts the vehicle signal task, once ESP-NOW is up for it to send with
+
+        bool initializeSignals()
+        {
+            for (const SignalInput& input : SIGNAL_INPUTS)
+                if (input.pin != GPIO_NUM_NC)
+                    power.addWakePin(input.pin);
+
+            signals.setLegacyWire(legacyWire);
+            return signals.begin(SIGNAL_INPUTS, sequences, RECEIVER_MAC.data());
+        }
+
+        // Initializes ESPNOW protocol and registers callback
+
+        bool initializeESPNow() 
+        {
+            if (esp_now_init() != ESP_OK || !SendOrder::begin()) {
+                Serial.println(F("Error initializing ESP-NOW"));
+                return false;
+            }
+
+            esp_now_register_send_cb(onSendCallback);
+            esp_now_register_recv_cb(onReceiveCallback);
+            return true;
+        }
+
+        // Creates the probe stream's timer once, at setup, since creating it later would
+        // allocate. It outlives any reinitialization of ESP-NOW, so a stream under way
+        // carries on (its frames sent meanwhile count as rejected) and stops as usual.
+
+        bool initializeProbeTimer()
+        {
+            esp_timer_create_args_t probeArgs = {};
+            probeArgs.callback = onProbeTimer;
+            probeArgs.arg      = this;
+            probeArgs.name     = "probe";
+            return esp_timer_create(&probeArgs, &probeTimer) == ESP_OK;
+        }
+
+        // Registers the target device(s) as ESPNOW peer(s)
+        
+        bool addPeer() 
+        {
+            esp_now_peer_info_t peerInfo = {};
+            std::copy(RECEIVER_MAC.begin(), RECEIVER_MAC.end(), peerInfo.peer_addr);
+            peerInfo.channel = 0;        // Auto channel selection
+            peerInfo.encrypt = false;    // No encryption for broadcast support
+            peerInfo.ifidx = WIFI_IF_STA;
+
+            if (esp_now_add_peer(&peerInfo) != ESP_OK) 
+            {
+                Serial.println(F("Failed to add peer"));
+                return false;
+            }
+            return true;
+        }
+
+        // Loads the unicast roster
+
+        bool initializePeers()
+        {
+            acks.setFleet(ACK_FLEET_SIZE);
+            peers.setSendHook(onUnicast, this);
+            if (!peers.begin())
+            {
+                Serial.println(F("Failed to load the peer roster"));
+                return false;
+            }
+            return true;
+        }
+
+        // Opens the NVS namespace holding the persisted state
+
+        bool initializeStateStore()
+        {
+            if (!stateStore.begin())
+            {
+                Serial.println(F("Failed to open NVS"));
+                return false;
+            }
+            return true;
+        }
+
+        // Drops the CPU to CPU_IDLE_MHZ until the first input
+
+        bool initializeCpuScaling()
+        {
+            if (!cpu.begin())
+            {
+                Serial.println(F("Failed to set the CPU clock"));
+                return false;
+            }
+            return true;
+        }
+
+        // Starts battery sampling and energy accounting
+
+        bool initializePower()
+        {
+            battery.begin();
+            power.begin();
+            return true;
+        }
+
+        // Saves anything pending and deep-sleeps until the button is pressed; the board
+        // reboots on wake and restoreState() brings the plates back
+
+        void enterDeepSleep()
+        {
+            stateStore.flush();
+            peers.flush();
+            Serial.println(F("Idle, entering deep sleep"));
+            Serial.flush();
+            Heltec.display->displayOff();
+            power.deepSleep();
+        }
+
+        // Parses "<slot>=<effect#>[@brightness]" entries, effect numbers as shown on the OLED;
+        // the brightness defaults to the preset's
+
+        static bool parseStates(const char* args, StatesFrame& states, Print& out)
+        {
+            if (*args == '\0')
+            {
+                out.println(F("Usage: states <slot>=<effect#>[@brightness] ..."));
+                return false;
+            }
+
+            while (*args)
+            {
+                char* end;
+                unsigned long slot   = strtoul(args, &end, 10);
+                bool          valid  = end != args && *end == '=' && slot < UNASSIGNED_SLOT;
+                unsigned long preset = valid ? strtoul(end + 1, &end, 10) : 0;
+                valid = valid && preset >= 1 && preset <= EFFECTS.size();
+
+                unsigned long brightness = valid ? EFFECTS[preset - 1].brightness : 0;
+                if (valid && *end == '@')
+                    brightness = strtoul(end + 1, &end, 10);
+
+                if (!valid || brightness > 255 || (*end != ' ' && *end != '\0'))
+                {
+                    out.println(F("Usage: states <slot>=<effect#>[@brightness] ..."));
+                    return false;
+                }
+
+                if (!states.set({uint8_t(slot), uint8_t(EFFECTS[preset - 1].index), uint8_t(brightness)}))
+                {
+                    printFormat(out, "At most %u states per frame\n", unsigned(MAX_STATE_SLOTS));
+                    return false;
+                }
+
+                args = end;
+                while (*args == ' ')
+                    args++;
+            }
+            return true;
+        }
+
+        void reportEnergy(Print& out) const
+        {
+            printFormat(out, "Battery: %u mV, %u%%\n", unsigned(battery.milliVolts()),
+                        unsigned(battery.stateOfCharge() * 100 + 0.5f));
+
+            static constexpr std::array<const char*, size_t(PowerState::COUNT)> STATE_NAMES =
+                {{ "display on", "display off", "light sleep", "deep sleep" }};
+
+            for (size_t i = 0; i < STATE_NAMES.size(); i++)
+                printFormat(out, "  %-12s %10.1f s at %6.2f mA\n", STATE_NAMES[i], energy.timeIn(PowerState(i)) / 1e6,
+                            energy.stateMilliAmps(PowerState(i)));
+
+            printFormat(out, "  %u frames sent\n", unsigned(energy.framesSent()));
+            printFormat(out, "Average %.2f mA, %.1f h remaining\n", energy.averageMilliAmps(),
+                        energy.remainingHours(battery.stateOfCharge()));
+        }
+
+        // Registers the console commands owned by the remote
+
+        bool initializeConsole()
+        {
+            bool added = true;
+
+            added &= console.addCommand("stats", "Loop timing histogram ('stats reset' clears it)",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "reset") == 0)
+                        self.profiler.reset();
+                    else
+                        self.profiler.report(out);
+                }, this);
+
+            added &= console.addCommand("deadline", "Show or set the loop deadline in ms (10 to 2000)",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (*args)
+                    {
+                        // Too short and every iteration misses, which ends in stall recovery
+                        // and a reboot; too long and no stall is ever seen
+                        char*         end;
+                        unsigned long ms = strtoul(args, &end, 10);
+                        if (!isdigit(static_cast<unsigned char>(*args)) || *end || ms == 0)
+                        {
+                            printFormat(out, "Expected %u to %u ms\n", unsigned(MIN_LOOP_DEADLINE_MS),
+                                        unsigned(MAX_LOOP_DEADLINE_MS));
+                            return;
+                        }
+                        ms = std::min<unsigned long>(std::max<unsigned long>(ms, MIN_LOOP_DEADLINE_MS), MAX_LOOP_DEADLINE_MS);
+                        self.profiler.setDeadline(uint32_t(ms) * 1000);
+                    }
+                    printFormat(out, "Loop deadline: %u ms\n", unsigned(self.profiler.getDeadline() / 1000));
+                }, this);
+
+            added &= console.addCommand("state", "Persisted state ('state save' writes it now)",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "save") == 0)
+                        self.stateStore.flush();
+                    self.stateStore.report(out);
+                }, this);
+
+            added &= console.addCommand("manifest", "Show the effect manifest hash and query receivers",
+                [](void* context, const char*, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    printFormat(out, "Manifest %08x: %u matching, %u mismatched replies\n", unsigned(MANIFEST_HASH),
+                                unsigned(manifestMatches.load()), unsigned(manifestMismatches.load()));
+                    self.requestManifestHash();
+                }, this);
+
+            added &= console.addCommand("battery", "Battery and energy use ('battery project <presses/hour>')",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strncmp(args, "project", 7) == 0)
+                    {
+                        float rate = strtof(args + 7, nullptr);
+                        float milliAmps = EnergyModel::projectAverageMilliAmps(DEFAULT_POWER_PROFILE, POWER_TIMEOUTS, rate, 2);
+                        printFormat(out, "%.1f presses/hour: %.3f mA average, %.1f days on a full battery\n", rate, milliAmps,
+                                    DEFAULT_POWER_PROFILE.batteryMilliAmpHours / milliAmps / 24);
+                    }
+                    else
+                    {
+                        self.reportEnergy(out);
+                    }
+                }, this);
+
+            added &= console.addCommand("trace", "Chrome trace of recent activity: trace [on|off|clear|dump]",
+                [](void*, const char* args, Print& out)
+                {
+                    if (strcmp(args, "dump") == 0)
+                        tracer.writeJson(out);
+                    else if (strcmp(args, "clear") == 0)
+                        tracer.clear();
+                    else if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+                        tracer.setEnabled(strcmp(args, "on") == 0);
+
+                    if (strcmp(args, "dump") != 0)
+                        printFormat(out, "Tracing %s, %u events buffered, %u recorded since boot\n",
+                                    tracer.isEnabled() ? "on" : "off", unsigned(tracer.bufferedCount()),
+                                    unsigned(tracer.recordedCount()));
+                }, this);
+
+            added &= console.addCommand("alloff", "Blank every plate now ('alloff stats' shows time to dark)",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "stats") != 0)
+                        self.allOff(esp_timer_get_time());
+                    self.reportAllOff(out);
+                }, this);
+
+            added &= console.addCommand("redundancy", "Copies per state frame: redundancy [off|auto|<copies>]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    uint32_t copies = strtoul(args, nullptr, 10);
+                    if (strcmp(args, "off") == 0)
+                    {
+                        self.redundancyMode = RedundancyMode::Off;
+                    }
+                    else if (strcmp(args, "auto") == 0)
+                    {
+                        self.redundancyMode = RedundancyMode::Adaptive;
+                    }
+                    else if (copies >= 1 && copies <= MAX_COPIES)
+                    {
+                        self.redundancyMode = RedundancyMode::Fixed;
+                        self.fixedCopies    = copies;
+                    }
+                    self.reportRedundancy(out);
+                }, this);
+
+            added &= console.addCommand("acks", "Acknowledged delivery: acks [on|off|fleet <receivers>]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+                    {
+                        self.ackConfirm = args[1] == 'n';
+                    }
+                    else if (strncmp(args, "fleet ", 6) == 0)
+                    {
+                        uint32_t count = strtoul(args + 6, nullptr, 10);
+                        if (count < 1 || count > MAX_ACK_IDS)
+                        {
+                            printFormat(out, "Fleet must be 1 to %u receivers\n", unsigned(MAX_ACK_IDS));
+                            return;
+                        }
+                        acks.setFleet(count);
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.reportAcks(out);
+                }, this);
+
+            added &= console.addCommand("plates", "Receiver states against the selected one: plates [query]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "query") == 0)
+                    {
+                        self.scheduleStateQuery();
+                        self.stateQueryAtMillis = millis();
+                        out.println(F("Querying; run 'plates' again for the replies"));
+                        return;
+                    }
+                    self.reportReceiverStates(out);
+                }, this);
+
+            added &= console.addCommand("telemetry", "Receiver health: telemetry [show|poll|dump]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "show") == 0)
+                    {
+                        // On the OLED until the next press
+                        self.showTelemetry = true;
+                        if (self.power.noteActivity())
+                            Heltec.display->displayOn();
+                        self.updateDisplay();
+                    }
+                    else if (strcmp(args, "poll") == 0)
+                    {
+                        self.telemetryPolledMillis = millis() - self.telemetry.pollInterval();
+                        out.println(F("Polling; run 'telemetry' again for the replies"));
+                        return;
+                    }
+                    else if (strcmp(args, "dump") == 0)
+                    {
+                        self.dumpTelemetry(out);
+                        return;
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.reportTelemetry(out);
+                }, this);
+
+            added &= console.addCommand("signals", "Vehicle signal inputs, override and edge to air latency",
+                [](void*, const char*, Print& out)
+                {
+                    signals.report(out);
+                }, this);
+
+            added &= console.addCommand("states", "Per-receiver effects: states <slot>=<effect#>[@brightness] ...",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    StatesFrame states{self.sequences.take(), TARGET_GROUPS[self.activeGroup].mask};
+                    if (!parseStates(args, states, out))
+                        return;
+
+                    printFormat(out, "Sending %u states in %u bytes\n", unsigned(states.size()), unsigned(states.byte_size()));
+                    self.setStates(states);
+                    self.reconciling = false;
+                }, this);
+
+            added &= console.addCommand("wire", "Frame layout sent: wire [current|legacy]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "current") == 0 || strcmp(args, "legacy") == 0)
+                    {
+                        self.legacyWire = args[0] == 'l';
+                        self.repeats.clear();
+                        self.signals.setLegacyWire(self.legacyWire);
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.reportWire(out);
+                }, this);
+
+            added &= console.addCommand("group", "Show or pick the receivers addressed: group [name]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (*args)
+                    {
+                        auto match = std::find_if(TARGET_GROUPS.begin(), TARGET_GROUPS.end(),
+                            [args](const TargetGroup& group) { return strcasecmp(group.name, args) == 0; });
+                        if (match == TARGET_GROUPS.end())
+                        {
+                            out.println(F("Unknown group"));
+                            return;
+                        }
+                        self.selectGroup(size_t(match - TARGET_GROUPS.begin()));
+                        self.stageState();
+                        self.updateDisplay();
+                    }
+
+                    for (size_t i = 0; i < TARGET_GROUPS.size(); i++)
+                        printFormat(out, "%c %-6s mask %02x\n", i == self.activeGroup ? '*' : ' ', TARGET_GROUPS[i].name,
+                                    unsigned(TARGET_GROUPS[i].mask));
+                }, this);
+
+            added &= console.addCommand("peers", "Unicast roster: peers [add <mac>|remove <mac>|send]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    MacAddress mac;
+                    if (strncmp(args, "add ", 4) == 0 || strncmp(args, "remove ", 7) == 0)
+                    {
+                        bool adding = args[0] == 'a';
+                        if (!PeerManager::parseMac(args + (adding ? 4 : 7), mac))
+                        {
+                            out.println(F("Expected aa:bb:cc:dd:ee:ff"));
+                            return;
+                        }
+                        if (!(adding ? self.peers.add(mac) : self.peers.remove(mac)))
+                            out.println(adding ? F("Roster full") : F("Not in the roster"));
+                        self.peers.flush();
+                    }
+                    else if (strcmp(args, "send") == 0)
+                    {
+                        // The current effect to each receiver in turn; unicasts are ACKed,
+                        // so no repeats
+                        Message msg{ESPNowCommand::SetEffect, EFFECTS[self.currentEffect].index, self.sequences.take()};
+                        auto   legacy = encodeLegacyMessage(msg);
+                        size_t sent   = self.legacyWire ? self.peers.fanOut(legacy.data(), legacy.size())
+                                                        : self.peers.fanOut(msg.data(), msg.byte_size());
+                        self.energy.addTransmit(sent);
+                        printFormat(out, "Sent to %u of %u receivers\n", unsigned(sent), unsigned(self.peers.size()));
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+
+                    self.peers.report(out);
+                }, this);
+
+            added &= console.addCommand("probe", "Loss test: probe [start [frames] [rate/s] [bytes]]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strncmp(args, "start", 5) == 0)
+                    {
+                        unsigned frames = PROBE_DEFAULT_FRAMES, rate = PROBE_DEFAULT_RATE, bytes = sizeof(Message);
+                        sscanf(args + 5, "%u %u %u", &frames, &rate, &bytes);
+                        if (!self.startProbe(frames, rate, bytes))
+                            printFormat(out, "Can't start: a stream is under way, or not 1-%u frames, 1-%u/s, %u-%u bytes\n",
+                                        unsigned(MAX_PROBE_FRAMES), unsigned(PROBE_MAX_RATE),
+                                        unsigned(PROBE_HEADER_SIZE), unsigned(MAX_PROBE_FRAME_SIZE));
+                        return;
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.reportProbe(out);
+                }, this);
+
+            added &= console.addCommand("sniff", "ESP-NOW capture as pcap: sniff [start|stop]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "start") == 0 && !self.sniffer.isRunning())
+                    {
+                        uint8_t            channel   = 0;
+                        wifi_second_chan_t secondary = WIFI_SECOND_CHAN_NONE;
+                        esp_wifi_get_channel(&channel, &secondary);
+                        printFormat(out, "Capturing on channel %u at %u baud\n", unsigned(channel), unsigned(SNIFFER_BAUD));
+
+                        Serial.flush();
+                        Serial.updateBaudRate(SNIFFER_BAUD);
+                        if (self.sniffer.start())
+                            return;
+                        Serial.updateBaudRate(CONSOLE_BAUD);
+                        out.println(F("Can't enable promiscuous mode"));
+                    }
+                    else if (strcmp(args, "stop") == 0 && self.sniffer.isRunning())
+                    {
+                        // The summary goes out at the capture rate, for the host tool
+                        self.sniffer.stop();
+                        self.sniffer.report(out);
+                        Serial.flush();
+                        Serial.updateBaudRate(CONSOLE_BAUD);
+                        return;
+                    }
+                    else if (*args && strcmp(args, "start") != 0 && strcmp(args, "stop") != 0)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.sniffer.report(out);
+                }, this);
+
+            added &= console.addCommand("channel", "WiFi channel: channel [survey|auto|<1-14>]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "survey") == 0 || strcmp(args, "auto") == 0)
+                    {
+                        if (!self.runSurvey(out))
+                            return;
+                        uint8_t quieter = self.survey.recommend(self.currentChannel(), CHANNEL_MARGIN_PERMILLE);
+                        if (strcmp(args, "auto") == 0 && quieter != self.currentChannel())
+                        {
+                            self.survey.report(out, self.currentChannel());
+                            self.migrateChannel(quieter, out);
+                            return;
+                        }
+                    }
+                    else if (*args)
+                    {
+                        char*         end     = nullptr;
+                        unsigned long channel = strtoul(args, &end, 10);
+                        if (*end || channel < 1 || channel > MAX_WIFI_CHANNEL)
+                        {
+                            out.println(F("Unknown option"));
+                            return;
+                        }
+                        self.migrateChannel(uint8_t(channel), out);
+                        return;
+                    }
+                    self.reportChannel(out);
+                }, this);
+
+            added &= console.addCommand("txpower", "Per-link transmit power: txpower [on|off]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+                    {
+                        self.txPower.setEnabled(args[1] == 'n');
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.reportTxPower(out);
+                }, this);
+
+            added &= console.addCommand("cpufreq", "CPU clock scaling and its cost in latency: cpufreq [on|off]",
+                [](void* context, const char* args, Print& out)
+                {
+                    auto& self = *static_cast<NightDriverRemote*>(context);
+                    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+                    {
+                        self.cpu.setEnabled(args[1] == 'n');
+                    }
+                    else if (*args)
+                    {
+                        out.println(F("Unknown option"));
+                        return;
+                    }
+                    self.cpu.report(out);
+                }, this);
+
+            added &= console.addCommand("bench", "Transmit throughput sweep, printed as JSON",
+                [](void* context, const char*, Print& out)
+                {
+                    static_cast<NightDriverRemote*>(context)->runBenchmark(out);
+                }, this);
+
+            added &= console.addCommand("paths", "Cold and warm timings of the hot paths",
+                [](void*, const char*, Print& out)
+                {
+                    PathProfiler::report(out);
+                }, this);
+
+            if (!added)
+            {
+                Serial.println(F("Console command table full, raise SerialConsole::MAX_COMMANDS"));
+                return false;
+            }
+            return true;
+        }
+
+        // Subscribes the loop task to the task watchdog, which panics and reboots the
+        // board if update() stops returning altogether. IDF 5 (Arduino core 3) takes a
+        // config and has usually started the watchdog already, so it is reconfigured;
+        // like the core's own setting, only core 0's idle task is watched.
+
+        bool initializeWatchdog()
+        {
+#if ESP_IDF_VERSION_MAJOR >= 5
+            const esp_task_wdt_config_t config =
+            {
+                .timeout_ms     = TASK_WDT_TIMEOUT_S * 1000,
+                .idle_core_mask = 1 << 0,
+                .trigger_panic  = true,
+            };
+            esp_err_t started = esp_task_wdt_reconfigure(&config);
+            if (started == ESP_ERR_INVALID_STATE)
+                started = esp_task_wdt_init(&config);
+#else
+            esp_err_t started = esp_task_wdt_init(TASK_WDT_TIMEOUT_S, true);
+#endif
+            if (started != ESP_OK || esp_task_wdt_add(nullptr) != ESP_OK)
+            {
+                Serial.println(F("Failed to start task watchdog"));
+                return false;
+            }
+            return true;
+        }
+
+        // Called when update() keeps overrunning its deadline. Reinitializes whichever
+        // subsystem the time went to, and reboots if that keeps happening.
+
+        void recoverFromStall(LoopStage culprit)
+        {
+            printFormat(Serial, "Loop stalled in stage %s, recovering\n", loopStageName(culprit));
+            profiler.report(Serial);
+
+            uint32_t now = millis();
+            if (now - lastRecovery > RECOVERY_WINDOW_MS)
+                recoveries = 0;
+            lastRecovery = now;
+
+            if (++recoveries > MAX_RECOVERIES)
+            {
+                Serial.println(F("Too many stalls, restarting"));
+                Serial.flush();
+                ESP.restart();
+            }
+
+            switch (culprit)
+            {
+                case LoopStage::Transmit:
+                    esp_now_deinit();
+                    SendOrder::resync();
+                    peers.tableCleared();
+                    if (!initializeESPNow() || !addPeer())
+                    {
+                        Serial.println(F("ESP-NOW failed to come back, restarting"));
+                        Serial.flush();
+                        ESP.restart();
+                    }
+                    break;
+
+                case LoopStage::Display:
+                    Heltec.display->init();
+                    updateDisplay();
+                    break;
+
+                default:
+                    break;
+            }
+
+            profiler.clearMisses();
+        }
+
+        Bounce2::Button button;      // Hardware button with debouncing
+        uint32_t currentEffect = 0;  // Current effect index in EFFECT_NAMES array
+        size_t   activeGroup   = 0;  // Index into TARGET_GROUPS
+
+        SerialConsole console;
+        StateStore    stateStore{STATE_SETTLE_MS};
+        PeerManager   peers{PEER_TABLE_SLOTS, STATE_SETTLE_MS};
+
+        EnergyModel    energy{DEFAULT_POWER_PROFILE};
+        PowerScheduler power{energy, POWER_TIMEOUTS, BUTTON_PIN, ALL_OFF_PIN};
+        BatteryMonitor battery{BATTERY_ADC_PIN, BATTERY_DIVIDER, BATTERY_SAMPLE_MS};
+        LoopProfiler  profiler{LOOP_DEADLINE_MS * 1000};
+        uint32_t      recoveries   = 0;
+        uint32_t      lastRecovery = 0;
+
+        // Redundant broadcast and the loss probes that drive it
+        RedundancyMode  redundancyMode = REDUNDANCY_MODE;
+        uint32_t        fixedCopies    = FIXED_COPIES;
+        RepeatScheduler repeats;
+        LinkEstimator   link;
+        SequenceCounter sequences;
+        uint32_t        probeSentMillis     = 0;
+        uint32_t        probeRepliesAtStart = 0;
+        bool            probeOpen           = false;
+
+        // Receiver state reconciliation; replies are queued by the receive callback
+        StateReconciler reconciler;
+        bool     reconciling          = true;     // False once 'states' gave receivers their own
+        bool     stateQueryDue        = false;
+        bool     stateQueryChanged    = false;
+        uint32_t stateQueryAtMillis   = 0;
+        uint32_t stateQuerySentMillis = 0;
+        size_t   flaggedReceivers     = 0;
+        uint32_t stateResends         = 0;
+        static inline portMUX_TYPE stateReplyLock = portMUX_INITIALIZER_UNLOCKED;
+        static inline StaticRing<StateReport, MAX_RECONCILED_RECEIVERS> stateReplies;
+
+        // Receiver telemetry; replies are queued by the receive callback
+        TelemetryStore telemetry;
+        uint32_t telemetryPolledMillis = 0;
+        uint16_t telemetrySequence     = 0;
+        bool     telemetryOpen         = false;
+        bool     showTelemetry         = false;    // On the OLED instead of the effect
+        uint32_t telemetryUnfiled      = 0;
+        static inline portMUX_TYPE telemetryLock = portMUX_INITIALIZER_UNLOCKED;
+        static inline StaticRing<TelemetryReply, MAX_TELEMETRY_RECEIVERS * 2> telemetryReplies;
+
+        // Acknowledged delivery; the session is shared with the receive callback
+        bool     ackConfirm    = ACK_CONFIRM;
+        uint32_t ackUnicasts   = 0;
+        uint32_t ackBroadcasts = 0;
+        static inline AckSession acks;
+
+        bool legacyWire = LEGACY_WIRE_FORMAT;     // 6-byte frames for receivers not yet upgraded
+
+        // Loss test; the timer sends the stream, the receive callback queues the reports
+        ProbeSession       probeStream;
+        esp_timer_handle_t probeTimer = nullptr;
+        size_t             probeLength = sizeof(Message);
+        uint32_t           probeRate   = PROBE_DEFAULT_RATE;
+        int64_t            probeStartMicros = 0;
+        bool               probeCollecting   = false;      // Asking for reports
+        uint32_t           probeRequestsLeft = 0;
+        uint32_t           probeNextRequestMillis = 0;
+        std::atomic<uint16_t> probeNext{0};
+        std::atomic<uint32_t> probeRejected{0};
+        std::atomic<int64_t>  probeEndMicros{0};
+        static inline std::atomic<bool>     probeStreaming{false};
+        static inline std::atomic<uint32_t> probeSendFailures{0};
+        static inline portMUX_TYPE probeLock = portMUX_INITIALIZER_UNLOCKED;
+        static inline StaticRing<ProbeReply, 4> probeReplies;
+
+        Sniffer sniffer;
+
+        // Channel survey and migration
+        ChannelSurvey survey;
+        uint8_t  savedChannel           = 0;        // As persisted; 0 until the first move
+        uint8_t  channelSwitchTo        = 0;
+        uint16_t channelSwitchSequence  = 0;
+        uint32_t channelSwitchRemaining = 0;
+        uint32_t channelSwitchNextMillis = 0;
+
+        // Takes over the send callback while it runs
+        static inline TxBenchmark bench{RECEIVER_MAC.data(), PEER_TABLE_SLOTS};
+
+        // All-off burst in progress
+        uint32_t allOffBurst      = 0;
+        uint32_t allOffRemaining  = 0;
+        uint32_t allOffNextMillis = 0;
+        uint32_t allOffCount      = 0;
+        bool     holdHandled      = false;
+        bool     pressSeen        = false;
+
+        // All-off requests from the ISR, and time to dark measured by the send callback
+        static inline std::atomic<int64_t>  allOffEdgeMicros{0};
+        static inline std::atomic<int64_t>  allOffAwaitingSince{0};
+        static inline std::atomic<uint32_t> lastTimeToDark{0};
+        static inline std::atomic<uint32_t> worstTimeToDark{0};
+
+        // Vehicle signal overrides; static so the send callback can reach it
+        static inline VehicleSignals signals;
+
+        // Spans from the loop and the WiFi task; static so the radio callback can reach it
+        static inline TraceRecorder tracer;
+
+        // Transmit power per link; the send callback queues unicast results for it
+        TxPowerControl txPower{DEFAULT_POWER_PROFILE.transmitMicros};
+        int8_t         appliedTxPower = 0;
+        static inline portMUX_TYPE unicastLock = portMUX_INITIALIZER_UNLOCKED;
+        static inline StaticRing<UnicastResult, 32> unicastResults;
+
+        // Send results, written from the WiFi task
+        static inline std::atomic<uint32_t> sendSuccesses{0};
+        static inline std::atomic<uint32_t> sendFailures{0};
+        uint32_t reportedSuccesses = 0;
+        uint32_t reportedFailures  = 0;
+
+        // CPU clock; static so the input ISRs can raise it
+        static inline CpuScaler cpu;
+
+        // Time of the last button edge not yet followed by a send, written from the ISR
+        static inline std::atomic<int64_t> buttonEdgeMicros{0};
+
+        // Manifest hash replies, written from the WiFi task
+        static inline std::atomic<uint32_t> manifestMatches{0};
+        static inline std::atomic<uint32_t> manifestMismatches{0};
+        uint32_t reportedMatches    = 0;
+        uint32_t reportedMismatches = 0;
     };
 
 } // anonymous namespace
@@ -278,11 +2457,18 @@ void setup()
     {
         Serial.println(F("Failed to initialize NightDriverRemote"));
     }
-    remote.setEffect(0);  // Start with the first effect
+    LoopProfiler::reportLastReset(Serial);
+    remote.benchmarkIfHeld();
+    PathProfiler::markCold();
+    remote.restoreState();  // Pick up where we were before the power cycle
+    remote.requestManifestHash();
+    HeapWatch::arm();     // Everything after this point is steady state
 }
 
 void loop() 
 {
     remote.update();
-    delay(10);  // Cooperative multitasking delay
+    if (HeapWatch::hasNewRecords())
+        HeapWatch::report(Serial);
+    remote.idle();  // Cooperative multitasking delay, or light sleep when idle
 }
\ No newline at end of file